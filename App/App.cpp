@@ -34,16 +34,29 @@
 #include <string.h>
 #include <assert.h>
 
+#include <atomic>
+#include <chrono>
 #include <fstream>
+#include <thread>
+#include <vector>
 
 #include <unistd.h>
 #include <pwd.h>
+#include <fcntl.h>
+
+#include <openssl/sha.h>
 
 #include "sgx_urts.h"
 #include "sgx_tcrypto.h"
 
 #include "App.h"
 #include "Enclave_u.h"
+#include "cred_db_file.h"
+#include "hotcall.h"
+#include "log_drain.h"
+#include "persist.h"
+#include "tx_confirm.h"
+#include "webauthn_defs.h"
 
 using namespace std;
 
@@ -52,7 +65,7 @@ void fgets_nonewline(char *str, size_t n, FILE *stream);
 
 
 #define MAX_PATH FILENAME_MAX
-#define ENCLAVE_DATA_FILE "enclave_data.seal"
+#define ENCLAVE_DATA_FILE "enclave_data.seal"  /* key pair of older versions, migrated into CRED_DB_FILE */
 
 /* Global EID shared by multiple threads */
 sgx_enclave_id_t global_eid = 0;
@@ -230,39 +243,450 @@ int initialize_enclave(void)
     return 0;
 }
 
+/* Background refill of the enclave's precomputed nonce pool.
+ *   The refill thread occupies a TCS only while it is computing,
+ *   and backs off once the pool is full.
+ */
+static std::atomic<bool> nonce_pool_refill_running(false);
+static std::thread nonce_pool_refill_thread;
+
+static void nonce_pool_refill_loop(void)
+{
+    while (nonce_pool_refill_running) {
+        sgx_status_t status;
+        uint32_t filled = 0;
+
+        sgx_status_t ret = nonce_pool_refill(global_eid, &status, NONCE_POOL_REFILL_BATCH, &filled);
+        if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+            printf("Warning: Nonce pool refill failed (0x%X, 0x%X).\n", ret, status);
+            return;
+        }
+
+        if (filled == 0) {
+            usleep(NONCE_POOL_REFILL_IDLE_US);
+        }
+    }
+}
+
+void start_nonce_pool_refill(void)
+{
+    sgx_status_t status;
+    sgx_status_t ret = nonce_pool_configure(global_eid, &status, NONCE_POOL_CAPACITY);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        printf("Warning: Failed to configure the nonce pool (0x%X, 0x%X).\n", ret, status);
+        return;
+    }
+
+    nonce_pool_refill_running = true;
+    nonce_pool_refill_thread = std::thread(nonce_pool_refill_loop);
+}
+
+void stop_nonce_pool_refill(void)
+{
+    nonce_pool_refill_running = false;
+    if (nonce_pool_refill_thread.joinable()) {
+        nonce_pool_refill_thread.join();
+    }
+}
+
+/* Background refill of the enclave's pool of pre-generated key pairs.
+ *   The enclave only hands out work once the pool is down to its
+ *   low-water mark, so the thread mostly sleeps.
+ */
+static std::atomic<bool> key_pool_refill_running(false);
+static std::thread key_pool_refill_thread;
+
+static void key_pool_refill_loop(void)
+{
+    while (key_pool_refill_running) {
+        sgx_status_t status;
+        uint32_t filled = 0;
+
+        sgx_status_t ret = key_pool_refill(global_eid, &status, KEY_POOL_REFILL_BATCH, &filled);
+        if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+            printf("Warning: Key pool refill failed (0x%X, 0x%X).\n", ret, status);
+            return;
+        }
+
+        if (filled == 0) {
+            usleep(KEY_POOL_REFILL_IDLE_US);
+        }
+    }
+}
+
+void start_key_pool_refill(void)
+{
+    sgx_status_t status;
+    sgx_status_t ret = key_pool_configure(global_eid, &status, KEY_POOL_CAPACITY, KEY_POOL_LOW_WATER);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        printf("Warning: Failed to configure the key pool (0x%X, 0x%X).\n", ret, status);
+        return;
+    }
+
+    key_pool_refill_running = true;
+    key_pool_refill_thread = std::thread(key_pool_refill_loop);
+}
+
+void stop_key_pool_refill(void)
+{
+    key_pool_refill_running = false;
+    if (!key_pool_refill_thread.joinable()) {
+        return;
+    }
+    key_pool_refill_thread.join();
+
+    /* How well the pool kept up with registrations */
+    sgx_status_t status;
+    key_pool_stats_t stats;
+    if (key_pool_get_stats(global_eid, &status, &stats) == SGX_SUCCESS && status == SGX_SUCCESS &&
+        stats.hits + stats.misses) {
+        printf("Key pool: %u of %u ready, %llu registrations served, %llu found it empty.\n",
+               stats.depth, stats.capacity, (unsigned long long)stats.hits, (unsigned long long)stats.misses);
+    }
+}
+
+/* Peak use of the enclave's scratch arenas, what SCRATCH_ARENA_SIZE and
+ *   HeapMaxSize are sized from */
+void print_scratch_stats(void)
+{
+    sgx_status_t status;
+    scratch_stats_t stats;
+    if (scratch_get_stats(global_eid, &status, &stats) == SGX_SUCCESS && status == SGX_SUCCESS &&
+        stats.allocations + stats.fallbacks) {
+        printf("Scratch: peak %u of %u bytes in %u arenas, %llu allocations, %llu from the heap (peak %llu bytes).\n",
+               stats.peak, stats.arena_size, stats.arenas, (unsigned long long)stats.allocations,
+               (unsigned long long)stats.fallbacks, (unsigned long long)stats.fallback_peak);
+    }
+}
+
+/* Provision `count` credentials for `rp_id` in bulk, split between
+ *   MAKE_CREDENTIALS_THREADS concurrent ECALLs that write straight into
+ *   one buffer. Each line of MAKE_CREDENTIALS_FILE is then a credential
+ *   ID and its public key's x and y, in hex.
+ */
+static int make_credentials(const char *rp_id, uint32_t count)
+{
+    std::vector<uint8_t> made((size_t)count * WEBAUTHN_MADE_CREDENTIAL_SIZE);
+    std::vector<std::thread> threads;
+    std::atomic<uint32_t> total(0);
+    std::atomic<bool> failed(false);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t t = 0; t < MAKE_CREDENTIALS_THREADS; t++) {
+        const uint32_t first = (uint32_t)((uint64_t)count * t / MAKE_CREDENTIALS_THREADS);
+        const uint32_t n = (uint32_t)((uint64_t)count * (t + 1) / MAKE_CREDENTIALS_THREADS) - first;
+
+        threads.emplace_back([&, first, n]() {
+            sgx_status_t status;
+            uint32_t done = 0;
+
+            sgx_status_t ret = webauthn_make_credentials(global_eid, &status, rp_id, n,
+                                                         &made[(size_t)first * WEBAUTHN_MADE_CREDENTIAL_SIZE], &done);
+            if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+                printf("Warning: Making credentials failed after %u of %u (0x%X, 0x%X).\n", done, n, ret, status);
+                failed = true;
+            }
+
+            /* Only the first `done` of this share were stored */
+            if (done < n) {
+                memset(&made[(size_t)(first + done) * WEBAUTHN_MADE_CREDENTIAL_SIZE], 0,
+                       (size_t)(n - done) * WEBAUTHN_MADE_CREDENTIAL_SIZE);
+            }
+            total += done;
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    FILE *fp = fopen(MAKE_CREDENTIALS_FILE, "w");
+    if (fp == NULL) {
+        printf("Failed to open %s!\n", MAKE_CREDENTIALS_FILE);
+        return -1;
+    }
+
+    static const uint8_t unused[WEBAUTHN_CREDENTIAL_ID_SIZE] = {0};
+    for (uint32_t c = 0; c < count; c++) {
+        const uint8_t *credential = &made[(size_t)c * WEBAUTHN_MADE_CREDENTIAL_SIZE];
+        const sgx_ec256_public_t *pk = (const sgx_ec256_public_t*)(credential + WEBAUTHN_CREDENTIAL_ID_SIZE);
+        int i;
+
+        if (memcmp(credential, unused, sizeof(unused)) == 0) {
+            continue;
+        }
+        for (i = 0; i < WEBAUTHN_CREDENTIAL_ID_SIZE; i++) {
+            fprintf(fp, "%02x", credential[i]);
+        }
+        fprintf(fp, " ");
+        for (i = SGX_ECP256_KEY_SIZE - 1; i >= 0; i--) {
+            fprintf(fp, "%02x", pk->gx[i]);
+        }
+        fprintf(fp, " ");
+        for (i = SGX_ECP256_KEY_SIZE - 1; i >= 0; i--) {
+            fprintf(fp, "%02x", pk->gy[i]);
+        }
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+
+    printf("Made %u credentials for %s in %.2f s (%.0f/s), listed in %s.\n",
+           total.load(), rp_id, seconds, seconds > 0 ? total / seconds : 0.0, MAKE_CREDENTIALS_FILE);
+    return failed ? -1 : 0;
+}
+
+/* Signature counter log: records framed by their 32-bit size in
+ * SIGN_COUNTER_WAL_FILE, written by the persistence thread */
+static std::atomic<bool> sign_counter_flush_running(false);
+static std::thread sign_counter_flush_thread;
+
+static void sign_counter_flush_loop(void)
+{
+    while (sign_counter_flush_running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(SIGN_COUNTER_FLUSH_INTERVAL_MS));
+
+        sgx_status_t status;
+        sgx_status_t ret = sign_counter_flush(global_eid, &status);
+        if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+            printf("Warning: Signature counter flush failed (0x%X, 0x%X).\n", ret, status);
+        }
+    }
+}
+
+/* Replay the log into the enclave, then start the periodic group commit */
+int start_sign_counters(void)
+{
+    sgx_status_t status;
+    sgx_status_t ret;
+
+    int fd = open(SIGN_COUNTER_WAL_FILE, O_RDONLY);
+    if (fd >= 0) {
+        std::vector<uint8_t> wal;
+        uint8_t buf[65536];
+        ssize_t n;
+
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            wal.insert(wal.end(), buf, buf + n);
+        }
+        close(fd);
+
+        /* A crash can only tear the last record, stop there */
+        size_t offset = 0;
+        while (wal.size() - offset >= sizeof(uint32_t)) {
+            uint32_t record_size;
+            memcpy(&record_size, &wal[offset], sizeof(record_size));
+            offset += sizeof(record_size);
+
+            if (record_size > wal.size() - offset) {
+                break;
+            }
+
+            ret = sign_counter_replay(global_eid, &status, &wal[offset], record_size);
+            if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+                printf("Warning: Skipping a signature counter record (0x%X, 0x%X).\n", ret, status);
+            }
+            offset += record_size;
+        }
+    }
+
+    ret = sign_counter_open(global_eid, &status);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        printf("Error: Failed to open the signature counters (0x%X, 0x%X).\n", ret, status);
+        return -1;
+    }
+
+    sign_counter_flush_running = true;
+    sign_counter_flush_thread = std::thread(sign_counter_flush_loop);
+    return 0;
+}
+
+void stop_sign_counters(void)
+{
+    /* Nothing to close if they were never opened */
+    sign_counter_flush_running = false;
+    if (!sign_counter_flush_thread.joinable()) {
+        return;
+    }
+    sign_counter_flush_thread.join();
+
+    sgx_status_t status;
+    sgx_status_t ret = sign_counter_close(global_eid, &status);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        printf("Warning: Signature counters were not closed cleanly (0x%X, 0x%X).\n", ret, status);
+    }
+}
+
+/* Feed a clientDataJSON too large for a single ECALL to a new enclave stream in chunks */
+static sgx_status_t stream_client_data(const uint8_t *client_data_json, size_t client_data_json_size,
+                                       uint32_t *ret_stream_id)
+{
+    sgx_status_t status;
+
+    sgx_status_t ret = webauthn_stream_begin(global_eid, &status, ret_stream_id);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        return ret ? ret : status;
+    }
+
+    while (client_data_json_size) {
+        const uint32_t n = client_data_json_size < WEBAUTHN_STREAM_CHUNK_MAX ?
+                           (uint32_t)client_data_json_size : WEBAUTHN_STREAM_CHUNK_MAX;
+
+        ret = webauthn_stream_update(global_eid, &status, *ret_stream_id, client_data_json, n);
+        if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+            webauthn_stream_abort(global_eid, &status, *ret_stream_id);
+            return ret ? ret : status;
+        }
+
+        client_data_json += n;
+        client_data_json_size -= n;
+    }
+
+    return SGX_SUCCESS;
+}
+
+/* Sign with a clientDataJSON too large for a single ECALL */
+static sgx_status_t webauthn_get_signature_streamed(const uint8_t *data, uint32_t data_size,
+                                                    const uint8_t *client_data_json, size_t client_data_json_size,
+                                                    sgx_ec256_signature_t *signature)
+{
+    sgx_status_t status;
+    uint32_t stream_id;
+
+    status = stream_client_data(client_data_json, client_data_json_size, &stream_id);
+    if (status) {
+        return status;
+    }
+
+    sgx_status_t ret = webauthn_stream_finish(global_eid, &status, stream_id, data, data_size, signature);
+    return ret ? ret : status;
+}
+
+/* Same for the first half of a transaction, see `confirm_transaction` */
+static sgx_status_t begin_tx_confirmation_streamed(const uint8_t *data, uint32_t data_size,
+                                                   const uint8_t *client_data_json, size_t client_data_json_size,
+                                                   webauthn_tx_handle_t *handle, char *text, uint32_t text_size)
+{
+    sgx_status_t status;
+    uint32_t stream_id;
+
+    status = stream_client_data(client_data_json, client_data_json_size, &stream_id);
+    if (status) {
+        return status;
+    }
+
+    sgx_status_t ret = webauthn_stream_begin_tx(global_eid, &status, stream_id, data, data_size,
+                                                handle, text, text_size);
+    return ret ? ret : status;
+}
+
+/* Wait for the user's decision on a transaction the enclave parked, then
+ *   complete it. No enclave thread is held meanwhile, however long the
+ *   user takes: the decision comes in through TX_CONFIRM_SOCKET.
+ */
+static sgx_status_t confirm_transaction(const webauthn_tx_handle_t *handle, const char *text,
+                                        uint8_t *authenticator_data, sgx_ec256_signature_t *signature,
+                                        bool *accepted)
+{
+    int decision = -1;
+
+    /* The listener on TX_CONFIRM_SOCKET runs from startup to `shutdown_app` */
+    if (tx_confirm_expect(handle->id) == 0) {
+        printf("\nAuthentication text: %s\n", text);
+        printf("Accept or reject with: echo \"%08x yes\" | nc -U %s  (or \"%08x no\")\n",
+               handle->id, TX_CONFIRM_SOCKET, handle->id);
+        decision = tx_confirm_wait(handle->id, TX_CONFIRM_TIMEOUT_MS);
+        printf("\n");
+    }
+
+    *accepted = decision == 1;
+
+    /* Frees the enclave's slot either way */
+    sgx_status_t status;
+    sgx_status_t ret;
+    if (decision < 0) {
+        printf("No decision received, rejecting\n");
+        ret = cancel_tx_confirmation(global_eid, &status, handle);
+    } else {
+        ret = complete_tx_confirmation(global_eid, &status, handle, *accepted ? 1 : 0,
+                                       authenticator_data, signature);
+    }
+    return ret ? ret : status;
+}
+
 /* OCall untrusted functions */
-void untrusted_print_string(const char *str) {
-    /* Proxy/Bridge will check the length and null-terminate 
-     * the input string to prevent buffer overflow. 
-     */
-    printf("%s", str);
+int32_t untrusted_load_enclave_data(uint8_t *sealed_data, const size_t sealed_size) {
+  return persist_load(ENCLAVE_DATA_FILE, sealed_data, sealed_size);
+}
 
-    return;
+int32_t untrusted_cred_db_put(uint64_t page, const uint8_t *credential_id, uint64_t rp_hash,
+                              const uint8_t *sealed, size_t sealed_size,
+                              uint64_t *ret_db, uint64_t *ret_db_size) {
+  const uint8_t *db;
+  const int error = cred_db_file_append(page, credential_id, rp_hash, sealed, sealed_size, &db, ret_db_size);
+
+  *ret_db = (uint64_t)(uintptr_t)db;
+  return error ? 1 : 0;
+}
+
+int32_t untrusted_cred_db_put_pages(const uint8_t *pages, size_t pages_size,
+                                    uint64_t *ret_db, uint64_t *ret_db_size) {
+  const uint8_t *db;
+  const int error = cred_db_file_append_pages(pages, pages_size, &db, ret_db_size);
+
+  *ret_db = (uint64_t)(uintptr_t)db;
+  return error ? 1 : 0;
+}
+
+int32_t untrusted_cred_db_delete(const uint8_t *credential_id, const uint8_t *sealed, size_t sealed_size) {
+  return cred_db_file_delete(credential_id, sealed, sealed_size) ? 1 : 0;
+}
+
+int32_t untrusted_cred_db_update(const uint8_t *updates, size_t updates_size) {
+  return cred_db_file_update(updates, updates_size) ? 1 : 0;
+}
+
+void untrusted_cred_db_release(void) {
+  cred_db_file_release();
 }
 
-void untrusted_get_user_input(char *ret_str, size_t n) {
-  fgets_nonewline(ret_str, n, stdin);
-  return;
+/* Durability callback for signature counter records */
+static void sign_counter_record_persisted(uint64_t seq, int error) {
+  sgx_status_t status;
+  sgx_status_t ret = sign_counter_persisted(global_eid, &status, seq, error);
+  if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+    printf("Warning: Signature counter record %llu was not acknowledged (0x%X, 0x%X).\n",
+           (unsigned long long)seq, ret, status);
+  }
 }
 
-int32_t untrusted_save_enclave_data(const uint8_t *sealed_data, const size_t sealed_size) {
-  ofstream file(ENCLAVE_DATA_FILE, ios::out | ios::binary);
-  if (file.fail()) {
+/* A log record framed by its 32-bit size */
+static std::vector<uint8_t> frame_wal_record(const uint8_t *record, size_t record_size) {
+  const uint32_t frame = (uint32_t)record_size;
+  std::vector<uint8_t> buf(sizeof(frame) + record_size);
+
+  memcpy(&buf[0], &frame, sizeof(frame));
+  memcpy(&buf[sizeof(frame)], record, record_size);
+  return buf;
+}
+
+int32_t untrusted_wal_append(const uint8_t *record, size_t record_size, uint64_t seq) {
+  if (record_size > UINT32_MAX) {
     return 1;
   }
 
-  file.write((const char*)sealed_data, sealed_size);
-  file.close();
+  std::vector<uint8_t> buf = frame_wal_record(record, record_size);
+  persist_append(&buf[0], buf.size(), seq, sign_counter_record_persisted);
   return 0;
 }
 
-int32_t untrusted_load_enclave_data(uint8_t *sealed_data, const size_t sealed_size) {
-  ifstream file(ENCLAVE_DATA_FILE, ios::in | ios::binary);
-  if (file.fail()) {
+/* Replace the log with a single snapshot record */
+int32_t untrusted_wal_reset(const uint8_t *record, size_t record_size, uint64_t seq) {
+  if (record_size > UINT32_MAX) {
     return 1;
   }
-  file.read((char*)sealed_data, sealed_size);
-  file.close();
+
+  std::vector<uint8_t> buf = frame_wal_record(record, record_size);
+  persist_replace(SIGN_COUNTER_WAL_FILE, &buf[0], buf.size(), seq, sign_counter_record_persisted);
   return 0;
 }
 
@@ -309,10 +733,64 @@ void fgets_nonewline(char *str, size_t n, FILE *stream) {
 }
 
 /* Application entry */
+/* Stop everything started after the enclave was created, the threads
+ *   calling into it first and the log drain last. Parts that were never
+ *   started are skipped, so every exit path can call it.
+ */
+static void shutdown_app(void)
+{
+    tx_confirm_stop();
+    hotcall_stop();
+    stop_nonce_pool_refill();
+    stop_key_pool_refill();
+
+    /* Their last records go through the persistence thread */
+    stop_sign_counters();
+    persist_stop();
+    cred_db_file_close();
+
+    print_scratch_stats();
+    sgx_destroy_enclave(global_eid);
+    log_drain_stop();
+}
+
 int SGX_CDECL main(int argc, char *argv[])
 {
-    (void)(argc);
-    (void)(argv);
+    /* `--deterministic` signs with RFC 6979 nonces, e.g. for reproducible benchmarks.
+     * `--rp-id <id>` lets the enclave build authenticatorData for that relying party
+     * instead of signing hex data entered by hand, with the device credential or
+     * the first of the credentials given as `--allow <hex id>` that it knows.
+     * `--cache-budget <bytes>` sizes the enclave's cache of unsealed credentials.
+     * `--make-credentials <n>` first provisions n credentials for the `--rp-id`.
+     * `--hotcall-workers <n>` serves signatures by n threads resident in the enclave */
+    bool deterministic = false;
+    const char *rp_id = NULL;
+    const char *cache_budget = NULL;
+    uint32_t make_count = 0;
+    unsigned int hotcall_workers = 0;
+    std::vector<uint8_t> allow_list;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--deterministic") == 0) {
+            deterministic = true;
+        } else if (strcmp(argv[arg], "--rp-id") == 0 && arg + 1 < argc) {
+            rp_id = argv[++arg];
+        } else if (strcmp(argv[arg], "--cache-budget") == 0 && arg + 1 < argc) {
+            cache_budget = argv[++arg];
+        } else if (strcmp(argv[arg], "--make-credentials") == 0 && arg + 1 < argc) {
+            make_count = (uint32_t)strtoul(argv[++arg], NULL, 0);
+        } else if (strcmp(argv[arg], "--hotcall-workers") == 0 && arg + 1 < argc) {
+            hotcall_workers = (unsigned int)strtoul(argv[++arg], NULL, 0);
+        } else if (strcmp(argv[arg], "--allow") == 0 && arg + 1 < argc) {
+            uint8_t *id;
+            if (hex2buf(argv[++arg], &id) != WEBAUTHN_CREDENTIAL_ID_SIZE) {
+                printf("Credential IDs are %d bytes of hex!\n", WEBAUTHN_CREDENTIAL_ID_SIZE);
+                return -1;
+            }
+            allow_list.insert(allow_list.end(), id, id + WEBAUTHN_CREDENTIAL_ID_SIZE);
+            free(id);
+        }
+    }
 
     /* Initialize the enclave */
     if(initialize_enclave() < 0) {
@@ -325,11 +803,97 @@ int SGX_CDECL main(int argc, char *argv[])
     sgx_status_t status;
     int32_t i;
 
+    /* The enclave logs into host memory from the start, printed by a background thread */
+    log_drain_start();
+
+    enclave_init(global_eid, &status);
+
+    if (status) {
+      printf("Enclave Init Error: %d!\n", status);
+      shutdown_app();
+      return -1;
+    }
+
+    /* Sealed data and counter records are written by a background thread */
+    if (persist_start(SIGN_COUNTER_WAL_FILE) < 0) {
+      printf("Failed to start the persistence thread!\n");
+      shutdown_app();
+      return -1;
+    }
+
+    /* Decisions on transactions, for as long as the app runs */
+    if (tx_confirm_start(TX_CONFIRM_SOCKET) < 0) {
+      printf("Failed to open %s!\n", TX_CONFIRM_SOCKET);
+      shutdown_app();
+      return -1;
+    }
+
+    /* Credentials are read by the enclave straight from the mapped database */
+    uint64_t cred_db_size;
+    const uint8_t *cred_db = NULL;
+
+    if (cache_budget != NULL) {
+      cred_db_set_cache_budget(global_eid, &status, strtoull(cache_budget, NULL, 0));
+
+      if (status) {
+        printf("Cache Budget Error: %d!\n", status);
+        shutdown_app();
+        return -1;
+      }
+    }
+
+    if (cred_db_file_open(CRED_DB_FILE) == 0) {
+      cred_db = cred_db_file_map(&cred_db_size);
+      cred_db_attach(global_eid, &status, cred_db, cred_db_size);
+    }
+
+    if (cred_db == NULL || status) {
+      printf("Failed to open the credential database %s!\n", CRED_DB_FILE);
+      shutdown_app();
+      return -1;
+    }
+
+    /* Recover the signature counters before anything is signed */
+    if (start_sign_counters() < 0) {
+      shutdown_app();
+      return -1;
+    }
+
+    if (deterministic) {
+      set_signing_mode(global_eid, &status, SIGNING_MODE_DETERMINISTIC);
+
+      if (status) {
+        printf("Signing Mode Error: %d!\n", status);
+        shutdown_app();
+        return -1;
+      }
+    } else {
+      /* Precompute signature nonces while waiting for input */
+      start_nonce_pool_refill();
+    }
+
+    /* Key pairs for registrations, generated ahead of time */
+    start_key_pool_refill();
+
+    if (make_count && (rp_id == NULL || make_credentials(rp_id, make_count) < 0)) {
+      if (rp_id == NULL) {
+        printf("--make-credentials needs an --rp-id!\n");
+      }
+      shutdown_app();
+      return -1;
+    }
+
+    /* Without them, signatures are plain ECALLs */
+    if (hotcall_workers && hotcall_start(hotcall_workers) < 0) {
+      printf("Failed to start %u hotcall workers, signing through ECALLs\n", hotcall_workers);
+    }
+
     sgx_ec256_public_t pk;
     get_public_key(global_eid, &status, &pk);
 
     if (status) {
       printf("App Error: %d!\n", status);
+      shutdown_app();
       return -1;
     }
 
@@ -355,47 +919,184 @@ int SGX_CDECL main(int argc, char *argv[])
     printf("\n\n");
 
 
-    // Get the client data for this attestation request
-    const uint32_t client_data_json_size = 1024;
-    char client_data_json[client_data_json_size];
+    // Get the client data for this attestation request, of any length
+    char *client_data_json = NULL;
+    size_t client_data_json_capacity = 0;
 
     printf("Enter client JSON data:\n");
-    fgets_nonewline(client_data_json, client_data_json_size, stdin);
-    printf("\n");
-
-    // Get user input as to what to sign
-    const uint32_t data_to_sign_size = 256;
-    char data_to_sign[data_to_sign_size];
-
-    printf("Enter hex data to sign:\n");
-    fgets_nonewline(data_to_sign, data_to_sign_size, stdin);
+    ssize_t client_data_json_len = getline(&client_data_json, &client_data_json_capacity, stdin);
     printf("\n");
 
-    // Decode the input into a byte array
-    uint8_t *bytes_to_sign;
-    const uint32_t nbytes_to_sign = hex2buf(data_to_sign, &bytes_to_sign);
+    if (client_data_json_len > 0 && client_data_json[client_data_json_len - 1] == '\n') {
+      client_data_json[--client_data_json_len] = '\0';
+    }
 
-    // Error check
-    if (!nbytes_to_sign) {
-      printf("Error receiving data to sign!\n");
+    if (client_data_json_len < 0 || client_data_json_len > UINT32_MAX) {
+      printf("Error receiving client JSON data!\n");
+      free(client_data_json);
+      shutdown_app();
       return -1;
     }
 
+    // Passed with its exact length, no NUL terminator
+    const uint32_t client_data_json_size = (uint32_t)client_data_json_len;
+
     sgx_ec256_signature_t signature;
-    webauthn_get_signature(global_eid, &status, 
-                           bytes_to_sign, nbytes_to_sign,
-                           (const uint8_t*)client_data_json, client_data_json_size,
-                           &signature);
+    uint8_t authenticator_data[WEBAUTHN_AUTHENTICATOR_DATA_SIZE];
+
+    // Transactions are parked in the enclave while the user decides
+    const bool transaction = strstr(client_data_json, WEBAUTHN_TX_AUTH_SIMPLE_TEXT) != NULL;
+    webauthn_tx_handle_t tx_handle;
+    char tx_text[WEBAUTHN_TX_TEXT_MAX + 1];
+    bool accepted = true;
+
+    if (rp_id != NULL && transaction) {
+      uint8_t credential_id[WEBAUTHN_CREDENTIAL_ID_SIZE];
 
-    // Release the input bytes decoded arrays
-    free(bytes_to_sign);
+      begin_tx_assertion(global_eid, &status, rp_id, WEBAUTHN_FLAG_UP,
+                         allow_list.empty() ? NULL : &allow_list[0], allow_list.size(),
+                         (const uint8_t*)client_data_json, client_data_json_size,
+                         &tx_handle, credential_id, tx_text, sizeof(tx_text));
+
+      if (!status) {
+        status = confirm_transaction(&tx_handle, tx_text, authenticator_data, &signature, &accepted);
+      }
+
+      if (!status && accepted) {
+        if (!allow_list.empty()) {
+          printf("Credential ID: ");
+          for (i = 0; i < WEBAUTHN_CREDENTIAL_ID_SIZE; i++) {
+            printf("%02x", credential_id[i]);
+          }
+          printf("\n");
+        }
+        printf("Authenticator data: ");
+        for (i = 0; i < WEBAUTHN_AUTHENTICATOR_DATA_SIZE; i++) {
+          printf("%02x", authenticator_data[i]);
+        }
+        printf("\n");
+      }
+    } else if (rp_id != NULL && !allow_list.empty()) {
+      // All candidates go in at once, the enclave picks the one it has
+      uint8_t credential_id[WEBAUTHN_CREDENTIAL_ID_SIZE];
+
+      webauthn_get_assertion_allow_list(global_eid, &status, rp_id, WEBAUTHN_FLAG_UP,
+                                        &allow_list[0], allow_list.size(),
+                                        (const uint8_t*)client_data_json, client_data_json_size,
+                                        credential_id, authenticator_data, &signature);
+
+      if (!status) {
+        printf("Credential ID: ");
+        for (i = 0; i < WEBAUTHN_CREDENTIAL_ID_SIZE; i++) {
+          printf("%02x", credential_id[i]);
+        }
+        printf("\nAuthenticator data: ");
+        for (i = 0; i < WEBAUTHN_AUTHENTICATOR_DATA_SIZE; i++) {
+          printf("%02x", authenticator_data[i]);
+        }
+        printf("\n");
+      }
+    } else if (rp_id != NULL) {
+      // The enclave hashes the rpId and fills in the flags and its own counter
+      status = hotcall_get_assertion(rp_id, WEBAUTHN_FLAG_UP,
+                                     (const uint8_t*)client_data_json, client_data_json_size,
+                                     authenticator_data, &signature);
+
+      if (!status) {
+        printf("Authenticator data: ");
+        for (i = 0; i < WEBAUTHN_AUTHENTICATOR_DATA_SIZE; i++) {
+          printf("%02x", authenticator_data[i]);
+        }
+        printf("\n");
+      }
+    } else {
+      // Get user input as to what to sign
+      const uint32_t data_to_sign_size = 256;
+      char data_to_sign[data_to_sign_size];
+
+      printf("Enter hex data to sign:\n");
+      fgets_nonewline(data_to_sign, data_to_sign_size, stdin);
+      printf("\n");
+
+      // Decode the input into a byte array
+      uint8_t *bytes_to_sign;
+      const uint32_t nbytes_to_sign = hex2buf(data_to_sign, &bytes_to_sign);
+
+      // Error check
+      if (!nbytes_to_sign) {
+        printf("Error receiving data to sign!\n");
+        free(client_data_json);
+        shutdown_app();
+        return -1;
+      }
+
+      if (transaction) {
+        // The enclave checks the transaction and hands its text out to be shown,
+        // the clientDataJSON gets to it the same ways as below
+        if (client_data_json_size <= WEBAUTHN_CLIENT_DATA_INLINE_MAX) {
+          begin_tx_confirmation(global_eid, &status,
+                                bytes_to_sign, nbytes_to_sign,
+                                (const uint8_t*)client_data_json, client_data_json_size,
+                                &tx_handle, tx_text, sizeof(tx_text));
+        } else if (client_data_json_size <= WEBAUTHN_CLIENT_DATA_MAX_SIZE) {
+          begin_tx_confirmation_large(global_eid, &status,
+                                      bytes_to_sign, nbytes_to_sign,
+                                      (const uint8_t*)client_data_json, client_data_json_size,
+                                      &tx_handle, tx_text, sizeof(tx_text));
+        } else {
+          status = begin_tx_confirmation_streamed(bytes_to_sign, nbytes_to_sign,
+                                                  (const uint8_t*)client_data_json, client_data_json_size,
+                                                  &tx_handle, tx_text, sizeof(tx_text));
+        }
+
+        if (!status) {
+          status = confirm_transaction(&tx_handle, tx_text, authenticator_data, &signature, &accepted);
+        }
+      } else if (client_data_json_size == 0 && nbytes_to_sign == WEBAUTHN_SIGNED_DATA_SIZE) {
+        // No clientDataJSON to check the clientDataHash against, so hash
+        // here and only pass the digest into the enclave
+        sgx_sha256_hash_t digest;
+        SHA256(bytes_to_sign, nbytes_to_sign, digest);
+        status = hotcall_sign_digest(&digest, &signature);
+      } else if (client_data_json_size <= WEBAUTHN_CLIENT_DATA_INLINE_MAX) {
+        // The enclave checks the clientDataHash itself rather than trust
+        // `transaction`, and refuses a transaction it finds
+        webauthn_get_signature(global_eid, &status, 
+                               bytes_to_sign, nbytes_to_sign,
+                               (const uint8_t*)client_data_json, client_data_json_size,
+                               &signature);
+      } else if (client_data_json_size <= WEBAUTHN_CLIENT_DATA_MAX_SIZE) {
+        // Too large to copy in, the enclave reads it from here
+        webauthn_get_signature_large(global_eid, &status,
+                                     bytes_to_sign, nbytes_to_sign,
+                                     (const uint8_t*)client_data_json, client_data_json_size,
+                                     &signature);
+      } else {
+        // Larger still, stream it through in chunks
+        status = webauthn_get_signature_streamed(bytes_to_sign, nbytes_to_sign,
+                                                 (const uint8_t*)client_data_json, client_data_json_size,
+                                                 &signature);
+      }
+
+      // Release the input bytes decoded arrays
+      free(bytes_to_sign);
+    }
+
+    free(client_data_json);
 
     // Check for errors
     if (status) {
       printf("Signature Error: %d!\n", status);
+      shutdown_app();
       return -1;
     }
 
+    if (!accepted) {
+      printf("Authentication rejected\n");
+      shutdown_app();
+      return 0;
+    }
+
     // Print the x and y coordinates of the signature
     printf("Resulting signature: ");
 
@@ -414,7 +1115,7 @@ int SGX_CDECL main(int argc, char *argv[])
     printf("\n");    
 
     /* Destroy the enclave */
-    sgx_destroy_enclave(global_eid);
+    shutdown_app();
     
     return 0;
 }
@@ -52,6 +52,47 @@
 # define TOKEN_FILENAME   "enclave.token"
 # define ENCLAVE_FILENAME "enclave.signed.so"
 
+/* Enclave log messages are printed this often, see log_drain.h */
+# define LOG_DRAIN_INTERVAL_MS 20
+
+/* Precomputed ECDSA nonce pool, see Enclave/nonce_pool.h */
+# define NONCE_POOL_CAPACITY       256
+# define NONCE_POOL_REFILL_BATCH   16     /* entries per refill ECALL */
+# define NONCE_POOL_REFILL_IDLE_US 10000  /* back-off once the pool is full */
+
+/* Pre-generated key pairs for registrations, see Enclave/key_pool.h */
+# define KEY_POOL_CAPACITY       64
+# define KEY_POOL_LOW_WATER      16     /* refilled once it is down to this many */
+# define KEY_POOL_REFILL_BATCH   8      /* pairs per refill ECALL */
+# define KEY_POOL_REFILL_IDLE_US 10000  /* back-off while above the low-water mark */
+
+# define SIGN_COUNTER_WAL_FILE          "sign_counter.wal"
+# define SIGN_COUNTER_FLUSH_INTERVAL_MS 100  /* group commit at least this often */
+
+# define PERSIST_MAX_BATCH    512  /* log appends per write and sync */
+# define PERSIST_RING_ENTRIES 8
+
+# define CRED_DB_FILE      "credentials.db"
+# define CRED_DB_GROW_SIZE (1 << 20)  /* the file grows by this much at a time */
+
+/* Transactions are accepted or rejected through this socket, see tx_confirm.h */
+# define TX_CONFIRM_SOCKET         "tx_confirm.sock"
+# define TX_CONFIRM_TIMEOUT_MS     (120 * 1000)  /* rejected if the user does not decide by then */
+# define TX_CONFIRM_LINE_MAX       64
+# define TX_CONFIRM_READ_TIMEOUT_S 5             /* per confirmer connection */
+
+/* `--make-credentials`: ECALLs run in parallel, each on its own TCS, and
+ * where the IDs and public keys of the new credentials are written */
+# define MAKE_CREDENTIALS_THREADS 5
+# define MAKE_CREDENTIALS_FILE    "made_credentials.txt"
+
+/* `--hotcall-workers`: a submitter polls this many times for its answer
+ * before it sleeps, and then checks this often that workers are left.
+ * Starting them waits at most this long for each to enter the enclave */
+# define HOTCALL_SPINS          20000
+# define HOTCALL_SLEEP_CHECK_MS 100
+# define HOTCALL_START_WAIT_MS  1000
+
 extern sgx_enclave_id_t global_eid;    /* global enclave id */
 
 #if defined(__cplusplus)
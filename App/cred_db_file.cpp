@@ -0,0 +1,708 @@
+/*
+ * cred_db_file.cpp - The credential database file.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "App.h"
+#include "cred_db_defs.h"
+#include "cred_db_file.h"
+
+using namespace std;
+
+static mutex db_mutex;
+static string db_path;
+static int db_fd = -1;
+static uint8_t *db_map = NULL;
+static size_t db_map_size = 0;
+
+/* Mappings the database moved away from. The enclave may still be
+ * reading them until it calls cred_db_file_release */
+static vector<pair<uint8_t*, size_t>> retired_maps;
+
+static cred_db_header_t *header(uint8_t *map)
+{
+    return (cred_db_header_t*)map;
+}
+
+static cred_db_slot_t *id_index(uint8_t *map)
+{
+    return (cred_db_slot_t*)(map + CRED_DB_ID_INDEX_OFFSET);
+}
+
+static cred_db_rp_slot_t *rp_index(uint8_t *map)
+{
+    return (cred_db_rp_slot_t*)(map + CRED_DB_RP_INDEX_OFFSET(header(map)->index_slots));
+}
+
+static cred_db_page_t *page_at(uint8_t *map, uint64_t offset)
+{
+    return (cred_db_page_t*)(map + offset);
+}
+
+/* The page record `ref` is in */
+static cred_db_page_t *page_of(uint8_t *map, uint64_t ref)
+{
+    return page_at(map, CRED_DB_REF_PAGE(ref));
+}
+
+static uint64_t id_hash(const uint8_t id[CRED_DB_ID_SIZE])
+{
+    uint64_t hash;
+    memcpy(&hash, id, sizeof(hash));
+    return hash;
+}
+
+/* FNV-1a, only to tell a torn journal from a complete one */
+static uint64_t page_sum(const uint8_t *page)
+{
+    uint64_t sum = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < CRED_DB_PAGE_SIZE; i++) {
+        sum = (sum ^ page[i]) * 0x100000001b3ULL;
+    }
+    return sum;
+}
+
+/* The index slot of credential `id` in `map`, NULL if there is none */
+static cred_db_slot_t *find_id_slot(uint8_t *map, const uint8_t id[CRED_DB_ID_SIZE])
+{
+    const uint64_t slots = header(map)->index_slots;
+    const uint64_t hash = id_hash(id);
+    cred_db_slot_t *index = id_index(map);
+
+    for (uint64_t probe = 0; probe < slots; probe++) {
+        cred_db_slot_t *slot = &index[(hash + probe) & (slots - 1)];
+
+        if (slot->ref == CRED_DB_SLOT_FREE) {
+            break;
+        }
+        if (slot->ref != CRED_DB_SLOT_DELETED && slot->id_hash == hash &&
+            memcmp(page_of(map, slot->ref)->ids[CRED_DB_REF_INDEX(slot->ref)], id, CRED_DB_ID_SIZE) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/* Index the record `ref` in a free slot; deleted slots are only
+ * reclaimed by `rebuild`, so `used_slots` bounds both indexes */
+static void insert_id_slot(uint8_t *map, uint64_t hash, uint64_t ref)
+{
+    const uint64_t slots = header(map)->index_slots;
+    cred_db_slot_t *index = id_index(map);
+    uint64_t i = hash & (slots - 1);
+
+    while (index[i].ref != CRED_DB_SLOT_FREE) {
+        i = (i + 1) & (slots - 1);
+    }
+
+    index[i].id_hash = hash;
+    index[i].ref = ref;
+    header(map)->used_slots++;
+}
+
+/* The rp index slot of `rp_hash`, taking a new one if it has none */
+static cred_db_rp_slot_t *rp_slot(uint8_t *map, uint64_t rp_hash)
+{
+    const uint64_t slots = header(map)->index_slots;
+    cred_db_rp_slot_t *index = rp_index(map);
+    uint64_t i = rp_hash & (slots - 1);
+
+    while (index[i].used && index[i].rp_hash != rp_hash) {
+        i = (i + 1) & (slots - 1);
+    }
+
+    if (!index[i].used) {
+        index[i].rp_hash = rp_hash;
+        index[i].head = 0;
+        index[i].count = 0;
+        index[i].used = 1;
+    }
+    return &index[i];
+}
+
+/* Put the record `ref` at the head of its relying party's list */
+static void link_record(uint8_t *map, uint64_t ref)
+{
+    cred_db_page_t *page = page_of(map, ref);
+    const uint32_t i = CRED_DB_REF_INDEX(ref);
+    cred_db_rp_slot_t *rp = rp_slot(map, page->rp_hash[i]);
+
+    page->rp_prev[i] = 0;
+    page->rp_next[i] = rp->head;
+    if (rp->head) {
+        page_of(map, rp->head)->rp_prev[CRED_DB_REF_INDEX(rp->head)] = ref;
+    }
+    rp->head = ref;
+    rp->count++;
+}
+
+static void unlink_record(uint8_t *map, uint64_t ref)
+{
+    cred_db_page_t *page = page_of(map, ref);
+    const uint32_t i = CRED_DB_REF_INDEX(ref);
+    cred_db_rp_slot_t *rp = rp_slot(map, page->rp_hash[i]);
+
+    if (page->rp_prev[i]) {
+        page_of(map, page->rp_prev[i])->rp_next[CRED_DB_REF_INDEX(page->rp_prev[i])] = page->rp_next[i];
+    } else {
+        rp->head = page->rp_next[i];
+    }
+    if (page->rp_next[i]) {
+        page_of(map, page->rp_next[i])->rp_prev[CRED_DB_REF_INDEX(page->rp_next[i])] = page->rp_prev[i];
+    }
+    rp->count--;
+}
+
+/* Thread every indexed record into its relying party's list again */
+static void relink(uint8_t *map)
+{
+    const uint64_t slots = header(map)->index_slots;
+    const cred_db_slot_t *index = id_index(map);
+
+    memset(rp_index(map), 0, slots * sizeof(cred_db_rp_slot_t));
+    for (uint64_t i = 0; i < slots; i++) {
+        if (index[i].ref != CRED_DB_SLOT_FREE && index[i].ref != CRED_DB_SLOT_DELETED) {
+            link_record(map, index[i].ref);
+        }
+    }
+}
+
+static size_t round_up_grow(uint64_t size)
+{
+    return (size + CRED_DB_GROW_SIZE - 1) / CRED_DB_GROW_SIZE * CRED_DB_GROW_SIZE;
+}
+
+static void unmap_retired_locked(void)
+{
+    for (size_t i = 0; i < retired_maps.size(); i++) {
+        munmap(retired_maps[i].first, retired_maps[i].second);
+    }
+    retired_maps.clear();
+}
+
+/* Grow the file and the mapping to at least `size` bytes */
+static int reserve(uint64_t size)
+{
+    if (size <= db_map_size) {
+        return 0;
+    }
+
+    const size_t new_size = round_up_grow(size);
+    if (ftruncate(db_fd, new_size)) {
+        return 1;
+    }
+
+    /* Grown in place if there is room, else mapped anew: the enclave may
+     * be reading the old mapping, it must stay until it is released */
+    void *map = mremap(db_map, db_map_size, new_size, 0);
+    if (map == MAP_FAILED) {
+        map = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, db_fd, 0);
+        if (map == MAP_FAILED) {
+            return 1;
+        }
+        retired_maps.emplace_back(db_map, db_map_size);
+    }
+
+    db_map = (uint8_t*)map;
+    db_map_size = new_size;
+    return 0;
+}
+
+/* Write `image` over the page at `offset`, through the journal: a crash
+ * tears at most one of the two copies */
+static int write_page(uint64_t offset, const uint8_t *image)
+{
+    memcpy(db_map + CRED_DB_JOURNAL_OFFSET, image, CRED_DB_PAGE_SIZE);
+    header(db_map)->journal_page = offset;
+    header(db_map)->journal_sum = page_sum(image);
+    if (fdatasync(db_fd)) {
+        return 1;
+    }
+
+    /* The enclave reads pages without waiting for writes, and copies
+     * the page again if it may have caught this one half done */
+    uint64_t *page_seq = &header(db_map)->page_seq;
+    __atomic_store_n(page_seq, *page_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(db_map + offset, image, CRED_DB_PAGE_SIZE);
+    __atomic_store_n(page_seq, *page_seq + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* The page at `offset` with its secrets replaced by `sealed` */
+static void page_image(uint64_t offset, const uint8_t *sealed, size_t sealed_size, uint8_t *image)
+{
+    cred_db_page_t *image_page = (cred_db_page_t*)image;
+
+    memcpy(image, db_map + offset, sizeof(cred_db_page_t));
+    image_page->sealed_size = (uint32_t)sealed_size;
+    memcpy(image + sizeof(cred_db_page_t), sealed, sealed_size);
+    memset(image + sizeof(cred_db_page_t) + sealed_size, 0, CRED_DB_PAGE_SIZE - sizeof(cred_db_page_t) - sealed_size);
+}
+
+/* After a crash, finish the last page write and rebuild the lists, which
+ * may have been torn along with it */
+static int recover(void)
+{
+    cred_db_header_t *h = header(db_map);
+    const uint8_t *journal = db_map + CRED_DB_JOURNAL_OFFSET;
+
+    if (h->journal_page >= CRED_DB_PAGES_OFFSET(h->index_slots) && h->journal_page % CRED_DB_PAGE_SIZE == 0 &&
+        h->journal_page + CRED_DB_PAGE_SIZE <= h->data_end && page_sum(journal) == h->journal_sum) {
+        memcpy(db_map + h->journal_page, journal, CRED_DB_PAGE_SIZE);
+    }
+
+    relink(db_map);
+    h->journal_page = 0;
+    return fdatasync(db_fd) ? 1 : 0;
+}
+
+/* Write an empty database with `slots` index slots to `fd` */
+static int init_file(int fd, uint64_t slots)
+{
+    cred_db_header_t empty;
+
+    memset(&empty, 0, sizeof(empty));
+    empty.magic = CRED_DB_MAGIC;
+    empty.version = CRED_DB_VERSION;
+    empty.index_slots = slots;
+    empty.data_end = CRED_DB_PAGES_OFFSET(slots);
+
+    if (ftruncate(fd, empty.data_end) ||
+        pwrite(fd, &empty, sizeof(empty), 0) != (ssize_t)sizeof(empty) ||
+        fsync(fd)) {
+        return 1;
+    }
+    return 0;
+}
+
+/* Copy the pages with live records into a new file with `slots`-slot
+ * indexes and rename it over the database. Deleted slots and pages with
+ * nothing live left are dropped */
+static int rebuild(uint64_t slots)
+{
+    const string tmp_path = db_path + ".tmp";
+    const uint64_t old_slots = header(db_map)->index_slots;
+    const uint64_t old_size = header(db_map)->data_end - CRED_DB_PAGES_OFFSET(old_slots);
+
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return 1;
+    }
+
+    const size_t map_size = round_up_grow(CRED_DB_PAGES_OFFSET(slots) + old_size);
+    if (init_file(fd, slots) || ftruncate(fd, map_size)) {
+        close(fd);
+        return 1;
+    }
+
+    uint8_t *map = (uint8_t*)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return 1;
+    }
+
+    /* Pages keep their records in place, only their offsets change */
+    unordered_map<uint64_t, uint64_t> moved;
+    const cred_db_slot_t *old_index = id_index(db_map);
+    for (uint64_t i = 0; i < old_slots; i++) {
+        if (old_index[i].ref == CRED_DB_SLOT_FREE || old_index[i].ref == CRED_DB_SLOT_DELETED) {
+            continue;
+        }
+
+        const uint64_t old_page = CRED_DB_REF_PAGE(old_index[i].ref);
+        auto page = moved.find(old_page);
+        if (page == moved.end()) {
+            const uint64_t offset = header(map)->data_end;
+
+            memcpy(map + offset, db_map + old_page, CRED_DB_PAGE_SIZE);
+            header(map)->data_end += CRED_DB_PAGE_SIZE;
+            page = moved.emplace(old_page, offset).first;
+        }
+
+        const uint64_t ref = CRED_DB_REF(page->second, CRED_DB_REF_INDEX(old_index[i].ref));
+        header(map)->num_records++;
+        insert_id_slot(map, old_index[i].id_hash, ref);
+        link_record(map, ref);
+    }
+
+    auto tail = moved.find(header(db_map)->tail_page);
+    header(map)->tail_page = tail != moved.end() ? tail->second : 0;
+
+    if (fdatasync(fd) || rename(tmp_path.c_str(), db_path.c_str())) {
+        munmap(map, map_size);
+        close(fd);
+        return 1;
+    }
+
+    /* Make the rename itself durable */
+    int dir_fd = open(".", O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    retired_maps.emplace_back(db_map, db_map_size);
+    close(db_fd);
+    db_fd = fd;
+    db_map = map;
+    db_map_size = map_size;
+    return 0;
+}
+
+int cred_db_file_open(const char *path)
+{
+    struct stat st;
+
+    lock_guard<mutex> lock(db_mutex);
+
+    db_path = path;
+    db_fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (db_fd < 0) {
+        return 1;
+    }
+
+    if (fstat(db_fd, &st) || (st.st_size == 0 && init_file(db_fd, CRED_DB_INITIAL_SLOTS)) || fstat(db_fd, &st)) {
+        close(db_fd);
+        db_fd = -1;
+        return 1;
+    }
+
+    db_map_size = st.st_size;
+    db_map = (uint8_t*)mmap(NULL, db_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, db_fd, 0);
+    if (db_map == MAP_FAILED) {
+        db_map = NULL;
+        close(db_fd);
+        db_fd = -1;
+        return 1;
+    }
+
+    const cred_db_header_t *h = header(db_map);
+    if (db_map_size < CRED_DB_HEADER_SIZE || h->magic != CRED_DB_MAGIC || h->version != CRED_DB_VERSION ||
+        h->index_slots == 0 || (h->index_slots & (h->index_slots - 1)) || h->index_slots > CRED_DB_MAX_SLOTS ||
+        h->data_end < CRED_DB_PAGES_OFFSET(h->index_slots) || h->data_end > db_map_size ||
+        h->data_end % CRED_DB_PAGE_SIZE) {
+        printf("Error: %s is not a credential database.\n", path);
+        munmap(db_map, db_map_size);
+        db_map = NULL;
+        close(db_fd);
+        db_fd = -1;
+        return 1;
+    }
+
+    /* Not closed cleanly */
+    if (h->journal_page && recover()) {
+        printf("Error: could not recover %s.\n", path);
+        munmap(db_map, db_map_size);
+        db_map = NULL;
+        close(db_fd);
+        db_fd = -1;
+        return 1;
+    }
+
+    /* Left odd by a crash in the middle of a page write, which `recover`
+     * has finished. Else the enclave would take every read for torn */
+    if (header(db_map)->page_seq & 1) {
+        header(db_map)->page_seq++;
+    }
+
+    return 0;
+}
+
+void cred_db_file_close(void)
+{
+    lock_guard<mutex> lock(db_mutex);
+
+    if (db_map != NULL) {
+        /* Every write was synced along with its list links */
+        if (header(db_map)->journal_page) {
+            header(db_map)->journal_page = 0;
+            fdatasync(db_fd);
+        }
+        munmap(db_map, db_map_size);
+        db_map = NULL;
+    }
+    unmap_retired_locked();
+    if (db_fd >= 0) {
+        close(db_fd);
+        db_fd = -1;
+    }
+}
+
+void cred_db_file_release(void)
+{
+    lock_guard<mutex> lock(db_mutex);
+    unmap_retired_locked();
+}
+
+const uint8_t *cred_db_file_map(uint64_t *ret_size)
+{
+    lock_guard<mutex> lock(db_mutex);
+
+    *ret_size = db_map_size;
+    return db_map;
+}
+
+static int append_locked(uint64_t page, const uint8_t id[CRED_DB_ID_SIZE], uint64_t rp_hash,
+                         const uint8_t *sealed, size_t sealed_size)
+{
+    uint8_t image[CRED_DB_PAGE_SIZE];
+    cred_db_page_t *image_page = (cred_db_page_t*)image;
+
+    if (db_map == NULL || sealed_size > CRED_DB_PAGE_SIZE - sizeof(cred_db_page_t)) {
+        return 1;
+    }
+
+    /* The enclave adds to the tail page it was shown, or starts a new one */
+    if (page) {
+        if (page != header(db_map)->tail_page || page_at(db_map, page)->count >= CRED_DB_PAGE_RECORDS) {
+            return 1;
+        }
+        memcpy(image, db_map + page, CRED_DB_PAGE_SIZE);
+    } else {
+        memset(image, 0, sizeof(image));
+    }
+
+    /* Keep the indexes at most half full so probes stay short, rebuilding
+     * at a size that leaves room for as many records again */
+    if ((header(db_map)->used_slots + 1) * 2 > header(db_map)->index_slots) {
+        uint64_t slots = header(db_map)->index_slots;
+        while ((header(db_map)->num_records + 1) * 4 > slots) {
+            slots *= 2;
+        }
+        if (slots > CRED_DB_MAX_SLOTS || rebuild(slots)) {
+            return 1;
+        }
+
+        /* The tail page moved with its list links rewritten, or was dropped
+         * along with its records and only the copy is left */
+        page = page ? header(db_map)->tail_page : 0;
+        if (page) {
+            memcpy(image, db_map + page, CRED_DB_PAGE_SIZE);
+        }
+    }
+
+    const uint64_t offset = page ? page : header(db_map)->data_end;
+    if (reserve(offset + CRED_DB_PAGE_SIZE)) {
+        return 1;
+    }
+
+    const uint32_t i = image_page->count;
+    memcpy(image_page->ids[i], id, CRED_DB_ID_SIZE);
+    image_page->rp_hash[i] = rp_hash;
+    image_page->flags[i] = 0;
+    image_page->count = i + 1;
+    image_page->sealed_size = (uint32_t)sealed_size;
+    memcpy(image + sizeof(cred_db_page_t), sealed, sealed_size);
+    memset(image + sizeof(cred_db_page_t) + sealed_size, 0, sizeof(image) - sizeof(cred_db_page_t) - sealed_size);
+
+    if (write_page(offset, image)) {
+        return 1;
+    }
+
+    /* The record is durable, now make it reachable */
+    const uint64_t ref = CRED_DB_REF(offset, i);
+    link_record(db_map, ref);
+    insert_id_slot(db_map, id_hash(id), ref);
+    header(db_map)->num_records++;
+    if (!page) {
+        header(db_map)->data_end = offset + CRED_DB_PAGE_SIZE;
+    }
+    header(db_map)->tail_page = i + 1 < CRED_DB_PAGE_RECORDS ? offset : 0;
+
+    return fdatasync(db_fd) ? 1 : 0;
+}
+
+int cred_db_file_append(uint64_t page, const uint8_t id[CRED_DB_ID_SIZE], uint64_t rp_hash,
+                        const uint8_t *sealed, size_t sealed_size,
+                        const uint8_t **ret_map, uint64_t *ret_size)
+{
+    lock_guard<mutex> lock(db_mutex);
+
+    const int error = append_locked(page, id, rp_hash, sealed, sealed_size);
+
+    /* Even on failure, the file may have grown or been rebuilt */
+    *ret_map = db_map;
+    *ret_size = db_map_size;
+    return error;
+}
+
+static int append_pages_locked(const uint8_t *pages, uint32_t num_pages)
+{
+    uint64_t new_records = 0;
+
+    if (db_map == NULL || num_pages == 0 || num_pages > CRED_DB_BATCH_PAGES) {
+        return 1;
+    }
+    for (uint32_t p = 0; p < num_pages; p++) {
+        const cred_db_page_t *page = (const cred_db_page_t*)(pages + p * CRED_DB_PAGE_SIZE);
+        if (page->count == 0 || page->count > CRED_DB_PAGE_RECORDS ||
+            page->sealed_size > CRED_DB_PAGE_SIZE - sizeof(cred_db_page_t)) {
+            return 1;
+        }
+        new_records += page->count;
+    }
+
+    /* As in append_locked, for all the records at once */
+    if ((header(db_map)->used_slots + new_records) * 2 > header(db_map)->index_slots) {
+        uint64_t slots = header(db_map)->index_slots;
+        while ((header(db_map)->num_records + new_records) * 4 > slots) {
+            slots *= 2;
+        }
+        if (slots > CRED_DB_MAX_SLOTS || rebuild(slots)) {
+            return 1;
+        }
+    }
+
+    const uint64_t offset = header(db_map)->data_end;
+    if (reserve(offset + (uint64_t)num_pages * CRED_DB_PAGE_SIZE)) {
+        return 1;
+    }
+
+    /* The pages are past `data_end`, only the last goes through the
+     * journal: its sync makes them all durable, and marks the lists for
+     * rebuilding should the links below be torn */
+    for (uint32_t p = 0; p < num_pages; p++) {
+        uint8_t *dst = db_map + offset + p * CRED_DB_PAGE_SIZE;
+        cred_db_page_t *page = (cred_db_page_t*)dst;
+
+        memcpy(dst, pages + p * CRED_DB_PAGE_SIZE, CRED_DB_PAGE_SIZE);
+        memset(page->flags, 0, sizeof(page->flags));
+        memset(page->rp_next, 0, sizeof(page->rp_next));
+        memset(page->rp_prev, 0, sizeof(page->rp_prev));
+    }
+    const uint64_t last = offset + (uint64_t)(num_pages - 1) * CRED_DB_PAGE_SIZE;
+    uint8_t image[CRED_DB_PAGE_SIZE];
+    memcpy(image, db_map + last, CRED_DB_PAGE_SIZE);
+    if (write_page(last, image)) {
+        return 1;
+    }
+
+    header(db_map)->data_end = last + CRED_DB_PAGE_SIZE;
+    for (uint32_t p = 0; p < num_pages; p++) {
+        const uint64_t page_offset = offset + p * CRED_DB_PAGE_SIZE;
+        const cred_db_page_t *page = page_at(db_map, page_offset);
+
+        for (uint32_t i = 0; i < page->count; i++) {
+            const uint64_t ref = CRED_DB_REF(page_offset, i);
+            link_record(db_map, ref);
+            insert_id_slot(db_map, id_hash(page->ids[i]), ref);
+            header(db_map)->num_records++;
+        }
+    }
+
+    /* A short last page takes new records if there is no tail page */
+    if (!header(db_map)->tail_page && page_at(db_map, last)->count < CRED_DB_PAGE_RECORDS) {
+        header(db_map)->tail_page = last;
+    }
+
+    return fdatasync(db_fd) ? 1 : 0;
+}
+
+int cred_db_file_append_pages(const uint8_t *pages, size_t pages_size,
+                              const uint8_t **ret_map, uint64_t *ret_size)
+{
+    lock_guard<mutex> lock(db_mutex);
+
+    const int error = pages_size % CRED_DB_PAGE_SIZE ||
+                      append_pages_locked(pages, (uint32_t)(pages_size / CRED_DB_PAGE_SIZE));
+
+    *ret_map = db_map;
+    *ret_size = db_map_size;
+    return error;
+}
+
+int cred_db_file_delete(const uint8_t id[CRED_DB_ID_SIZE], const uint8_t *sealed, size_t sealed_size)
+{
+    lock_guard<mutex> lock(db_mutex);
+
+    if (db_map == NULL || sealed_size > CRED_DB_PAGE_SIZE - sizeof(cred_db_page_t)) {
+        return 1;
+    }
+
+    cred_db_slot_t *slot = find_id_slot(db_map, id);
+    if (slot == NULL) {
+        return 1;
+    }
+
+    const uint64_t ref = slot->ref;
+    const uint64_t offset = CRED_DB_REF_PAGE(ref);
+    const uint32_t i = CRED_DB_REF_INDEX(ref);
+
+    /* The record stays in its page, without its key, until the page is
+     * dropped by a rebuild */
+    if (sealed_size) {
+        uint8_t image[CRED_DB_PAGE_SIZE];
+
+        page_image(offset, sealed, sealed_size, image);
+        ((cred_db_page_t*)image)->flags[i] |= CRED_DB_RECORD_DELETED;
+
+        if (write_page(offset, image)) {
+            return 1;
+        }
+    } else {
+        page_at(db_map, offset)->flags[i] |= CRED_DB_RECORD_DELETED;
+    }
+
+    unlink_record(db_map, ref);
+    slot->ref = CRED_DB_SLOT_DELETED;
+    header(db_map)->num_records--;
+
+    return fdatasync(db_fd) ? 1 : 0;
+}
+
+int cred_db_file_update(const uint8_t *updates, size_t updates_size)
+{
+    lock_guard<mutex> lock(db_mutex);
+
+    if (db_map == NULL) {
+        return 1;
+    }
+
+    /* Each page goes through the journal on its own; the sync of the
+     * next one's journal also makes this one's in-place copy durable */
+    size_t offset = 0;
+    for (unsigned int pages = 0; offset < updates_size; pages++) {
+        cred_db_update_t update;
+
+        if (pages == CRED_DB_UPDATE_PAGES || updates_size - offset < sizeof(update)) {
+            return 1;
+        }
+        memcpy(&update, updates + offset, sizeof(update));
+        offset += sizeof(update);
+
+        if (update.sealed_size == 0 || update.sealed_size > CRED_DB_PAGE_SIZE - sizeof(cred_db_page_t) ||
+            update.sealed_size > updates_size - offset) {
+            return 1;
+        }
+
+        const cred_db_slot_t *slot = find_id_slot(db_map, update.id);
+        if (slot == NULL) {
+            return 1;
+        }
+
+        const uint64_t page = CRED_DB_REF_PAGE(slot->ref);
+        uint8_t image[CRED_DB_PAGE_SIZE];
+
+        page_image(page, updates + offset, update.sealed_size, image);
+        if (write_page(page, image)) {
+            return 1;
+        }
+        offset += update.sealed_size;
+    }
+
+    return fdatasync(db_fd) ? 1 : 0;
+}
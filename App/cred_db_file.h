@@ -0,0 +1,58 @@
+/*
+ * cred_db_file.h - The credential database file, see cred_db_defs.h.
+ *
+ * The whole file is mapped shared and read in place by the enclave.
+ * Records are added to the tail page, resealed by the enclave, until it
+ * is full. Each page write goes through the journal and is synced before
+ * the index slots, list links and header that point to it, so a crash at
+ * worst leaves an unreferenced record behind; the lists are rebuilt when
+ * the file is opened after one. Deleting a record unlinks it and leaves
+ * a tombstone in the index. Once the indexes are half full they are
+ * rebuilt into a new file holding only the pages with live records.
+ */
+
+#ifndef _CRED_DB_FILE_H_
+#define _CRED_DB_FILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cred_db_defs.h"
+
+/* Open `path`, creating an empty database if it does not exist, 0 on success */
+int cred_db_file_open(const char *path);
+void cred_db_file_close(void);
+
+/* The current mapping of the whole file */
+const uint8_t *cred_db_file_map(uint64_t *ret_size);
+
+/* Unmap the mappings the file has moved away from, once the enclave no
+ * longer reads them */
+void cred_db_file_release(void);
+
+/* Add the record of credential `id`, listed under the relying party
+ * `rp_hash`, to the tail page `page` or to a new page if it is 0. `sealed`
+ * are the page's secrets resealed with the record. 0 once it is on disk;
+ * returns the mapping in any case, it moves when the file grows */
+int cred_db_file_append(uint64_t page, const uint8_t id[CRED_DB_ID_SIZE], uint64_t rp_hash,
+                        const uint8_t *sealed, size_t sealed_size,
+                        const uint8_t **ret_map, uint64_t *ret_size);
+
+/* Add whole pages of new records, `pages_size / CRED_DB_PAGE_SIZE` of them
+ * and at most CRED_DB_BATCH_PAGES, as sealed by the enclave. 0 once they
+ * are on disk; returns the mapping as cred_db_file_append does */
+int cred_db_file_append_pages(const uint8_t *pages, size_t pages_size,
+                              const uint8_t **ret_map, uint64_t *ret_size);
+
+/* Remove credential `id`, writing the secrets of its page resealed
+ * without it unless `sealed_size` is 0. 0 once that is on disk, the
+ * mapping does not move */
+int cred_db_file_delete(const uint8_t id[CRED_DB_ID_SIZE], const uint8_t *sealed, size_t sealed_size);
+
+/* Replace the secrets of up to CRED_DB_UPDATE_PAGES pages, each named
+ * by a cred_db_update_t in `updates` followed by its secrets resealed
+ * with changed records. 0 once all of them are on disk, with one sync
+ * for the lot besides the journal's; the mapping does not move */
+int cred_db_file_update(const uint8_t *updates, size_t updates_size);
+
+#endif /* !_CRED_DB_FILE_H_ */
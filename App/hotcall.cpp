@@ -0,0 +1,244 @@
+/*
+ * hotcall.cpp - Requests served by resident enclave workers.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "sgx_urts.h"
+
+#include "App.h"
+#include "Enclave_u.h"
+#include "hotcall.h"
+#include "hotcall_defs.h"
+
+using namespace std;
+
+/* Never freed, the enclave keeps it once attached */
+static hotcall_ring_t ring __attribute__((aligned(64)));
+static bool ring_attached = false;
+
+static vector<thread> workers;
+static atomic<unsigned int> live_workers(0);
+
+static long futex(uint32_t *word, int op, uint32_t value, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
+
+void untrusted_hotcall_wake(uint32_t call)
+{
+    if (call < HOTCALL_CALLS) {
+        futex(&ring.calls[call].state, FUTEX_WAKE_PRIVATE, 1, NULL);
+    }
+}
+
+static void worker_loop(void)
+{
+    sgx_status_t status = SGX_SUCCESS;
+    sgx_status_t ret = hotcall_worker(global_eid, &status);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        printf("Warning: A hotcall worker failed (0x%X, 0x%X).\n", ret, status);
+    }
+    live_workers--;
+}
+
+int hotcall_start(unsigned int count)
+{
+    sgx_status_t status;
+    unsigned int i;
+
+    if (count == 0 || count > HOTCALL_MAX_WORKERS || !workers.empty()) {
+        return -1;
+    }
+
+    if (!ring_attached) {
+        for (i = 0; i < HOTCALL_RING_SLOTS; i++) {
+            ring.slots[i].seq = i;
+        }
+
+        sgx_status_t ret = hotcall_attach(global_eid, &status, &ring);
+        if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+            printf("Warning: Failed to attach the hotcall ring (0x%X, 0x%X).\n", ret, status);
+            return -1;
+        }
+        ring_attached = true;
+    }
+
+    __atomic_store_n(&ring.stop, 0, __ATOMIC_RELEASE);
+    live_workers = count;
+    for (i = 0; i < count; i++) {
+        workers.push_back(thread(worker_loop));
+    }
+
+    /* Wait for each worker to either settle in its loop or come back
+     * out, e.g. with SGX_ERROR_OUT_OF_TCS */
+    const struct timespec pause = { 0, 1000000L };
+    for (i = 0; i < HOTCALL_START_WAIT_MS; i++) {
+        const unsigned int running = __atomic_load_n(&ring.running, __ATOMIC_ACQUIRE);
+        if (running + (count - live_workers) >= count) {
+            break;
+        }
+        nanosleep(&pause, NULL);
+    }
+
+    /* Without one the calls below are plain ECALLs */
+    if (live_workers == 0) {
+        hotcall_stop();
+        return -1;
+    }
+    return 0;
+}
+
+void hotcall_stop(void)
+{
+    __atomic_store_n(&ring.stop, 1, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+    workers.clear();
+}
+
+/* A free call, HOTCALL_STATE_CLAIMED for the caller to fill in */
+static hotcall_call_t *claim_call(uint32_t *ret_index)
+{
+    /* Start where other submitters are unlikely to look */
+    uint32_t index = (uint32_t)(hash<thread::id>()(this_thread::get_id()) % HOTCALL_CALLS);
+
+    for (;;) {
+        for (uint32_t n = 0; n < HOTCALL_CALLS; n++, index = (index + 1) % HOTCALL_CALLS) {
+            uint32_t expected = HOTCALL_STATE_FREE;
+            if (__atomic_compare_exchange_n(&ring.calls[index].state, &expected, HOTCALL_STATE_CLAIMED, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                *ret_index = index;
+                return &ring.calls[index];
+            }
+        }
+        this_thread::yield();
+    }
+}
+
+/* Bounded MPMC enqueue, see hotcall_defs.h. There are no more calls
+ * than slots, so a slot frees up as soon as a worker takes its call */
+static void ring_put(uint32_t index)
+{
+    uint64_t pos = __atomic_load_n(&ring.enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        hotcall_slot_t *slot = &ring.slots[pos & (HOTCALL_RING_SLOTS - 1)];
+        const uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        const int64_t diff = (int64_t)(seq - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring.enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->call = index;
+                __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+                return;
+            }
+        } else {
+            /* Taken by another submitter, or not yet released by its worker */
+            if (diff < 0) {
+                __builtin_ia32_pause();
+            }
+            pos = __atomic_load_n(&ring.enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Enqueue `call` and wait for its answer. Spins first, a worker usually
+ * answers within microseconds, then sleeps until the worker wakes it */
+static sgx_status_t submit(hotcall_call_t *call, uint32_t index)
+{
+    __atomic_store_n(&call->state, HOTCALL_STATE_PENDING, __ATOMIC_RELEASE);
+    ring_put(index);
+
+    for (uint32_t spins = 0; spins < HOTCALL_SPINS; spins++) {
+        if (__atomic_load_n(&call->state, __ATOMIC_ACQUIRE) == HOTCALL_STATE_DONE) {
+            return (sgx_status_t)call->status;
+        }
+        __builtin_ia32_pause();
+    }
+
+    uint32_t expected = HOTCALL_STATE_PENDING;
+    if (__atomic_compare_exchange_n(&call->state, &expected, HOTCALL_STATE_SLEEPING, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        const struct timespec timeout = { 0, HOTCALL_SLEEP_CHECK_MS * 1000000L };
+
+        while (__atomic_load_n(&call->state, __ATOMIC_ACQUIRE) != HOTCALL_STATE_DONE) {
+            /* No worker is left to answer. The call stays claimed, one
+             * might still get to it if the workers are restarted */
+            if (live_workers == 0) {
+                return SGX_ERROR_UNEXPECTED;
+            }
+            futex(&call->state, FUTEX_WAIT_PRIVATE, HOTCALL_STATE_SLEEPING, &timeout);
+        }
+    }
+
+    return (sgx_status_t)call->status;
+}
+
+sgx_status_t hotcall_sign_digest(const sgx_sha256_hash_t *digest, sgx_ec256_signature_t *ret_signature)
+{
+    sgx_status_t status;
+
+    if (live_workers == 0) {
+        sgx_status_t ret = webauthn_sign_digest(global_eid, &status, digest, ret_signature);
+        return ret != SGX_SUCCESS ? ret : status;
+    }
+
+    uint32_t index;
+    hotcall_call_t *call = claim_call(&index);
+    call->op = HOTCALL_OP_SIGN_DIGEST;
+    call->data_size = sizeof(*digest);
+    memcpy(call->data, digest, sizeof(*digest));
+
+    status = submit(call, index);
+    if (status == SGX_SUCCESS) {
+        *ret_signature = call->signature;
+    }
+
+    __atomic_store_n(&call->state, HOTCALL_STATE_FREE, __ATOMIC_RELEASE);
+    return status;
+}
+
+sgx_status_t hotcall_get_assertion(const char *rp_id, uint8_t flags,
+                                   const uint8_t *client_data_json, uint32_t client_data_json_size,
+                                   uint8_t *ret_authenticator_data, sgx_ec256_signature_t *ret_signature)
+{
+    sgx_status_t status;
+
+    /* Requests too large for a call go the usual way */
+    if (live_workers == 0 || strlen(rp_id) > WEBAUTHN_RP_ID_MAX || client_data_json_size > HOTCALL_DATA_MAX) {
+        sgx_status_t ret = webauthn_get_assertion(global_eid, &status, rp_id, flags,
+                                                  client_data_json, client_data_json_size,
+                                                  ret_authenticator_data, ret_signature);
+        return ret != SGX_SUCCESS ? ret : status;
+    }
+
+    uint32_t index;
+    hotcall_call_t *call = claim_call(&index);
+    call->op = HOTCALL_OP_GET_ASSERTION;
+    call->flags = flags;
+    strcpy(call->rp_id, rp_id);
+    call->data_size = client_data_json_size;
+    memcpy(call->data, client_data_json, client_data_json_size);
+
+    status = submit(call, index);
+    if (status == SGX_SUCCESS) {
+        memcpy(ret_authenticator_data, call->authenticator_data, WEBAUTHN_AUTHENTICATOR_DATA_SIZE);
+        *ret_signature = call->signature;
+    }
+
+    __atomic_store_n(&call->state, HOTCALL_STATE_FREE, __ATOMIC_RELEASE);
+    return status;
+}
@@ -0,0 +1,31 @@
+/*
+ * hotcall.h - Requests served by resident enclave workers.
+ *
+ * `hotcall_start` attaches a request ring to the enclave and starts
+ * threads that enter it for good, see hotcall_defs.h. The calls below
+ * then enqueue their request, wait for a worker to answer it in place
+ * and never enter the enclave themselves. Without workers they are
+ * plain ECALLs.
+ */
+
+#ifndef _HOTCALL_H_
+#define _HOTCALL_H_
+
+#include <stdint.h>
+
+#include "sgx_error.h"
+#include "sgx_tcrypto.h"
+
+/* Start up to HOTCALL_MAX_WORKERS workers, each on a TCS of its own.
+ * Fails if none of them stays in the enclave */
+int hotcall_start(unsigned int workers);
+void hotcall_stop(void);  /* no call may be in progress */
+
+/* As the `webauthn_sign_digest` and `webauthn_get_assertion` ECALLs. A
+ * clientDataJSON over HOTCALL_DATA_MAX bytes takes the ECALL anyway */
+sgx_status_t hotcall_sign_digest(const sgx_sha256_hash_t *digest, sgx_ec256_signature_t *ret_signature);
+sgx_status_t hotcall_get_assertion(const char *rp_id, uint8_t flags,
+                                   const uint8_t *client_data_json, uint32_t client_data_json_size,
+                                   uint8_t *ret_authenticator_data, sgx_ec256_signature_t *ret_signature);
+
+#endif /* !_HOTCALL_H_ */
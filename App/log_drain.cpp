@@ -0,0 +1,121 @@
+/*
+ * log_drain.cpp - Printing the enclave's log.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "sgx_urts.h"
+
+#include "App.h"
+#include "Enclave_u.h"
+#include "log_drain.h"
+#include "log_ring_defs.h"
+
+using namespace std;
+
+/* Never freed, see `log_drain_stop` */
+static log_ring_t ring __attribute__((aligned(64)));
+
+static mutex drain_mutex;
+static uint64_t next_seq = 1;   /* under `drain_mutex`, like `lost` */
+static uint64_t lost = 0;
+
+static atomic<bool> drain_running(false);
+static thread drain_thread;
+
+static const char *level_name(uint32_t level)
+{
+    switch (level) {
+    case LOG_LEVEL_DEBUG: return "debug";
+    case LOG_LEVEL_INFO:  return "info";
+    case LOG_LEVEL_WARN:  return "warning";
+    case LOG_LEVEL_ERROR: return "error";
+    default:              return "?";
+    }
+}
+
+/* Print every message written since the last drain */
+static void drain(void)
+{
+    lock_guard<mutex> lock(drain_mutex);
+
+    for (;;) {
+        log_ring_entry_t *entry = &ring.entries[(next_seq - 1) % LOG_RING_ENTRIES];
+
+        /* Not written yet, or still being written */
+        const uint64_t seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        if (seq < next_seq) {
+            return;
+        }
+
+        if (seq == next_seq) {
+            char message[LOG_RING_MESSAGE_MAX];
+            const uint32_t level = entry->level;
+            uint32_t size = entry->size < LOG_RING_MESSAGE_MAX ? entry->size : LOG_RING_MESSAGE_MAX;
+            memcpy(message, entry->message, size);
+
+            /* Still the same message once copied */
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq) {
+                while (size && message[size - 1] == '\n') {
+                    size--;
+                }
+                printf("Enclave %s: %.*s\n", level_name(level), (int)size, message);
+                next_seq++;
+                continue;
+            }
+        }
+
+        /* Overwritten: the enclave wrapped around since. Skip to the oldest
+         * message that may be left once the newer one is in place */
+        const uint64_t newer = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        if (newer < next_seq + LOG_RING_ENTRIES) {
+            return;
+        }
+        lost += newer - LOG_RING_ENTRIES + 1 - next_seq;
+        next_seq = newer - LOG_RING_ENTRIES + 1;
+    }
+}
+
+static void drain_loop(void)
+{
+    while (drain_running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(LOG_DRAIN_INTERVAL_MS));
+        drain();
+    }
+}
+
+int log_drain_start(void)
+{
+    sgx_status_t status;
+    sgx_status_t ret = log_ring_attach(global_eid, &status, &ring);
+    if (ret != SGX_SUCCESS || status != SGX_SUCCESS) {
+        printf("Warning: Failed to attach the enclave log (0x%X, 0x%X).\n", ret, status);
+        return -1;
+    }
+
+    drain_running = true;
+    drain_thread = std::thread(drain_loop);
+    return 0;
+}
+
+void log_drain_stop(void)
+{
+    drain_running = false;
+    if (!drain_thread.joinable()) {
+        return;
+    }
+    drain_thread.join();
+
+    drain();
+    if (lost) {
+        printf("Warning: %llu enclave log messages were overwritten before they were printed.\n",
+               (unsigned long long)lost);
+    }
+}
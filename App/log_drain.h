@@ -0,0 +1,19 @@
+/*
+ * log_drain.h - Printing the enclave's log.
+ *
+ * The enclave stores its messages into a ring in host memory, see
+ * log_ring_defs.h. A thread here prints them every LOG_DRAIN_INTERVAL_MS,
+ * so logging in the enclave never costs an enclave exit.
+ */
+
+#ifndef _LOG_DRAIN_H_
+#define _LOG_DRAIN_H_
+
+/* Attach the ring to the enclave and start printing, before any other ECALL */
+int log_drain_start(void);
+
+/* Print what is left and stop. The ring itself stays allocated, the
+ * enclave may still write to it until it is destroyed */
+void log_drain_stop(void);
+
+#endif /* !_LOG_DRAIN_H_ */
@@ -0,0 +1,336 @@
+/*
+ * persist.cpp - Asynchronous persistence of sealed enclave data.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(HAVE_LIBURING)
+#include <liburing.h>
+#endif
+
+#include "App.h"
+#include "persist.h"
+
+using namespace std;
+
+typedef struct {
+    bool append;            /* else replace `path` */
+    string path;
+    vector<uint8_t> data;
+    uint64_t tag;
+    persist_callback_t done;
+} persist_job_t;
+
+static mutex queue_mutex;
+static condition_variable queue_cond;
+static deque<persist_job_t> queue;
+static bool stopping = false;
+static thread persist_thread;
+
+/* Latest contents of every replaced file, for `persist_load` */
+static mutex latest_mutex;
+static map<string, vector<uint8_t> > latest;
+
+/* Log state, only touched by the persistence thread after start */
+static string log_path;
+static int log_fd = -1;
+static off_t log_offset = 0;
+
+#if defined(HAVE_LIBURING)
+static struct io_uring ring;
+#endif
+
+/* Write `iov` at `log_offset` and sync the data, 0 on success */
+static int write_log(struct iovec *iov, int iov_count, size_t total)
+{
+#if defined(HAVE_LIBURING)
+    /* The write and the sync in one submission, the sync linked after the write */
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_writev(sqe, log_fd, iov, iov_count, log_offset);
+    sqe->flags |= IOSQE_IO_LINK;
+
+    sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_fsync(sqe, log_fd, IORING_FSYNC_DATASYNC);
+
+    if (io_uring_submit_and_wait(&ring, 2) < 0) {
+        return 1;
+    }
+
+    int error = 0;
+    for (int i = 0; i < 2; i++) {
+        struct io_uring_cqe *cqe;
+        if (io_uring_wait_cqe(&ring, &cqe) < 0) {
+            return 1;
+        }
+        /* A short write also cancels the linked sync */
+        if (cqe->res < 0 || (i == 0 && (size_t)cqe->res != total)) {
+            error = 1;
+        }
+        io_uring_cqe_seen(&ring, cqe);
+    }
+    if (error) {
+        return 1;
+    }
+#else
+    size_t done = 0;
+    while (done < total) {
+        ssize_t n = pwritev(log_fd, iov, iov_count, log_offset + done);
+        if (n <= 0) {
+            return 1;
+        }
+        done += n;
+
+        /* Skip what the short write already covered */
+        while (iov_count && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count) {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    if (fdatasync(log_fd)) {
+        return 1;
+    }
+#endif
+
+    log_offset += total;
+    return 0;
+}
+
+/* Write a whole file next to `path`, sync it and rename it over `path` */
+static int replace_file(const string &path, const vector<uint8_t> &data)
+{
+    const string tmp_path = path + ".tmp";
+
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return 1;
+    }
+
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(fd, &data[done], data.size() - done);
+        if (n <= 0) {
+            close(fd);
+            return 1;
+        }
+        done += n;
+    }
+
+    if (fsync(fd)) {
+        close(fd);
+        return 1;
+    }
+    close(fd);
+
+    if (rename(tmp_path.c_str(), path.c_str())) {
+        return 1;
+    }
+
+    /* Make the rename itself durable */
+    int dir_fd = open(".", O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    /* Appends continue after the new contents */
+    if (path == log_path) {
+        if (log_fd >= 0) {
+            close(log_fd);
+        }
+        log_fd = open(log_path.c_str(), O_WRONLY);
+        log_offset = data.size();
+        if (log_fd < 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* One write and one sync for a run of appends */
+static void append_batch(deque<persist_job_t> &jobs, size_t count)
+{
+    vector<struct iovec> iov(count);
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        iov[i].iov_base = &jobs[i].data[0];
+        iov[i].iov_len = jobs[i].data.size();
+        total += jobs[i].data.size();
+    }
+
+    const int error = (log_fd < 0) ? 1 : write_log(&iov[0], (int)count, total);
+
+    for (size_t i = 0; i < count; i++) {
+        if (jobs[i].done) {
+            jobs[i].done(jobs[i].tag, error);
+        }
+    }
+}
+
+static void persist_loop(void)
+{
+    for (;;) {
+        deque<persist_job_t> jobs;
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            queue_cond.wait(lock, [] { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+            jobs.swap(queue);
+        }
+
+        /* Everything queued meanwhile is handled in order, consecutive appends as one batch */
+        while (!jobs.empty()) {
+            size_t count = 0;
+            while (count < jobs.size() && count < PERSIST_MAX_BATCH && jobs[count].append) {
+                count++;
+            }
+
+            if (count) {
+                append_batch(jobs, count);
+                jobs.erase(jobs.begin(), jobs.begin() + count);
+                continue;
+            }
+
+            persist_job_t &job = jobs.front();
+            const int error = replace_file(job.path, job.data);
+            if (job.done) {
+                job.done(job.tag, error);
+            }
+            jobs.pop_front();
+        }
+    }
+}
+
+static void enqueue(persist_job_t &job)
+{
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        queue.push_back(std::move(job));
+    }
+    queue_cond.notify_one();
+}
+
+int persist_start(const char *path)
+{
+    log_path = path;
+    log_fd = open(path, O_WRONLY | O_CREAT, 0600);
+    if (log_fd < 0) {
+        return -1;
+    }
+    log_offset = lseek(log_fd, 0, SEEK_END);
+
+#if defined(HAVE_LIBURING)
+    if (io_uring_queue_init(PERSIST_RING_ENTRIES, &ring, 0) < 0) {
+        close(log_fd);
+        log_fd = -1;
+        return -1;
+    }
+#endif
+
+    stopping = false;
+    persist_thread = thread(persist_loop);
+    return 0;
+}
+
+void persist_stop(void)
+{
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_cond.notify_one();
+
+    if (!persist_thread.joinable()) {
+        return;
+    }
+    persist_thread.join();
+
+#if defined(HAVE_LIBURING)
+    io_uring_queue_exit(&ring);
+#endif
+
+    if (log_fd >= 0) {
+        close(log_fd);
+        log_fd = -1;
+    }
+}
+
+void persist_append(const uint8_t *data, size_t size, uint64_t tag, persist_callback_t done)
+{
+    persist_job_t job;
+    job.append = true;
+    job.data.assign(data, data + size);
+    job.tag = tag;
+    job.done = done;
+    enqueue(job);
+}
+
+void persist_replace(const char *path, const uint8_t *data, size_t size, uint64_t tag, persist_callback_t done)
+{
+    persist_job_t job;
+    job.append = false;
+    job.path = path;
+    job.data.assign(data, data + size);
+    job.tag = tag;
+    job.done = done;
+
+    {
+        lock_guard<mutex> lock(latest_mutex);
+        latest[job.path] = job.data;
+    }
+    enqueue(job);
+}
+
+int persist_load(const char *path, uint8_t *data, size_t size)
+{
+    lock_guard<mutex> lock(latest_mutex);
+
+    map<string, vector<uint8_t> >::iterator it = latest.find(path);
+    if (it == latest.end()) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return 1;
+        }
+
+        vector<uint8_t> contents;
+        uint8_t buf[4096];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            contents.insert(contents.end(), buf, buf + n);
+        }
+        close(fd);
+
+        if (n < 0) {
+            return 1;
+        }
+        it = latest.insert(make_pair(string(path), contents)).first;
+    }
+
+    if (it->second.size() < size) {
+        return 1;
+    }
+    if (size) {
+        memcpy(data, &it->second[0], size);
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * persist.h - Asynchronous persistence of sealed enclave data.
+ *
+ * Writes are queued and the caller returns at once, typically straight
+ * back into the enclave. A dedicated thread batches queued appends to
+ * the log into a single write and sync (io_uring when built with
+ * HAVE_LIBURING, pwritev and fdatasync otherwise) and reports each
+ * write through its callback once it is durable.
+ */
+
+#ifndef _PERSIST_H_
+#define _PERSIST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Runs on the persistence thread, `error` is 0 once the data is on disk */
+typedef void (*persist_callback_t)(uint64_t tag, int error);
+
+int persist_start(const char *log_path);
+void persist_stop(void);  /* finishes every queued write first */
+
+/* Append `data` to the log */
+void persist_append(const uint8_t *data, size_t size, uint64_t tag, persist_callback_t done);
+
+/* Atomically replace the contents of `path`, which may be the log */
+void persist_replace(const char *path, const uint8_t *data, size_t size, uint64_t tag, persist_callback_t done);
+
+/* The latest contents of `path` (served from memory when it was queued for
+ * replacement), 0 on success. Fails if there are fewer than `size` bytes */
+int persist_load(const char *path, uint8_t *data, size_t size);
+
+#endif /* !_PERSIST_H_ */
@@ -0,0 +1,226 @@
+/*
+ * tx_confirm.cpp - The user's decisions on pending transactions.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "App.h"
+#include "tx_confirm.h"
+#include "webauthn_defs.h"
+
+using namespace std;
+
+typedef struct {
+    int event_fd;           /* signalled once `decision` is set */
+    int decision;           /* 1 accept, 0 reject, -1 none yet */
+} tx_waiter_t;
+
+static mutex waiters_mutex;
+static map<uint32_t, tx_waiter_t> waiters;
+
+static string socket_path;
+static int listen_fd = -1;
+static int stop_fd = -1;    /* eventfd, wakes the listener to stop */
+static thread listener;
+
+/* Read one decision from a confirmer and answer "ok" or "unknown" */
+static void read_decision(int fd)
+{
+    char line[TX_CONFIRM_LINE_MAX + 1];
+    size_t size = 0;
+
+    /* A confirmer that goes quiet is dropped, the next one may be waiting */
+    struct timeval timeout = { TX_CONFIRM_READ_TIMEOUT_S, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    while (size < TX_CONFIRM_LINE_MAX && memchr(line, '\n', size) == NULL) {
+        ssize_t n = read(fd, line + size, TX_CONFIRM_LINE_MAX - size);
+        if (n <= 0) {
+            break;
+        }
+        size += n;
+    }
+    line[size] = '\0';
+
+    unsigned int id;
+    char answer[4];
+    int decision = -1;
+    if (sscanf(line, "%x %3s", &id, answer) == 2) {
+        if (strcmp(answer, "yes") == 0) {
+            decision = 1;
+        } else if (strcmp(answer, "no") == 0) {
+            decision = 0;
+        }
+    }
+
+    bool known = false;
+    if (decision >= 0) {
+        lock_guard<mutex> lock(waiters_mutex);
+
+        map<uint32_t, tx_waiter_t>::iterator it = waiters.find(id);
+        if (it != waiters.end() && it->second.decision < 0) {
+            const uint64_t one = 1;
+            it->second.decision = decision;
+            known = write(it->second.event_fd, &one, sizeof(one)) == sizeof(one);
+        }
+    }
+
+    const char *reply = known ? "ok\n" : "unknown\n";
+    if (write(fd, reply, strlen(reply)) < 0) {
+        /* The confirmer hung up, the decision stands */
+    }
+}
+
+static void listen_loop(void)
+{
+    struct pollfd fds[2];
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_fd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            continue;
+        }
+        if (fds[1].revents) {
+            return;
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                read_decision(fd);
+                close(fd);
+            }
+        }
+    }
+}
+
+int tx_confirm_start(const char *path)
+{
+    struct sockaddr_un addr;
+
+    /* One listener serves every transaction until `tx_confirm_stop` */
+    if (listener.joinable() || strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* Left behind by a previous run */
+    unlink(path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        return -1;
+    }
+
+    /* Only this user may confirm transactions */
+    const mode_t mask = umask(0077);
+    const int error = bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(mask);
+
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (error || listen(listen_fd, WEBAUTHN_TX_PENDING_MAX) || stop_fd < 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        if (stop_fd >= 0) {
+            close(stop_fd);
+            stop_fd = -1;
+        }
+        unlink(path);
+        return -1;
+    }
+
+    socket_path = path;
+    listener = thread(listen_loop);
+    return 0;
+}
+
+void tx_confirm_stop(void)
+{
+    if (!listener.joinable()) {
+        return;
+    }
+
+    const uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) == sizeof(one)) {
+        listener.join();
+    } else {
+        listener.detach();
+    }
+
+    close(listen_fd);
+    close(stop_fd);
+    listen_fd = -1;
+    stop_fd = -1;
+    unlink(socket_path.c_str());
+
+    /* Wake whoever still waits, without a decision */
+    lock_guard<mutex> lock(waiters_mutex);
+    for (map<uint32_t, tx_waiter_t>::iterator it = waiters.begin(); it != waiters.end(); ++it) {
+        if (write(it->second.event_fd, &one, sizeof(one)) < 0) {
+            /* It times out instead */
+        }
+    }
+}
+
+int tx_confirm_expect(uint32_t id)
+{
+    tx_waiter_t waiter;
+
+    waiter.event_fd = eventfd(0, EFD_CLOEXEC);
+    waiter.decision = -1;
+    if (waiter.event_fd < 0) {
+        return -1;
+    }
+
+    lock_guard<mutex> lock(waiters_mutex);
+    if (!waiters.insert(make_pair(id, waiter)).second) {
+        close(waiter.event_fd);
+        return -1;
+    }
+    return 0;
+}
+
+int tx_confirm_wait(uint32_t id, int timeout_ms)
+{
+    int event_fd;
+    {
+        lock_guard<mutex> lock(waiters_mutex);
+
+        map<uint32_t, tx_waiter_t>::iterator it = waiters.find(id);
+        if (it == waiters.end()) {
+            return -1;
+        }
+        event_fd = it->second.event_fd;
+    }
+
+    struct pollfd fd;
+    fd.fd = event_fd;
+    fd.events = POLLIN;
+    while (poll(&fd, 1, timeout_ms) < 0) {
+        /* Interrupted, wait again */
+    }
+
+    /* A decision that races the timeout still counts */
+    lock_guard<mutex> lock(waiters_mutex);
+    map<uint32_t, tx_waiter_t>::iterator it = waiters.find(id);
+    const int decision = it->second.decision;
+    close(it->second.event_fd);
+    waiters.erase(it);
+    return decision;
+}
@@ -0,0 +1,27 @@
+/*
+ * tx_confirm.h - The user's decisions on pending transactions.
+ *
+ * The enclave parks a transaction and returns at once, see the
+ * `begin_tx_confirmation` ECALL. The thread that began it then waits
+ * here, outside the enclave, on an eventfd of its own. Decisions arrive
+ * on a Unix socket, one line of "<id in hex> yes" or "<id in hex> no"
+ * per connection, read by a listener thread that wakes the waiter.
+ */
+
+#ifndef _TX_CONFIRM_H_
+#define _TX_CONFIRM_H_
+
+#include <stdint.h>
+
+/* Listen on `socket_path` for decisions on every transaction of the run */
+int tx_confirm_start(const char *socket_path);
+void tx_confirm_stop(void);  /* waits in progress return -1 */
+
+/* Get ready for a decision on transaction `id`, before the user is asked */
+int tx_confirm_expect(uint32_t id);
+
+/* 1 if the user accepted transaction `id`, 0 if they rejected it, -1 if
+ * no decision arrived within `timeout_ms` */
+int tx_confirm_wait(uint32_t id, int timeout_ms);
+
+#endif /* !_TX_CONFIRM_H_ */
@@ -33,152 +33,322 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <stdio.h>      /* vsnprintf */
 #include <string.h>
 
 #include "Enclave.h"
 #include "Enclave_t.h"  /* print_string */
+#include "client_data.h"
+#include "cpu_features.h"
+#include "cred_db.h"
+#include "drbg.h"
+#include "ecdsa.h"
+#include "key_pool.h"
+#include "log_ring.h"
+#include "rp_id_cache.h"
+#include "scratch.h"
+#include "sha256.h"
+#include "sign_counter.h"
+#include "tx_confirm.h"
+#include "uECC.h"
+#include "webauthn_defs.h"
 
 #include "sgx_trts.h"
 #include "sgx_tcrypto.h"
 #include "sgx_tseal.h"
 
-typedef struct {
-  sgx_ec256_public_t pk;
-  sgx_ec256_private_t sk;
-} ec256_pk_sk_pair;
-
 // Function Declarations
-static sgx_status_t get_pk_sk_pair(ec256_pk_sk_pair *pk_sk_pair);
+static sgx_status_t get_device_key(sgx_ec256_private_t *ret_sk);
+static sgx_status_t sign_unless_tx(const sgx_ec256_private_t *sk,
+                                   const uint8_t *data, uint32_t data_size, const char *auth_text,
+                                   sgx_ec256_signature_t *ret_signature);
+
+static const uint8_t device_credential_id[WEBAUTHN_CREDENTIAL_ID_SIZE] = {0};
 
 /* 
  * printf: 
- *   Invokes OCALL to display the enclave buffer to the terminal.
+ *   Logs at LOG_LEVEL_INFO through the host's log ring, without an OCALL.
  */
 void printf(const char *fmt, ...) {
-  char buf[BUFSIZ] = {'\0'};
   va_list ap;
   va_start(ap, fmt);
-  vsnprintf(buf, BUFSIZ, fmt, ap);
+  log_vwrite(LOG_LEVEL_INFO, fmt, ap);
   va_end(ap);
-  untrusted_print_string(buf);
+}
+
+/*
+ * enclave_init:
+ *   One-time setup, called by the host right after creating the enclave.
+ */
+sgx_status_t enclave_init() {
+  // Pick the SHA-256 implementation before anything is hashed
+  cpu_features_detect();
+
+  // Serve uECC's nonces, blinding values and initial Z coordinates
+  // from the buffered per-thread DRBG instead of RDRAND directly
+  uECC_set_rng(&drbg_uecc_rng);
+
+  return SGX_SUCCESS;
 }
 
 sgx_status_t get_public_key(sgx_ec256_public_t *ret_pk) {
-  ec256_pk_sk_pair pk_sk_pair;
-  sgx_status_t status = get_pk_sk_pair(&pk_sk_pair);
+  cred_record_t record;
+  sgx_status_t status = cred_db_get_device(&record);
 
-  // No errors, copy the public key over
+  // Only the private key is stored, the public key is derived once and cached
   if (!status) {
-    *ret_pk = pk_sk_pair.pk;
+    status = cred_db_get_public_key(record.id, ret_pk);
   }
+  memset_s(&record, sizeof(record), 0, sizeof(record));
 
   return status;
 }
 
-// TODO: All of these frees can be cleaned up. Split
-// the case where a new key needs to be created
-// into a helper function, and so forth
-static sgx_status_t get_pk_sk_pair(ec256_pk_sk_pair *pk_sk_pair) {
+// A random ID for a new credential, and its `meta`
+static sgx_status_t new_credential_id(cred_record_t *record) {
   sgx_status_t status;
 
-  const size_t pk_sk_pair_size = sizeof(*pk_sk_pair);
+  // The all-zero ID is taken by the device credential
+  do {
+    status = sgx_read_rand(record->id, sizeof(record->id));
+  } while (!status && memcmp(record->id, device_credential_id, sizeof(device_credential_id)) == 0);
 
-  int32_t error;
-  size_t sealed_size = sgx_calc_sealed_data_size(0, pk_sk_pair_size);
-  uint8_t *sealed_data = (uint8_t*)malloc(sealed_size);
+  if (!status) {
+    record->meta = CRED_META(CRED_ALG_ES256, 0);
+    record->counter = 0;
+    record->counter_epoch = sign_counter_epoch();
+  }
 
-  untrusted_load_enclave_data(&error, sealed_data, sealed_size);
+  return status;
+}
 
-  // Private key does not exist, create one and save it!
-  if (error) {
-    sgx_ecc_state_handle_t handle;
+// Create a credential for `rp_id` with a fresh key pair and a random ID
+sgx_status_t webauthn_make_credential(const char *rp_id, uint8_t *ret_credential_id, sgx_ec256_public_t *ret_pk) {
+  sgx_ec256_public_t pk;
+  cred_record_t record;
+  sgx_status_t status;
 
-    status = sgx_ecc256_open_context(&handle);
-    if (status) {
-      sgx_ecc256_close_context(handle);
-      free(sealed_data);
-      return status;
-    }
+  // `rp_id` is NUL-terminated by edger8r
+  status = rp_id_hash(rp_id, strlen(rp_id), record.rp_id_hash);
+  if (status) {
+    return status;
+  }
 
-    status = sgx_ecc256_create_key_pair(&pk_sk_pair->sk, &pk_sk_pair->pk, handle);
-    if (status) {
-      sgx_ecc256_close_context(handle);
-      free(sealed_data);
-      return status;
-    }
+  // A pre-generated key pair if there is one left, the pool is refilled
+  // by the host in the background
+  status = new_credential_id(&record);
+  if (!status && !key_pool_take(&record.sk, &pk)) {
+    LOG_DEBUG("Key pool empty, generating a key pair for %s", rp_id);
+    status = ecdsa_make_key_pair(&record.sk, &pk);
+  }
+  if (!status) {
+    status = cred_db_put(&record, &pk);
+  }
 
-    // Seal the new public/private keys
-    status = sgx_seal_data(0, NULL, pk_sk_pair_size, (const uint8_t*)pk_sk_pair, 
-                           sealed_size,  (sgx_sealed_data_t*)sealed_data);
+  if (!status) {
+    memcpy(ret_credential_id, record.id, sizeof(record.id));
+    *ret_pk = pk;
+  }
+  memset_s(&record, sizeof(record), 0, sizeof(record));
 
-    if (status) {
-      sgx_ecc256_close_context(handle);
-      free(sealed_data);
-      return status;
+  return status;
+}
+
+// Create `count` credentials for `rp_id`, CRED_DB_BATCH_RECORDS at a time.
+// Each batch is written to `ret_credentials` in host memory, ID and public
+// key per credential, once it is in the database; `ret_made` counts them
+// even if a later batch fails
+sgx_status_t webauthn_make_credentials(const char *rp_id, uint32_t count,
+                                       uint8_t *ret_credentials, uint32_t *ret_made) {
+  uint8_t rp_hash[SHA256_DIGEST_SIZE];
+  uint32_t made = 0;
+  uint32_t i;
+  sgx_status_t status;
+
+  *ret_made = 0;
+
+  if (count == 0) {
+    return SGX_SUCCESS;
+  }
+  if (count > UINT32_MAX / WEBAUTHN_MADE_CREDENTIAL_SIZE ||
+      !sgx_is_outside_enclave(ret_credentials, (size_t)count * WEBAUTHN_MADE_CREDENTIAL_SIZE)) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  status = rp_id_hash(rp_id, strlen(rp_id), rp_hash);
+  if (status) {
+    return status;
+  }
+
+  cred_record_t *records = (cred_record_t*)scratch_alloc(CRED_DB_BATCH_RECORDS * sizeof(*records));
+  sgx_ec256_public_t *pks = (sgx_ec256_public_t*)scratch_alloc(CRED_DB_BATCH_RECORDS * sizeof(*pks));
+  if (records == NULL || pks == NULL) {
+    scratch_free(pks);
+    scratch_free(records);
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+
+  // Other TCS may run the same loop, they only meet at the page write
+  while (!status && made < count) {
+    const uint32_t batch = count - made < CRED_DB_BATCH_RECORDS ? count - made : CRED_DB_BATCH_RECORDS;
+
+    for (i = 0; i < batch && !status; i++) {
+      memcpy(records[i].rp_id_hash, rp_hash, sizeof(rp_hash));
+      status = new_credential_id(&records[i]);
+      if (!status) {
+        status = ecdsa_make_key_pair(&records[i].sk, &pks[i]);
+      }
+    }
+    if (!status) {
+      status = cred_db_put_batch(records, batch);
     }
 
-    // Write back the sealed_data
-    untrusted_save_enclave_data(&error, sealed_data, sealed_size);
+    if (!status) {
+      uint8_t *out = ret_credentials + (size_t)made * WEBAUTHN_MADE_CREDENTIAL_SIZE;
 
-    if (error) {
-      status = SGX_ERROR_UNEXPECTED;
-    } else {
-      status = SGX_SUCCESS;
+      for (i = 0; i < batch; i++, out += WEBAUTHN_MADE_CREDENTIAL_SIZE) {
+        memcpy(out, records[i].id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+        memcpy(out + WEBAUTHN_CREDENTIAL_ID_SIZE, &pks[i], sizeof(pks[i]));
+      }
+      made += batch;
     }
+  }
 
-    sgx_ecc256_close_context(handle);
-    free(sealed_data);
-    return status;
+  memset_s(records, CRED_DB_BATCH_RECORDS * sizeof(*records), 0, CRED_DB_BATCH_RECORDS * sizeof(*records));
+  scratch_free(pks);
+  scratch_free(records);
+
+  *ret_made = made;
+  return status;
+}
+
+sgx_status_t webauthn_delete_credential(const uint8_t *credential_id) {
+  // The device credential backs the ECALLs that take no credential ID
+  if (memcmp(credential_id, device_credential_id, sizeof(device_credential_id)) == 0) {
+    return SGX_ERROR_INVALID_PARAMETER;
   }
 
-  // Load the public/private keys from the sealed_data
-  status = sgx_unseal_data((sgx_sealed_data_t*)sealed_data, NULL, NULL, (uint8_t*)pk_sk_pair, (uint32_t*)&pk_sk_pair_size);
+  return cred_db_delete(credential_id);
+}
+
+// Discoverable credentials: every credential of `rp_id`, without an allowList
+sgx_status_t webauthn_list_credentials(const char *rp_id, uint8_t *ret_ids, uint32_t ids_size, uint32_t *ret_count) {
+  uint8_t hash[SHA256_DIGEST_SIZE];
+  uint32_t max_ids = ids_size / WEBAUTHN_CREDENTIAL_ID_SIZE;
 
+  // `rp_id` is NUL-terminated by edger8r
+  sgx_status_t status = rp_id_hash(rp_id, strlen(rp_id), hash);
   if (status) {
-    free(sealed_data);
     return status;
-  }  
+  }
+
+  if (max_ids > WEBAUTHN_LIST_MAX) {
+    max_ids = WEBAUTHN_LIST_MAX;
+  }
+
+  return cred_db_list(hash, ret_ids, max_ids, ret_count);
+}
+
+// The device credential's private key, see `cred_db_get_device`
+static sgx_status_t get_device_key(sgx_ec256_private_t *ret_sk) {
+  cred_record_t record;
+  sgx_status_t status = cred_db_get_device(&record);
+
+  if (!status) {
+    *ret_sk = record.sk;
+  }
+  memset_s(&record, sizeof(record), 0, sizeof(record));
 
-  free(sealed_data);
   return status;
 }
 
-sgx_status_t sign_data(const uint8_t *data, uint32_t data_size, sgx_ec256_signature_t *ret_signature) {
+// Sign `digest` with `sk`, or with the device credential if `sk` is NULL
+static sgx_status_t sign_digest(const sgx_ec256_private_t *sk, const uint8_t digest[SHA256_DIGEST_SIZE],
+                                sgx_ec256_signature_t *ret_signature) {
   sgx_status_t status;
 
-  // Open up a ECC state context
-  sgx_ecc_state_handle_t handle;
-  status = sgx_ecc256_open_context(&handle);  
+  // Get the private key from the enclave
+  sgx_ec256_private_t device_sk;
+  if (sk == NULL) {
+    status = get_device_key(&device_sk);
+
+    if (status) {
+      return status;
+    }
+    sk = &device_sk;
+  }
+
+  // Compute the signature locally, using a precomputed nonce if available
+  sgx_ec256_signature_t signature;
+  status = ecdsa_sign_digest(sk, digest, &signature);
+  memset_s(&device_sk, sizeof(device_sk), 0, sizeof(device_sk));
 
   if (status) {
-    sgx_ecc256_close_context(handle);
     return status;
   }
 
-  // Get the private key from the enclave
-  ec256_pk_sk_pair pk_sk_pair;
-  status = get_pk_sk_pair(&pk_sk_pair);
+  // Successfully signed, copy the signature over
+  *ret_signature = signature;
+
+  return status;
+}
+
+static sgx_status_t sign_message(const sgx_ec256_private_t *sk, const uint8_t *data, uint32_t data_size,
+                                 sgx_ec256_signature_t *ret_signature) {
+  sgx_status_t status;
+
+  // Hash the data, same as `sgx_ecdsa_sign` does internally
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  status = sha256_msg(data, data_size, digest);
 
   if (status) {
-    sgx_ecc256_close_context(handle);
     return status;
   }
 
-  // Compute the signature locally
-  sgx_ec256_signature_t signature;
-  status = sgx_ecdsa_sign(data, data_size, &pk_sk_pair.sk, &signature, handle);
+  return sign_digest(sk, digest, ret_signature);
+}
 
+sgx_status_t sign_data(const uint8_t *data, uint32_t data_size, sgx_ec256_signature_t *ret_signature) {
+  return sign_message(NULL, data, data_size, ret_signature);
+}
+
+// Sign a SHA256 digest of authenticatorData || clientDataHash computed
+// by the host, so only 32 bytes cross into the enclave. Never having
+// seen the clientDataJSON, the enclave can neither check the hash nor
+// show a transaction text: this is for plain assertions only
+sgx_status_t webauthn_sign_digest(const sgx_sha256_hash_t *digest, sgx_ec256_signature_t *ret_signature) {
+  return sign_digest(NULL, *digest, ret_signature);
+}
+
+// Finish an assertion once its `client_data_json` has been scanned: check
+// the clientDataHash in `data` and sign
+sgx_status_t sign_scanned_assertion(const uint8_t *data, uint32_t data_size,
+                                    client_data_scan_t *scan,
+                                    sgx_ec256_signature_t *ret_signature) {
+  uint8_t client_data_hash[SHA256_DIGEST_SIZE];
+  sgx_status_t status = client_data_scan_final(scan, client_data_hash);
   if (status) {
-    sgx_ecc256_close_context(handle);
     return status;
   }
 
-  // Successfully signed, copy the signature over
-  *ret_signature = signature;
+  // The 2nd half of `data` must be the hash of the `client_data_json` we are shown
+  if (memcmp(client_data_hash, data + WEBAUTHN_AUTHENTICATOR_DATA_SIZE, SHA256_DIGEST_SIZE) != 0) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
 
-  sgx_ecc256_close_context(handle);
-  return status;
+  return sign_unless_tx(NULL, data, data_size, client_data_scan_tx_text(scan), ret_signature);
+}
+
+// Sign `data` with `sk`, or the device credential if NULL, unless there
+// is a transaction in `auth_text`. Transactions go through
+// `begin_tx_confirmation`, so no TCS waits for the user's decision
+static sgx_status_t sign_unless_tx(const sgx_ec256_private_t *sk,
+                                   const uint8_t *data, uint32_t data_size, const char *auth_text,
+                                   sgx_ec256_signature_t *ret_signature) {
+  if (auth_text != NULL) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  return sign_message(sk, data, data_size, ret_signature);
 }
 
 // Compute the signature of a given piece of `data` according 
@@ -188,58 +358,445 @@ sgx_status_t webauthn_get_signature(const uint8_t *data, uint32_t data_size,
                                     sgx_ec256_signature_t *ret_signature) {
   // Expected `data_size` for the signature is 69 bytes
   // (two hashes x 32 bytes + 5 bytes metadata)
-  if (data_size != 69) {
+  if (data_size != WEBAUTHN_SIGNED_DATA_SIZE) {
     return SGX_ERROR_UNEXPECTED;
   }
 
-  // TODO: Perform SHA256 on `client_data_json` and compare with 2nd half of `data`
+  if (client_data_json_size > WEBAUTHN_CLIENT_DATA_MAX_SIZE) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  client_data_scan_t scan;
+  client_data_scan_init(&scan);
+  client_data_scan_update(&scan, client_data_json, client_data_json_size);
 
-  // TODO: This is hacky and bug-prone
-  //
-  // Search the client data to see if this a txAuthSimple event
-  // Look for the string `"clientExtensions":{"txAuthSimple":` to get the transaction text
-  const char *txAuthSimple_search_text = "\"clientExtensions\":{\"txAuthSimple\":";
-  char *auth_text_start = strstr((const char*)client_data_json, txAuthSimple_search_text);
-  
-  // This must be a regular authentication event, simply sign
-  if (auth_text_start == NULL) {
-    return sign_data(data, data_size, ret_signature);
+  return sign_scanned_assertion(data, data_size, &scan, ret_signature);
+}
+
+// Start an assertion for `rp_id`: check `flags` and put the rpIdHash and
+// the clientDataHash of `client_data_json` into `data`
+static sgx_status_t begin_assertion(const char *rp_id, uint8_t flags,
+                                    const uint8_t *client_data_json, uint32_t client_data_json_size,
+                                    uint8_t data[WEBAUTHN_SIGNED_DATA_SIZE], client_data_scan_t *scan) {
+  sgx_status_t status;
+
+  // Assertions carry no attested credential data or extensions
+  if (flags & ~(WEBAUTHN_FLAG_UP | WEBAUTHN_FLAG_UV)) {
+    return SGX_ERROR_INVALID_PARAMETER;
   }
 
-  // Skip forward the search text in the authentication text start
-  auth_text_start += strlen(txAuthSimple_search_text);
+  if (client_data_json_size > WEBAUTHN_CLIENT_DATA_INLINE_MAX) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
 
-  // Look for the end of the authentication text
-  char *auth_text_end = strstr(auth_text_start, "}");
+  // `rp_id` is NUL-terminated by edger8r
+  status = rp_id_hash(rp_id, strlen(rp_id), data);
+  if (status) {
+    return status;
+  }
 
-  // Expect a closing bracket
-  if (auth_text_end == NULL) {
-    return SGX_ERROR_UNEXPECTED;
+  client_data_scan_init(scan);
+  client_data_scan_update(scan, client_data_json, client_data_json_size);
+  return client_data_scan_final(scan, data + WEBAUTHN_AUTHENTICATOR_DATA_SIZE);
+}
+
+// Fill in `flags` and the next value of the signature counter of credential `id`
+static sgx_status_t count_assertion(uint8_t data[WEBAUTHN_SIGNED_DATA_SIZE], uint8_t flags,
+                                    const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE]) {
+  uint32_t count;
+
+  sgx_status_t status = sign_counter_next(id, &count);
+  if (status) {
+    return status;
   }
 
-  // Mark the end of the authentication text before printing it
-  *auth_text_end = 0;
+  data[32] = flags;
+  data[33] = (uint8_t)(count >> 24);
+  data[34] = (uint8_t)(count >> 16);
+  data[35] = (uint8_t)(count >> 8);
+  data[36] = (uint8_t)count;
 
-  printf("\nAuthentication text: %s\n", auth_text_start);
-  printf("Accept [yes], Reject [no]:\n");
+  return SGX_SUCCESS;
+}
 
-  // Get the user input to this authentication request
-  char user_input[4];
-  untrusted_get_user_input(user_input, sizeof(user_input));
-  printf("\n");
+// Count the assertion, then sign with `sk`, or the device credential if NULL
+static sgx_status_t finish_assertion(uint8_t data[WEBAUTHN_SIGNED_DATA_SIZE], uint8_t flags,
+                                     const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE],
+                                     const sgx_ec256_private_t *sk, client_data_scan_t *scan,
+                                     uint8_t *ret_authenticator_data, sgx_ec256_signature_t *ret_signature) {
+  // Transactions are counted once the user accepts them
+  if (client_data_scan_tx_text(scan) != NULL) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
 
-  if (strcmp(user_input, "yes") == 0) {
-    printf("Authentication accepted\n");
-    return sign_data(data, data_size, ret_signature);    
-  } else if (strcmp(user_input, "no") == 0) {
-    printf("Authentication rejected\n");
-    return SGX_SUCCESS;
+  sgx_status_t status = count_assertion(data, flags, id);
+  if (status) {
+    return status;
+  }
+
+  memcpy(ret_authenticator_data, data, WEBAUTHN_AUTHENTICATOR_DATA_SIZE);
+
+  return sign_message(sk, data, WEBAUTHN_SIGNED_DATA_SIZE, ret_signature);
+}
+
+// Build authenticatorData (rpIdHash, `flags`, signCount) for `rp_id` with
+// the enclave's own signature counter and sign it with the clientDataHash
+sgx_status_t webauthn_get_assertion(const char *rp_id, uint8_t flags,
+                                    const uint8_t *client_data_json, uint32_t client_data_json_size,
+                                    uint8_t *ret_authenticator_data, sgx_ec256_signature_t *ret_signature) {
+  uint8_t data[WEBAUTHN_SIGNED_DATA_SIZE];
+  client_data_scan_t scan;
+
+  sgx_status_t status = begin_assertion(rp_id, flags, client_data_json, client_data_json_size, data, &scan);
+  if (status) {
+    return status;
+  }
+
+  // Signed with the device credential
+  return finish_assertion(data, flags, device_credential_id, NULL, &scan,
+                          ret_authenticator_data, ret_signature);
+}
+
+static int allow_list_size_valid(uint32_t allow_list_size) {
+  return allow_list_size != 0 && allow_list_size % WEBAUTHN_CREDENTIAL_ID_SIZE == 0 &&
+         allow_list_size / WEBAUTHN_CREDENTIAL_ID_SIZE <= WEBAUTHN_ALLOW_LIST_MAX;
+}
+
+// The first credential of `allow_list` that is ours and bound to the
+// relying party of `rp_id_hash`. IDs that are not ours cost one index
+// probe each and are never unsealed
+static sgx_status_t find_allowed_credential(const uint8_t rp_id_hash[SHA256_DIGEST_SIZE],
+                                            const uint8_t *allow_list, uint32_t allow_list_size,
+                                            cred_record_t *ret_record) {
+  uint32_t i;
+
+  for (i = 0; i < allow_list_size / WEBAUTHN_CREDENTIAL_ID_SIZE; i++) {
+    const uint8_t *id = allow_list + i * WEBAUTHN_CREDENTIAL_ID_SIZE;
+
+    // The device credential is not bound to a relying party
+    if (memcmp(id, device_credential_id, sizeof(device_credential_id)) == 0) {
+      continue;
+    }
+
+    if (cred_db_get(id, ret_record) == SGX_SUCCESS &&
+        memcmp(ret_record->rp_id_hash, rp_id_hash, SHA256_DIGEST_SIZE) == 0) {
+      return SGX_SUCCESS;
+    }
+    memset_s(ret_record, sizeof(*ret_record), 0, sizeof(*ret_record));
+  }
+
+  return SGX_ERROR_INVALID_PARAMETER;
+}
+
+// Same as `webauthn_get_assertion` for the relying party's allowList of
+// `allow_list_size / WEBAUTHN_CREDENTIAL_ID_SIZE` credential IDs, resolved
+// here in one go: the first one that is ours and bound to `rp_id` signs
+sgx_status_t webauthn_get_assertion_allow_list(const char *rp_id, uint8_t flags,
+                                               const uint8_t *allow_list, uint32_t allow_list_size,
+                                               const uint8_t *client_data_json, uint32_t client_data_json_size,
+                                               uint8_t *ret_credential_id, uint8_t *ret_authenticator_data,
+                                               sgx_ec256_signature_t *ret_signature) {
+  uint8_t data[WEBAUTHN_SIGNED_DATA_SIZE];
+  client_data_scan_t scan;
+  cred_record_t record;
+
+  if (!allow_list_size_valid(allow_list_size)) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  sgx_status_t status = begin_assertion(rp_id, flags, client_data_json, client_data_json_size, data, &scan);
+  if (status) {
+    return status;
+  }
+
+  status = find_allowed_credential(data, allow_list, allow_list_size, &record);
+  if (status) {
+    return status;
+  }
+
+  memcpy(ret_credential_id, record.id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+  status = finish_assertion(data, flags, record.id, &record.sk, &scan,
+                            ret_authenticator_data, ret_signature);
+  memset_s(&record, sizeof(record), 0, sizeof(record));
+
+  return status;
+}
+
+// Park a transaction for the user's decision and copy its text, which
+// `client_data_scan_final` has bounded, out for them to read
+static sgx_status_t park_transaction(const tx_confirm_request_t *request, const char *tx_text,
+                                     webauthn_tx_handle_t *ret_handle, char *ret_text, uint32_t text_size) {
+  const size_t tx_text_size = strlen(tx_text) + 1;
+
+  if (text_size < tx_text_size) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  sgx_status_t status = tx_confirm_park(request, ret_handle);
+  if (!status) {
+    memcpy(ret_text, tx_text, tx_text_size);
+  }
+  return status;
+}
+
+// Park the transaction in a fully fed `scan` once `data`'s clientDataHash
+// matches it, to be signed by `complete_tx_confirmation` with the device
+// credential if the user accepts
+sgx_status_t park_scanned_transaction(const uint8_t *data, uint32_t data_size,
+                                      client_data_scan_t *scan,
+                                      webauthn_tx_handle_t *ret_handle, char *ret_text, uint32_t text_size) {
+  uint8_t client_data_hash[SHA256_DIGEST_SIZE];
+  tx_confirm_request_t request;
+
+  if (data_size != WEBAUTHN_SIGNED_DATA_SIZE) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  sgx_status_t status = client_data_scan_final(scan, client_data_hash);
+  if (status) {
+    return status;
+  }
+
+  // Plain assertions are signed in one go
+  if (client_data_scan_tx_text(scan) == NULL ||
+      memcmp(client_data_hash, data + WEBAUTHN_AUTHENTICATOR_DATA_SIZE, SHA256_DIGEST_SIZE) != 0) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  memset(&request, 0, sizeof(request));
+  memcpy(request.data, data, WEBAUTHN_SIGNED_DATA_SIZE);
+  request.device_key = 1;
+
+  return park_transaction(&request, client_data_scan_tx_text(scan), ret_handle, ret_text, text_size);
+}
+
+// First half of `webauthn_get_signature` for a transaction: check the
+// clientDataHash in `data` and hand out its text. Larger clientDataJSONs
+// go through `begin_tx_confirmation_large` or `webauthn_stream_begin_tx`
+sgx_status_t begin_tx_confirmation(const uint8_t *data, uint32_t data_size,
+                                   const uint8_t *client_data_json, uint32_t client_data_json_size,
+                                   webauthn_tx_handle_t *ret_handle, char *ret_text, uint32_t text_size) {
+  client_data_scan_t scan;
+
+  if (client_data_json_size > WEBAUTHN_CLIENT_DATA_INLINE_MAX) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  client_data_scan_init(&scan);
+  client_data_scan_update(&scan, client_data_json, client_data_json_size);
+
+  return park_scanned_transaction(data, data_size, &scan, ret_handle, ret_text, text_size);
+}
+
+// Same as `begin_tx_confirmation` for a `client_data_json` read in place,
+// as by `webauthn_get_signature_large`
+sgx_status_t begin_tx_confirmation_large(const uint8_t *data, uint32_t data_size,
+                                         const uint8_t *client_data_json, uint32_t client_data_json_size,
+                                         webauthn_tx_handle_t *ret_handle, char *ret_text, uint32_t text_size) {
+  client_data_scan_t scan;
+
+  if (client_data_json == NULL || client_data_json_size > WEBAUTHN_CLIENT_DATA_MAX_SIZE) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  client_data_scan_init(&scan);
+  sgx_status_t status = client_data_scan_update_outside(&scan, client_data_json, client_data_json_size);
+  if (status) {
+    return status;
+  }
+
+  return park_scanned_transaction(data, data_size, &scan, ret_handle, ret_text, text_size);
+}
+
+// First half of `webauthn_get_assertion` for a transaction, or of
+// `webauthn_get_assertion_allow_list` if there is an `allow_list`. The
+// credential is resolved now, its signature counter only moves once
+// the user accepts
+sgx_status_t begin_tx_assertion(const char *rp_id, uint8_t flags,
+                                const uint8_t *allow_list, uint32_t allow_list_size,
+                                const uint8_t *client_data_json, uint32_t client_data_json_size,
+                                webauthn_tx_handle_t *ret_handle, uint8_t *ret_credential_id,
+                                char *ret_text, uint32_t text_size) {
+  tx_confirm_request_t request;
+  client_data_scan_t scan;
+  cred_record_t record;
+
+  if (allow_list_size != 0 && !allow_list_size_valid(allow_list_size)) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  memset(&request, 0, sizeof(request));
+  sgx_status_t status = begin_assertion(rp_id, flags, client_data_json, client_data_json_size, request.data, &scan);
+  if (status) {
+    return status;
+  }
+
+  if (client_data_scan_tx_text(&scan) == NULL) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  request.assertion = 1;
+  request.flags = flags;
+
+  if (allow_list_size == 0) {
+    request.device_key = 1;
+    memcpy(request.credential_id, device_credential_id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+    memcpy(ret_credential_id, device_credential_id, WEBAUTHN_CREDENTIAL_ID_SIZE);
   } else {
-    printf("Unknown input received\n");
+    status = find_allowed_credential(request.data, allow_list, allow_list_size, &record);
+    if (status) {
+      return status;
+    }
+
+    request.sk = record.sk;
+    memcpy(request.credential_id, record.id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+    memcpy(ret_credential_id, record.id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+    memset_s(&record, sizeof(record), 0, sizeof(record));
+  }
+
+  status = park_transaction(&request, client_data_scan_tx_text(&scan), ret_handle, ret_text, text_size);
+  memset_s(&request, sizeof(request), 0, sizeof(request));
+
+  return status;
+}
+
+// Second half: sign the transaction behind `handle` if the user accepted
+// it. Either way it is no longer pending, a rejected one is not signed
+// and leaves both outputs zeroed
+sgx_status_t complete_tx_confirmation(const webauthn_tx_handle_t *handle, uint8_t accept,
+                                      uint8_t *ret_authenticator_data, sgx_ec256_signature_t *ret_signature) {
+  tx_confirm_request_t request;
+
+  sgx_status_t status = tx_confirm_take(handle, &request);
+  if (status) {
+    return status;
+  }
+
+  memset(ret_authenticator_data, 0, WEBAUTHN_AUTHENTICATOR_DATA_SIZE);
+  memset(ret_signature, 0, sizeof(*ret_signature));
+
+  if (accept && request.assertion) {
+    status = count_assertion(request.data, request.flags, request.credential_id);
+  }
+  if (accept && !status) {
+    memcpy(ret_authenticator_data, request.data, WEBAUTHN_AUTHENTICATOR_DATA_SIZE);
+    status = sign_message(request.device_key ? NULL : &request.sk, request.data, WEBAUTHN_SIGNED_DATA_SIZE,
+                          ret_signature);
+  }
+  LOG_INFO("Transaction %08x %s", handle->id, accept ? "accepted" : "rejected");
+  memset_s(&request, sizeof(request), 0, sizeof(request));
+
+  return status;
+}
+
+// Drop the transaction behind `handle` unsigned, for a host that will not
+// ask the user after all
+sgx_status_t cancel_tx_confirmation(const webauthn_tx_handle_t *handle) {
+  tx_confirm_request_t request;
+
+  sgx_status_t status = tx_confirm_take(handle, &request);
+  if (!status) {
+    LOG_INFO("Transaction %08x cancelled", handle->id);
+    memset_s(&request, sizeof(request), 0, sizeof(request));
+  }
+
+  return status;
+}
+
+// Same as `webauthn_get_signature` for a `client_data_json` too large to
+// be worth copying in by edger8r: it is read once, in place, from host memory
+sgx_status_t webauthn_get_signature_large(const uint8_t *data, uint32_t data_size,
+                                          const uint8_t *client_data_json, uint32_t client_data_json_size,
+                                          sgx_ec256_signature_t *ret_signature) {
+  if (data_size != WEBAUTHN_SIGNED_DATA_SIZE) {
     return SGX_ERROR_UNEXPECTED;
   }
 
-  // We should never get here
-  assert(false);
-  return SGX_ERROR_UNEXPECTED;
+  if (client_data_json == NULL || client_data_json_size > WEBAUTHN_CLIENT_DATA_MAX_SIZE) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  client_data_scan_t scan;
+  client_data_scan_init(&scan);
+  sgx_status_t status = client_data_scan_update_outside(&scan, client_data_json, client_data_json_size);
+  if (status) {
+    return status;
+  }
+
+  return sign_scanned_assertion(data, data_size, &scan, ret_signature);
+}
+
+// Sign a batch of plain assertions. `signed_data` holds one 69-byte
+// message per request and `client_data` the concatenated clientDataJSONs,
+// `client_data_sizes[i]` bytes each. Both hashing steps run over the
+// whole batch at once and the key is unsealed once for all signatures
+sgx_status_t webauthn_get_signature_batch(uint32_t num_requests,
+                                          const uint8_t *signed_data, uint32_t signed_data_size,
+                                          const uint8_t *client_data, uint32_t client_data_size,
+                                          const uint32_t *client_data_sizes,
+                                          sgx_ec256_signature_t *ret_signatures, uint32_t *ret_statuses) {
+  const uint8_t *msgs[WEBAUTHN_BATCH_MAX_REQUESTS];
+  size_t msg_sizes[WEBAUTHN_BATCH_MAX_REQUESTS];
+  uint8_t digests[WEBAUTHN_BATCH_MAX_REQUESTS][SHA256_DIGEST_SIZE];
+  sgx_status_t status;
+  size_t offset = 0;
+  uint32_t i;
+
+  if (num_requests == 0 || num_requests > WEBAUTHN_BATCH_MAX_REQUESTS ||
+      signed_data_size != num_requests * WEBAUTHN_SIGNED_DATA_SIZE) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  for (i = 0; i < num_requests; i++) {
+    if (client_data_sizes[i] > client_data_size - offset) {
+      return SGX_ERROR_INVALID_PARAMETER;
+    }
+    msgs[i] = client_data + offset;
+    msg_sizes[i] = client_data_sizes[i];
+    offset += client_data_sizes[i];
+  }
+
+  // Check every clientDataHash against its clientDataJSON
+  status = sha256_msg_batch(num_requests, msgs, msg_sizes, digests);
+  if (status) {
+    return status;
+  }
+
+  for (i = 0; i < num_requests; i++) {
+    const uint8_t *data = signed_data + i * WEBAUTHN_SIGNED_DATA_SIZE;
+
+    if (memcmp(digests[i], data + WEBAUTHN_AUTHENTICATOR_DATA_SIZE, SHA256_DIGEST_SIZE) != 0) {
+      ret_statuses[i] = SGX_ERROR_INVALID_PARAMETER;
+    } else if (client_data_has_tx(msgs[i], msg_sizes[i])) {
+      // Transactions need the user's confirmation, see `begin_tx_confirmation`
+      ret_statuses[i] = SGX_ERROR_INVALID_PARAMETER;
+    } else {
+      ret_statuses[i] = SGX_SUCCESS;
+    }
+    memset(&ret_signatures[i], 0, sizeof(ret_signatures[i]));
+
+    msgs[i] = data;
+    msg_sizes[i] = WEBAUTHN_SIGNED_DATA_SIZE;
+  }
+
+  // Message digests for signing, same as `sign_data`
+  status = sha256_msg_batch(num_requests, msgs, msg_sizes, digests);
+  if (status) {
+    return status;
+  }
+
+  sgx_ec256_private_t sk;
+  status = get_device_key(&sk);
+  if (status) {
+    return status;
+  }
+
+  for (i = 0; i < num_requests; i++) {
+    if (ret_statuses[i] == SGX_SUCCESS) {
+      ret_statuses[i] = ecdsa_sign_digest(&sk, digests[i], &ret_signatures[i]);
+    }
+  }
+  memset_s(&sk, sizeof(sk), 0, sizeof(sk));
+
+  return SGX_SUCCESS;
 }
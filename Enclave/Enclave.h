@@ -36,6 +36,9 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#include "sgx_tcrypto.h"
+#include "client_data.h"
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -43,6 +46,18 @@ extern "C" {
 void printf(const char *fmt, ...);
 void printf_helloworld();
 
+// Check `data`'s clientDataHash against a fully fed `scan` and sign
+// `data`. Fails for transactions, see `begin_tx_confirmation`
+sgx_status_t sign_scanned_assertion(const uint8_t *data, uint32_t data_size,
+                                    client_data_scan_t *scan,
+                                    sgx_ec256_signature_t *ret_signature);
+
+// Check `data`'s clientDataHash against a fully fed `scan` and park its
+// transaction, see `begin_tx_confirmation`. Fails for plain assertions
+sgx_status_t park_scanned_transaction(const uint8_t *data, uint32_t data_size,
+                                      client_data_scan_t *scan,
+                                      webauthn_tx_handle_t *ret_handle, char *ret_text, uint32_t text_size);
+
 #if defined(__cplusplus)
 }
 #endif
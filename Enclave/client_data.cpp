@@ -0,0 +1,134 @@
+/*
+ * client_data.cpp - Single-pass scan of a clientDataJSON.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "client_data.h"
+
+#include "sgx_trts.h"
+
+// Bounce buffer for reading host memory
+#define CLIENT_DATA_COPY_CHUNK 4096
+
+enum {
+  CLIENT_DATA_SCAN_MARKER,    // looking for WEBAUTHN_TX_AUTH_SIMPLE_TEXT
+  CLIENT_DATA_SCAN_TX_TEXT,   // collecting the text up to the closing '}'
+  CLIENT_DATA_SCAN_DONE,      // text complete, only hashing left
+  CLIENT_DATA_SCAN_TOO_LONG,  // text over CLIENT_DATA_TX_TEXT_MAX
+};
+
+static const char tx_marker[] = WEBAUTHN_TX_AUTH_SIMPLE_TEXT;
+static const uint32_t tx_marker_size = sizeof(tx_marker) - 1;
+
+// fail[i]: longest proper prefix of the marker that is also a suffix of marker[0..i]
+static void marker_fail_init(uint8_t fail[sizeof(tx_marker)]) {
+  uint32_t i, k = 0;
+
+  fail[0] = 0;
+  for (i = 1; i < tx_marker_size; i++) {
+    while (k > 0 && tx_marker[i] != tx_marker[k]) {
+      k = fail[k - 1];
+    }
+    if (tx_marker[i] == tx_marker[k]) {
+      k++;
+    }
+    fail[i] = (uint8_t)k;
+  }
+}
+
+// Advance a match of `matched` marker bytes by `c`. Same match as `strstr`
+// on the whole JSON, across chunk boundaries
+static uint32_t marker_step(const uint8_t fail[sizeof(tx_marker)], uint32_t matched, char c) {
+  while (matched > 0 && tx_marker[matched] != c) {
+    matched = fail[matched - 1];
+  }
+  if (tx_marker[matched] == c) {
+    matched++;
+  }
+  return matched;
+}
+
+void client_data_scan_init(client_data_scan_t *scan) {
+  sha256_init(&scan->sha);
+  scan->state = CLIENT_DATA_SCAN_MARKER;
+  scan->matched = 0;
+  scan->tx_text_size = 0;
+  marker_fail_init(scan->fail);
+}
+
+void client_data_scan_update(client_data_scan_t *scan, const uint8_t *data, size_t size) {
+  size_t i;
+
+  sha256_update(&scan->sha, data, size);
+
+  for (i = 0; i < size && scan->state < CLIENT_DATA_SCAN_DONE; i++) {
+    const char c = (char)data[i];
+
+    if (scan->state == CLIENT_DATA_SCAN_MARKER) {
+      scan->matched = marker_step(scan->fail, scan->matched, c);
+      if (scan->matched == tx_marker_size) {
+        scan->state = CLIENT_DATA_SCAN_TX_TEXT;
+      }
+    } else if (c == '}') {
+      scan->tx_text[scan->tx_text_size] = '\0';
+      scan->state = CLIENT_DATA_SCAN_DONE;
+    } else if (scan->tx_text_size < CLIENT_DATA_TX_TEXT_MAX) {
+      scan->tx_text[scan->tx_text_size++] = c;
+    } else {
+      scan->state = CLIENT_DATA_SCAN_TOO_LONG;
+    }
+  }
+}
+
+int client_data_has_tx(const uint8_t *data, size_t size) {
+  uint8_t fail[sizeof(tx_marker)];
+  uint32_t matched = 0;
+  size_t i;
+
+  marker_fail_init(fail);
+  for (i = 0; i < size; i++) {
+    matched = marker_step(fail, matched, (char)data[i]);
+    if (matched == tx_marker_size) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+sgx_status_t client_data_scan_update_outside(client_data_scan_t *scan, const uint8_t *data, size_t size) {
+  uint8_t chunk[CLIENT_DATA_COPY_CHUNK];
+
+  if (!sgx_is_outside_enclave(data, size)) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  // Do not speculate past the bounds check
+  __builtin_ia32_lfence();
+
+  while (size) {
+    const size_t n = (size < sizeof(chunk)) ? size : sizeof(chunk);
+
+    memcpy(chunk, data, n);
+    client_data_scan_update(scan, chunk, n);
+
+    data += n;
+    size -= n;
+  }
+
+  return SGX_SUCCESS;
+}
+
+sgx_status_t client_data_scan_final(client_data_scan_t *scan, uint8_t hash[SHA256_DIGEST_SIZE]) {
+  sha256_final(&scan->sha, hash);
+
+  if (scan->state == CLIENT_DATA_SCAN_TX_TEXT || scan->state == CLIENT_DATA_SCAN_TOO_LONG) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  return SGX_SUCCESS;
+}
+
+const char *client_data_scan_tx_text(const client_data_scan_t *scan) {
+  return (scan->state == CLIENT_DATA_SCAN_DONE) ? scan->tx_text : NULL;
+}
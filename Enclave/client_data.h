@@ -0,0 +1,59 @@
+/*
+ * client_data.h - Single-pass scan of a clientDataJSON.
+ *
+ * The JSON is hashed and searched for a txAuthSimple text in the same
+ * pass, reading every byte exactly once. It can therefore be fed in
+ * chunks of any size and read straight from host memory: a host that
+ * changes the buffer meanwhile only changes what is hashed and shown
+ * together, never one without the other.
+ */
+
+#ifndef _CLIENT_DATA_H_
+#define _CLIENT_DATA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sgx_error.h"
+#include "sha256.h"
+#include "webauthn_defs.h"
+
+#define CLIENT_DATA_TX_TEXT_MAX WEBAUTHN_TX_TEXT_MAX  // longest transaction text shown to the user
+
+typedef struct {
+  sha256_ctx_t sha;
+  uint32_t state;         // CLIENT_DATA_SCAN_*, private to client_data.cpp
+  uint32_t matched;       // bytes of WEBAUTHN_TX_AUTH_SIMPLE_TEXT matched so far
+  uint32_t tx_text_size;
+  char tx_text[CLIENT_DATA_TX_TEXT_MAX + 1];
+  uint8_t fail[sizeof(WEBAUTHN_TX_AUTH_SIMPLE_TEXT)];  // KMP failure function of the marker
+} client_data_scan_t;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+void client_data_scan_init(client_data_scan_t *scan);
+
+// Absorb bytes that are already inside the enclave
+void client_data_scan_update(client_data_scan_t *scan, const uint8_t *data, size_t size);
+
+// Whether `data` holds a txAuthSimple, by the same match as the scan. For
+// callers that hash by other means, e.g. several messages at once
+int client_data_has_tx(const uint8_t *data, size_t size);
+
+// Absorb a `[user_check]` buffer, copying it in bounded chunks so every byte is read once
+sgx_status_t client_data_scan_update_outside(client_data_scan_t *scan, const uint8_t *data, size_t size);
+
+// Write the clientDataHash. Fails if a txAuthSimple text was started but
+// never closed or is longer than CLIENT_DATA_TX_TEXT_MAX
+sgx_status_t client_data_scan_final(client_data_scan_t *scan, uint8_t hash[SHA256_DIGEST_SIZE]);
+
+// The NUL-terminated transaction text after a successful final, NULL for plain assertions
+const char *client_data_scan_tx_text(const client_data_scan_t *scan);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_CLIENT_DATA_H_ */
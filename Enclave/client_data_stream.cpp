@@ -0,0 +1,143 @@
+/*
+ * client_data_stream.cpp - Assertions over a clientDataJSON fed in chunks.
+ *
+ * `webauthn_stream_begin` opens a stream, `webauthn_stream_update` scans
+ * each chunk as it arrives and `webauthn_stream_finish` signs, or
+ * `webauthn_stream_begin_tx` parks a transaction. Only the scan state
+ * is kept between calls, so enclave memory does not grow with the size
+ * of the JSON.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Enclave.h"
+#include "Enclave_t.h"
+#include "client_data.h"
+
+#include "sgx_spinlock.h"
+
+typedef struct {
+  sgx_spinlock_t lock;  // held while a call works on the stream
+  uint32_t id;          // handed to the host, 0 while the slot is free
+  client_data_scan_t scan;
+} client_data_stream_t;
+
+static client_data_stream_t streams[WEBAUTHN_STREAM_MAX];
+static uint32_t stream_generation = 0;
+
+// A stream id is a generation count above the slot number, so a
+// stale id from a finished stream never matches the slot's next stream
+#define STREAM_ID(generation, slot) (((generation) << 8) | ((slot) + 1))
+#define STREAM_SLOT(id)             (((id) & 0xff) - 1)
+
+// Find and lock the stream behind `stream_id`, NULL if it is not open
+static client_data_stream_t *stream_acquire(uint32_t stream_id) {
+  const uint32_t slot = STREAM_SLOT(stream_id);
+
+  if (slot >= WEBAUTHN_STREAM_MAX) {
+    return NULL;
+  }
+
+  client_data_stream_t *stream = &streams[slot];
+  sgx_spin_lock(&stream->lock);
+  if (stream->id != stream_id) {
+    sgx_spin_unlock(&stream->lock);
+    return NULL;
+  }
+  return stream;
+}
+
+// Close a locked stream and free its slot
+static void stream_close(client_data_stream_t *stream) {
+  memset_s(&stream->scan, sizeof(stream->scan), 0, sizeof(stream->scan));
+  stream->id = 0;
+  sgx_spin_unlock(&stream->lock);
+}
+
+sgx_status_t webauthn_stream_begin(uint32_t *ret_stream_id) {
+  const uint32_t generation = __atomic_add_fetch(&stream_generation, 1, __ATOMIC_RELAXED);
+  uint32_t slot;
+
+  for (slot = 0; slot < WEBAUTHN_STREAM_MAX; slot++) {
+    client_data_stream_t *stream = &streams[slot];
+
+    sgx_spin_lock(&stream->lock);
+    if (stream->id == 0) {
+      stream->id = STREAM_ID(generation, slot);
+      client_data_scan_init(&stream->scan);
+      *ret_stream_id = stream->id;
+      sgx_spin_unlock(&stream->lock);
+      return SGX_SUCCESS;
+    }
+    sgx_spin_unlock(&stream->lock);
+  }
+
+  return SGX_ERROR_BUSY;
+}
+
+sgx_status_t webauthn_stream_update(uint32_t stream_id, const uint8_t *chunk, uint32_t chunk_size) {
+  if (chunk_size > WEBAUTHN_STREAM_CHUNK_MAX) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  client_data_stream_t *stream = stream_acquire(stream_id);
+  if (stream == NULL) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  client_data_scan_update(&stream->scan, chunk, chunk_size);
+
+  sgx_spin_unlock(&stream->lock);
+  return SGX_SUCCESS;
+}
+
+sgx_status_t webauthn_stream_finish(uint32_t stream_id, const uint8_t *data, uint32_t data_size,
+                                    sgx_ec256_signature_t *ret_signature) {
+  // Expected `data_size` for the signature is 69 bytes
+  if (data_size != WEBAUTHN_SIGNED_DATA_SIZE) {
+    return SGX_ERROR_UNEXPECTED;
+  }
+
+  client_data_stream_t *stream = stream_acquire(stream_id);
+  if (stream == NULL) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  // Free the slot before signing
+  client_data_scan_t scan = stream->scan;
+  stream_close(stream);
+
+  sgx_status_t status = sign_scanned_assertion(data, data_size, &scan, ret_signature);
+  memset_s(&scan, sizeof(scan), 0, sizeof(scan));
+
+  return status;
+}
+
+// Same as `begin_tx_confirmation` with the clientDataJSON of `stream_id`,
+// which is closed either way
+sgx_status_t webauthn_stream_begin_tx(uint32_t stream_id, const uint8_t *data, uint32_t data_size,
+                                      webauthn_tx_handle_t *ret_handle, char *ret_text, uint32_t text_size) {
+  client_data_stream_t *stream = stream_acquire(stream_id);
+  if (stream == NULL) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  client_data_scan_t scan = stream->scan;
+  stream_close(stream);
+
+  sgx_status_t status = park_scanned_transaction(data, data_size, &scan, ret_handle, ret_text, text_size);
+  memset_s(&scan, sizeof(scan), 0, sizeof(scan));
+
+  return status;
+}
+
+sgx_status_t webauthn_stream_abort(uint32_t stream_id) {
+  client_data_stream_t *stream = stream_acquire(stream_id);
+  if (stream == NULL) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  stream_close(stream);
+  return SGX_SUCCESS;
+}
@@ -0,0 +1,70 @@
+/*
+ * cpu_features.cpp - Instruction set extensions usable inside the enclave.
+ */
+
+#include <stdint.h>
+
+#include "cpu_features.h"
+
+#include "sgx_cpuid.h"
+
+// CPUID.1:ECX
+#define CPUID_1_ECX_SSSE3   (1u << 9)
+#define CPUID_1_ECX_SSE4_1  (1u << 19)
+#define CPUID_1_ECX_OSXSAVE (1u << 27)
+
+// CPUID.(EAX=7,ECX=0):EBX
+#define CPUID_7_EBX_AVX2    (1u << 5)
+#define CPUID_7_EBX_AVX512F (1u << 16)
+#define CPUID_7_EBX_SHA     (1u << 29)
+
+// XCR0 state components
+#define XCR0_SSE_AVX        0x06ull  // XMM, YMM
+#define XCR0_AVX512         0xe0ull  // opmask, ZMM_Hi256, Hi16_ZMM
+
+// EENTER loads XCR0 with the enclave's XFRM, so this reports what
+// the enclave may actually use rather than what the OS enabled
+static uint64_t read_xcr0(void) {
+  uint32_t lo, hi;
+  __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static volatile uint32_t detected_features = 0;
+
+void cpu_features_detect(void) {
+  int leaf1[4] = {0};
+  int leaf7[4] = {0};
+  uint32_t features = 0;
+
+  if (sgx_cpuid(leaf1, 1) != SGX_SUCCESS ||
+      sgx_cpuidex(leaf7, 7, 0) != SGX_SUCCESS) {
+    return;
+  }
+
+  const uint32_t ecx1 = (uint32_t)leaf1[2];
+  const uint32_t ebx7 = (uint32_t)leaf7[1];
+
+  if ((ebx7 & CPUID_7_EBX_SHA) && (ecx1 & CPUID_1_ECX_SSSE3) && (ecx1 & CPUID_1_ECX_SSE4_1)) {
+    features |= CPU_FEATURE_SHA_NI;
+  }
+
+  if (ecx1 & CPUID_1_ECX_OSXSAVE) {
+    const uint64_t xcr0 = read_xcr0();
+
+    if ((xcr0 & XCR0_SSE_AVX) == XCR0_SSE_AVX) {
+      if (ebx7 & CPUID_7_EBX_AVX2) {
+        features |= CPU_FEATURE_AVX2;
+      }
+      if ((ebx7 & CPUID_7_EBX_AVX512F) && (xcr0 & XCR0_AVX512) == XCR0_AVX512) {
+        features |= CPU_FEATURE_AVX512F;
+      }
+    }
+  }
+
+  detected_features = features;
+}
+
+int cpu_has_feature(uint32_t feature) {
+  return (detected_features & feature) == feature;
+}
@@ -0,0 +1,33 @@
+/*
+ * cpu_features.h - Instruction set extensions usable inside the enclave.
+ *
+ * CPUID cannot be executed inside an enclave, so the features are
+ * queried once through the SDK's `sgx_cpuidex` OCALL. The answer comes
+ * from the host; a host that lies can only make the enclave fault on
+ * an unsupported instruction, which it could cause anyway.
+ */
+
+#ifndef _CPU_FEATURES_H_
+#define _CPU_FEATURES_H_
+
+#include <stdint.h>
+
+#define CPU_FEATURE_SHA_NI  (1u << 0)  // SHA extensions, plus the SSSE3/SSE4.1 they are used with
+#define CPU_FEATURE_AVX2    (1u << 1)  // AVX2, with YMM state enabled for the enclave
+#define CPU_FEATURE_AVX512F (1u << 2)  // AVX-512 Foundation, with ZMM/opmask state enabled for the enclave
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Query the CPU, called once from `enclave_init`. Until then
+// no feature is reported and the portable code paths are used
+void cpu_features_detect(void);
+
+int cpu_has_feature(uint32_t feature);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_CPU_FEATURES_H_ */
@@ -0,0 +1,1273 @@
+/*
+ * cred_db.cpp - Credential database.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Enclave_t.h"
+#include "cred_db.h"
+#include "cred_db_defs.h"
+#include "ecdsa.h"
+#include "log_ring.h"
+#include "scratch.h"
+#include "seal_key.h"
+#include "sign_counter.h"
+#include "tcs_context.h"
+
+#include "sgx_spinlock.h"
+#include "sgx_thread.h"
+#include "sgx_trts.h"
+#include "sgx_tseal.h"
+
+// A full page, its seal header included, fits in CRED_DB_PAGE_SIZE
+static_assert(sizeof(cred_db_page_t) + SEAL_KEY_SEALED_SIZE(sizeof(cred_db_page_secrets_t)) <= CRED_DB_PAGE_SIZE,
+              "CRED_DB_PAGE_RECORDS does not fit a page");
+
+// The key pair sealed in enclave_data.seal by older versions
+typedef struct {
+  sgx_ec256_public_t pk;
+  sgx_ec256_private_t sk;
+} legacy_key_pair_t;
+
+typedef struct {
+  uint32_t seq;        // odd while a writer changes the entry, see entry_read
+  int32_t next;        // in its bucket's chain, -1 at the end
+  uint8_t valid;
+  uint8_t referenced;  // set by every hit, cleared as the clock hand passes
+  uint8_t pk_valid;    // `pk` has been derived
+  uint8_t pk[ECDSA_COMPRESSED_KEY_SIZE];
+  cred_record_t record;
+} cred_cache_entry_t;
+
+// The cache at one size, replaced as a whole when it is resized
+typedef struct {
+  cred_cache_entry_t *entries;
+  int32_t *buckets;
+  uint32_t capacity;
+  uint32_t bucket_mask;
+} cred_cache_table_t;
+
+// The host's mapping of the database, replaced as a whole when it moves
+typedef struct {
+  const uint8_t *base;
+  uint64_t size;
+  uint64_t slots;
+} db_map_t;
+
+// Lookups read the mapping `db_map` points to in a read section, or
+// under `map_lock` on threads without a TCS context (see map_read_begin),
+// so they never wait for a write. Writes are serialized by `db_mutex`,
+// a mutex rather than a spinlock since it is held across the OCALLs that
+// write pages. The host keeps a mapping it moved away from until the
+// writer has waited out the lookups still using it
+static db_map_t *db_map = NULL;
+static sgx_spinlock_t map_lock = SGX_SPINLOCK_INITIALIZER;
+static sgx_thread_mutex_t db_mutex = SGX_THREAD_MUTEX_INITIALIZER;
+
+// Unsealed credentials. The buckets chain the entries by ID and the
+// clock hand sweeps the entries for a victim: an entry used since the
+// hand last passed gets another round. Changes are made under
+// `cache_lock`, lookups take no lock on threads with a TCS context (see
+// cache_read), so registrations never hold up signatures on other TCS
+static cred_cache_table_t *cache_table = NULL;  // NULL while the cache is disabled
+static uint32_t cache_hand = 0;
+static cred_db_cache_stats_t cache_stats;
+static int cache_configured = 0;
+static uint64_t cache_generation = 0;  // bumped by every delete and counter write-back
+static sgx_spinlock_t cache_lock = SGX_SPINLOCK_INITIALIZER;
+
+// Serializes creating the device credential
+static sgx_thread_mutex_t device_mutex = SGX_THREAD_MUTEX_INITIALIZER;
+static const uint8_t device_id[WEBAUTHN_CREDENTIAL_ID_SIZE] = {0};
+
+static uint64_t id_hash(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE]) {
+  uint64_t hash;
+  memcpy(&hash, id, sizeof(hash));
+  return hash;
+}
+
+// The mapping to read, until map_read_end. NULL if there is none
+static const db_map_t *map_read_begin(tcs_context_t *context) {
+  if (context == NULL) {
+    sgx_spin_lock(&map_lock);
+    return db_map;
+  }
+
+  tcs_read_begin(context);
+  return __atomic_load_n(&db_map, __ATOMIC_ACQUIRE);
+}
+
+static void map_read_end(tcs_context_t *context) {
+  if (context == NULL) {
+    sgx_spin_unlock(&map_lock);
+  } else {
+    tcs_read_end(context);
+  }
+}
+
+// Check the header of the host's mapping and start using it. Only the
+// values checked here are trusted, the mapping may change at any time.
+// Called with `db_mutex` held
+static sgx_status_t attach_locked(const uint8_t *db, uint64_t size) {
+  cred_db_header_t header;
+  db_map_t *map = NULL;
+  sgx_status_t status = SGX_ERROR_INVALID_PARAMETER;
+
+  // Most writes leave the mapping where it was
+  if (db_map != NULL && db_map->base == db && db_map->size == size) {
+    return SGX_SUCCESS;
+  }
+
+  if (db != NULL && size >= CRED_DB_HEADER_SIZE && sgx_is_outside_enclave(db, size)) {
+    memcpy(&header, db, sizeof(header));
+    if (header.magic == CRED_DB_MAGIC && header.version == CRED_DB_VERSION &&
+        header.index_slots != 0 && !(header.index_slots & (header.index_slots - 1)) &&
+        header.index_slots <= CRED_DB_MAX_SLOTS &&
+        CRED_DB_PAGES_OFFSET(header.index_slots) <= size) {
+      map = (db_map_t*)malloc(sizeof(*map));
+      status = SGX_ERROR_OUT_OF_MEMORY;
+    }
+  }
+  if (map != NULL) {
+    map->base = db;
+    map->size = size;
+    map->slots = header.index_slots;
+    status = SGX_SUCCESS;
+  }
+
+  sgx_spin_lock(&map_lock);
+  db_map_t *old_map = db_map;
+  __atomic_store_n(&db_map, map, __ATOMIC_RELEASE);
+  sgx_spin_unlock(&map_lock);
+
+  // Lookups may still be reading the old mapping, the host unmaps it
+  // once they are done
+  if (old_map != NULL) {
+    tcs_read_synchronize();
+    free(old_map);
+    untrusted_cred_db_release();
+  }
+
+  return status;
+}
+
+// The host's count of pages rewritten in place, odd while it rewrites one
+static uint64_t map_page_seq(const db_map_t *map) {
+  return __atomic_load_n((const uint64_t*)(map->base + offsetof(cred_db_header_t, page_seq)), __ATOMIC_ACQUIRE);
+}
+
+// Whether `page_offset` is a page within `map`
+static int page_in_bounds(const db_map_t *map, uint64_t page_offset) {
+  return page_offset >= CRED_DB_PAGES_OFFSET(map->slots) &&
+         page_offset % CRED_DB_PAGE_SIZE == 0 &&
+         page_offset <= map->size - CRED_DB_PAGE_SIZE;
+}
+
+// Copy the page at `page_offset` into `page` and check its header
+static sgx_status_t read_page(const db_map_t *map, uint64_t page_offset, uint8_t *page) {
+  if (!page_in_bounds(map, page_offset)) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  // Bounds checked before the page is read
+  __builtin_ia32_lfence();
+  memcpy(page, map->base + page_offset, CRED_DB_PAGE_SIZE);
+
+  const cred_db_page_t *header = (const cred_db_page_t*)page;
+  if (header->count == 0 || header->count > CRED_DB_PAGE_RECORDS ||
+      header->sealed_size != SEAL_KEY_SEALED_SIZE(sizeof(cred_db_page_secrets_t))) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  return SGX_SUCCESS;
+}
+
+// Probe the index of `map` for `id` and copy the page of its record into `page`
+static sgx_status_t find_record(const db_map_t *map, const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE], uint8_t *page,
+                                uint64_t *ret_page_offset, uint32_t *ret_index) {
+  const cred_db_page_t *header = (const cred_db_page_t*)page;
+  const uint64_t hash = id_hash(id);
+  uint64_t probe;
+
+  if (map == NULL) {
+    return SGX_ERROR_INVALID_STATE;
+  }
+
+  const cred_db_slot_t *index = (const cred_db_slot_t*)(map->base + CRED_DB_ID_INDEX_OFFSET);
+
+  for (probe = 0; probe < map->slots; probe++) {
+    cred_db_slot_t slot;
+
+    memcpy(&slot, &index[(hash + probe) & (map->slots - 1)], sizeof(slot));
+    if (slot.ref == CRED_DB_SLOT_FREE) {
+      break;
+    }
+    if (slot.ref == CRED_DB_SLOT_DELETED || slot.id_hash != hash) {
+      continue;
+    }
+
+    const uint64_t page_offset = CRED_DB_REF_PAGE(slot.ref);
+    const uint32_t i = CRED_DB_REF_INDEX(slot.ref);
+    if (i >= CRED_DB_PAGE_RECORDS || !page_in_bounds(map, page_offset)) {
+      continue;
+    }
+
+    // Skip records of other credentials whose IDs share the first 8
+    // bytes by their ID alone, without copying the page
+    __builtin_ia32_lfence();
+    if (memcmp(map->base + page_offset + offsetof(cred_db_page_t, ids) + i * WEBAUTHN_CREDENTIAL_ID_SIZE,
+               id, WEBAUTHN_CREDENTIAL_ID_SIZE) != 0) {
+      continue;
+    }
+
+    // The host may have changed the page since, check the copy
+    if (read_page(map, page_offset, page) == SGX_SUCCESS && i < header->count &&
+        memcmp(header->ids[i], id, WEBAUTHN_CREDENTIAL_ID_SIZE) == 0) {
+      *ret_page_offset = page_offset;
+      *ret_index = i;
+      return SGX_SUCCESS;
+    }
+  }
+
+  return SGX_ERROR_INVALID_PARAMETER;
+}
+
+// Unseal the secrets of a page copied by `read_page_locked`. The IDs of
+// the copy are then authentic too, they are authenticated with the secrets
+static sgx_status_t unseal_page(const uint8_t *page, cred_db_page_secrets_t *ret_secrets) {
+  const cred_db_page_t *header = (const cred_db_page_t*)page;
+  uint32_t secrets_size = sizeof(*ret_secrets);
+
+  sgx_status_t status = seal_key_unseal(header->ids[0], header->count * WEBAUTHN_CREDENTIAL_ID_SIZE,
+                                        page + sizeof(*header), header->sealed_size,
+                                        (uint8_t*)ret_secrets, &secrets_size);
+  if (status) {
+    return status;
+  }
+
+  if (secrets_size != sizeof(*ret_secrets)) {
+    memset_s(ret_secrets, sizeof(*ret_secrets), 0, sizeof(*ret_secrets));
+    return SGX_ERROR_MAC_MISMATCH;
+  }
+
+  return SGX_SUCCESS;
+}
+
+// Seal `secrets` after the header of `page`, whose IDs and count are set
+static sgx_status_t seal_page(uint8_t *page, const cred_db_page_secrets_t *secrets) {
+  cred_db_page_t *header = (cred_db_page_t*)page;
+
+  header->sealed_size = SEAL_KEY_SEALED_SIZE(sizeof(*secrets));
+  return seal_key_seal(header->ids[0], header->count * WEBAUTHN_CREDENTIAL_ID_SIZE,
+                       (const uint8_t*)secrets, sizeof(*secrets),
+                       page + sizeof(*header), header->sealed_size);
+}
+
+static int32_t *cache_bucket(const cred_cache_table_t *table, const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE]) {
+  return &table->buckets[id_hash(id) & table->bucket_mask];
+}
+
+// Called with `cache_lock` held
+static int32_t cache_find_locked(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE]) {
+  const cred_cache_table_t *table = cache_table;
+  int32_t index;
+
+  if (table == NULL) {
+    return -1;
+  }
+
+  for (index = *cache_bucket(table, id); index >= 0; index = table->entries[index].next) {
+    if (memcmp(table->entries[index].record.id, id, WEBAUTHN_CREDENTIAL_ID_SIZE) == 0) {
+      return index;
+    }
+  }
+
+  return -1;
+}
+
+// Bracket every change to an entry other than its chain link and
+// `referenced`. Called with `cache_lock` held
+static void entry_write_begin(cred_cache_entry_t *entry) {
+  __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void entry_write_end(cred_cache_entry_t *entry) {
+  __atomic_store_n(&entry->seq, entry->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Copy `entry` into `ret_entry` if it holds credential `id`, 0 if it does
+// not. A copy a writer got in between is made again: writers only hold
+// an entry for as long as it takes to copy a record
+static int entry_read(const cred_cache_entry_t *entry, const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE],
+                      cred_cache_entry_t *ret_entry) {
+  for (;;) {
+    const uint32_t seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      __builtin_ia32_pause();
+      continue;
+    }
+
+    const int match = entry->valid && memcmp(entry->record.id, id, WEBAUTHN_CREDENTIAL_ID_SIZE) == 0;
+    if (match) {
+      memcpy(ret_entry, entry, sizeof(*ret_entry));
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq) {
+      return match;
+    }
+  }
+}
+
+// Unlink and wipe the entry `index`. Called with `cache_lock` held
+static void cache_drop_locked(int32_t index) {
+  const cred_cache_table_t *table = cache_table;
+  cred_cache_entry_t *entry = &table->entries[index];
+  int32_t *link = cache_bucket(table, entry->record.id);
+
+  while (*link != index) {
+    link = &table->entries[*link].next;
+  }
+  __atomic_store_n(link, entry->next, __ATOMIC_RELEASE);
+
+  entry_write_begin(entry);
+  memset_s(&entry->record, sizeof(entry->record), 0, sizeof(entry->record));
+  entry->valid = 0;
+  entry->pk_valid = 0;
+  entry_write_end(entry);
+  __atomic_store_n(&entry->next, -1, __ATOMIC_RELEASE);
+  cache_stats.entries--;
+}
+
+// Free an entry, evicting the first one the clock hand finds unused since
+// its last pass. Called with `cache_lock` held
+static int32_t cache_victim_locked(void) {
+  const cred_cache_table_t *table = cache_table;
+
+  for (;;) {
+    const int32_t index = (int32_t)cache_hand;
+    cred_cache_entry_t *entry = &table->entries[index];
+
+    cache_hand = (cache_hand + 1) % table->capacity;
+
+    if (!entry->valid) {
+      return index;
+    }
+    if (__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED)) {
+      __atomic_store_n(&entry->referenced, 0, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    cache_drop_locked(index);
+    cache_stats.evictions++;
+    return index;
+  }
+}
+
+// Cache `record`, read from the database at `generation`, unless it has
+// been deleted since
+static void cache_put(const cred_record_t *record, uint64_t generation) {
+  sgx_spin_lock(&cache_lock);
+  const cred_cache_table_t *table = cache_table;
+
+  if (generation == cache_generation && table != NULL) {
+    int32_t index = cache_find_locked(record->id);
+    const int linked = index >= 0;
+
+    if (!linked) {
+      index = cache_victim_locked();
+    }
+
+    cred_cache_entry_t *entry = &table->entries[index];
+    entry_write_begin(entry);
+    entry->record = *record;
+    entry->valid = 1;
+    if (!linked) {
+      entry->pk_valid = 0;
+    }
+    entry_write_end(entry);
+    __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+
+    // Linked once it is complete, so readers never find half a record
+    if (!linked) {
+      int32_t *bucket = cache_bucket(table, record->id);
+      __atomic_store_n(&entry->next, *bucket, __ATOMIC_RELAXED);
+      __atomic_store_n(bucket, index, __ATOMIC_RELEASE);
+      cache_stats.entries++;
+    }
+  }
+  sgx_spin_unlock(&cache_lock);
+}
+
+// Copy the cached entry of `id` into `ret_entry`, 0 if it is not cached.
+// Threads with a TCS context walk the table in a read section, which
+// keeps it from being freed under them, and copy entries with entry_read.
+// A chain that changes during the walk may lead it astray, which only
+// makes a miss
+static int cache_read(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE], cred_cache_entry_t *ret_entry) {
+  tcs_context_t *context = tcs_context_get();
+  int found = 0;
+
+  if (context == NULL) {
+    sgx_spin_lock(&cache_lock);
+    const int32_t index = cache_find_locked(id);
+    if (index >= 0) {
+      *ret_entry = cache_table->entries[index];
+      cache_table->entries[index].referenced = 1;
+      found = 1;
+    }
+    sgx_spin_unlock(&cache_lock);
+    return found;
+  }
+
+  tcs_read_begin(context);
+  const cred_cache_table_t *table = __atomic_load_n(&cache_table, __ATOMIC_ACQUIRE);
+  if (table != NULL) {
+    int32_t index = __atomic_load_n(cache_bucket(table, id), __ATOMIC_ACQUIRE);
+    uint32_t steps;
+
+    for (steps = 0; index >= 0 && (uint32_t)index < table->capacity && steps < table->capacity; steps++) {
+      cred_cache_entry_t *entry = &table->entries[index];
+
+      if (entry_read(entry, id, ret_entry)) {
+        // Stored only when it changes, hits do not keep dirtying the line
+        if (!__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED)) {
+          __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+        }
+        found = 1;
+        break;
+      }
+      index = __atomic_load_n(&entry->next, __ATOMIC_ACQUIRE);
+    }
+  }
+  tcs_read_end(context);
+
+  return found;
+}
+
+// Copy the cached credential `id` into `ret_record`, 0 if it is not cached
+static int cache_get(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE], cred_record_t *ret_record) {
+  tcs_context_t *context = tcs_context_get();
+  cred_cache_entry_t entry;
+
+  const int found = cache_read(id, &entry);
+  if (found) {
+    *ret_record = entry.record;
+  }
+  memset_s(&entry, sizeof(entry), 0, sizeof(entry));
+
+  // Counted in the thread's own shard when it has one, so the lookup
+  // does not also write to a shared line
+  if (context != NULL) {
+    if (found) {
+      context->stats.cache_hits++;
+    } else {
+      context->stats.cache_misses++;
+    }
+  } else {
+    __sync_fetch_and_add(found ? &cache_stats.hits : &cache_stats.misses, 1);
+  }
+
+  return found;
+}
+
+// Copy the cached public key of `id` into `ret_compressed`, 0 if it has
+// not been derived yet
+static int cache_get_public_key(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE],
+                                uint8_t ret_compressed[ECDSA_COMPRESSED_KEY_SIZE]) {
+  cred_cache_entry_t entry;
+
+  const int found = cache_read(id, &entry) && entry.pk_valid;
+  if (found) {
+    memcpy(ret_compressed, entry.pk, ECDSA_COMPRESSED_KEY_SIZE);
+  }
+  memset_s(&entry, sizeof(entry), 0, sizeof(entry));
+
+  return found;
+}
+
+// Keep the public key of `id` with its record, if that is still cached
+static void cache_put_public_key(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE],
+                                 const uint8_t compressed[ECDSA_COMPRESSED_KEY_SIZE]) {
+  sgx_spin_lock(&cache_lock);
+  const int32_t index = cache_find_locked(id);
+
+  if (index >= 0) {
+    cred_cache_entry_t *entry = &cache_table->entries[index];
+    entry_write_begin(entry);
+    memcpy(entry->pk, compressed, ECDSA_COMPRESSED_KEY_SIZE);
+    entry->pk_valid = 1;
+    entry_write_end(entry);
+  }
+  sgx_spin_unlock(&cache_lock);
+}
+
+static uint64_t cache_current_generation(void) {
+  sgx_spin_lock(&cache_lock);
+  const uint64_t generation = cache_generation;
+  sgx_spin_unlock(&cache_lock);
+
+  return generation;
+}
+
+static void cache_table_free(cred_cache_table_t *table) {
+  if (table == NULL) {
+    return;
+  }
+  if (table->entries != NULL) {
+    memset_s(table->entries, table->capacity * sizeof(*table->entries), 0,
+             table->capacity * sizeof(*table->entries));
+  }
+  free(table->entries);
+  free(table->buckets);
+  free(table);
+}
+
+sgx_status_t cred_db_set_cache_budget(uint64_t budget) {
+  cred_cache_table_t *table = NULL;
+  uint32_t capacity;
+  uint32_t num_buckets = 1;
+  uint32_t i;
+
+  if (budget > CRED_DB_CACHE_MAX_BUDGET) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  // There are fewer than two buckets per entry, so the entries and
+  // their buckets fit in `budget`
+  capacity = (uint32_t)(budget / (sizeof(cred_cache_entry_t) + 2 * sizeof(int32_t)));
+  while (num_buckets < capacity) {
+    num_buckets <<= 1;
+  }
+
+  if (capacity > 0) {
+    table = (cred_cache_table_t*)calloc(1, sizeof(*table));
+    if (table == NULL) {
+      return SGX_ERROR_OUT_OF_MEMORY;
+    }
+    table->entries = (cred_cache_entry_t*)malloc(capacity * sizeof(*table->entries));
+    table->buckets = (int32_t*)malloc(num_buckets * sizeof(*table->buckets));
+    if (table->entries == NULL || table->buckets == NULL) {
+      cache_table_free(table);
+      return SGX_ERROR_OUT_OF_MEMORY;
+    }
+    table->capacity = capacity;
+    table->bucket_mask = num_buckets - 1;
+
+    for (i = 0; i < capacity; i++) {
+      table->entries[i].seq = 0;
+      table->entries[i].next = -1;
+      table->entries[i].valid = 0;
+      table->entries[i].referenced = 0;
+      table->entries[i].pk_valid = 0;
+    }
+    for (i = 0; i < num_buckets; i++) {
+      table->buckets[i] = -1;
+    }
+  }
+
+  // Start over empty, the credentials dropped count as evicted
+  sgx_spin_lock(&cache_lock);
+  cred_cache_table_t *old_table = cache_table;
+  __atomic_store_n(&cache_table, table, __ATOMIC_RELEASE);
+  cache_hand = 0;
+  cache_stats.evictions += cache_stats.entries;
+  cache_stats.entries = 0;
+  cache_stats.capacity = capacity;
+  cache_stats.budget = budget;
+  cache_configured = 1;
+  sgx_spin_unlock(&cache_lock);
+
+  // Lookups may still be walking the old table
+  if (old_table != NULL) {
+    tcs_read_synchronize();
+    cache_table_free(old_table);
+  }
+
+  return SGX_SUCCESS;
+}
+
+sgx_status_t cred_db_get_cache_stats(cred_db_cache_stats_t *ret_stats) {
+  uint32_t i;
+
+  sgx_spin_lock(&cache_lock);
+  *ret_stats = cache_stats;
+  sgx_spin_unlock(&cache_lock);
+
+  for (i = 0; i < TCS_CONTEXT_MAX; i++) {
+    const tcs_context_t *context = tcs_context_at(i);
+    if (context != NULL) {
+      ret_stats->hits += context->stats.cache_hits;
+      ret_stats->misses += context->stats.cache_misses;
+    }
+  }
+
+  return SGX_SUCCESS;
+}
+
+sgx_status_t cred_db_attach(const uint8_t *db, uint64_t size) {
+  sgx_status_t status;
+
+  // The default cache, unless the host has sized it already
+  sgx_spin_lock(&cache_lock);
+  const int configured = cache_configured;
+  sgx_spin_unlock(&cache_lock);
+
+  if (!configured) {
+    status = cred_db_set_cache_budget(CRED_DB_CACHE_BUDGET);
+    if (status) {
+      return status;
+    }
+  }
+
+  sgx_thread_mutex_lock(&db_mutex);
+  status = attach_locked(db, size);
+  sgx_thread_mutex_unlock(&db_mutex);
+
+  return status;
+}
+
+sgx_status_t cred_db_get(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE], cred_record_t *ret_record) {
+  cred_db_page_secrets_t secrets;
+  uint64_t page_offset;
+  uint32_t i;
+  uint32_t j;
+  sgx_status_t status;
+
+  if (cache_get(id, ret_record)) {
+    return SGX_SUCCESS;
+  }
+
+  uint8_t *page = (uint8_t*)scratch_alloc(CRED_DB_PAGE_SIZE);
+  if (page == NULL) {
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+
+  // Read without `db_mutex`, so a miss does not wait for writes to the
+  // host. A page the host rewrote meanwhile may have been copied half
+  // done; it is copied again under `db_mutex`, the host only writes for
+  // whoever holds it
+  tcs_context_t *context = tcs_context_get();
+  const uint64_t generation = cache_current_generation();
+  const db_map_t *map = map_read_begin(context);
+  const uint64_t seq = (map != NULL) ? map_page_seq(map) : 0;
+  status = find_record(map, id, page, &page_offset, &i);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  const int torn = map != NULL && ((seq & 1) || map_page_seq(map) != seq);
+  map_read_end(context);
+
+  if (torn) {
+    sgx_thread_mutex_lock(&db_mutex);
+    status = find_record(db_map, id, page, &page_offset, &i);
+    sgx_thread_mutex_unlock(&db_mutex);
+  }
+
+  if (!status) {
+    status = unseal_page(page, &secrets);
+  }
+  scratch_free(page);
+
+  if (status) {
+    return status;
+  }
+
+  // A deleted record is zeroed in place and the host may still serve
+  // its page. Never hand out, or cache, the all-zero key of one
+  uint8_t sk_bits = 0;
+  for (j = 0; j < SGX_ECP256_KEY_SIZE; j++) {
+    sk_bits |= secrets.sk[i][j];
+  }
+  if (CRED_META_ALG(secrets.meta[i]) != CRED_ALG_ES256 || sk_bits == 0) {
+    memset_s(&secrets, sizeof(secrets), 0, sizeof(secrets));
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  memcpy(ret_record->id, id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+  memcpy(ret_record->rp_id_hash, secrets.rp_id_hash[i], SHA256_DIGEST_SIZE);
+  memcpy(ret_record->sk.r, secrets.sk[i], SGX_ECP256_KEY_SIZE);
+  ret_record->meta = secrets.meta[i];
+  ret_record->counter = secrets.counter[i];
+  ret_record->counter_epoch = secrets.counter_epoch[i];
+  memset_s(&secrets, sizeof(secrets), 0, sizeof(secrets));
+
+  cache_put(ret_record, generation);
+  return SGX_SUCCESS;
+}
+
+sgx_status_t cred_db_put(const cred_record_t *record, const sgx_ec256_public_t *pk) {
+  cred_db_page_secrets_t secrets;
+  cred_db_header_t db_header;
+  uint64_t new_base = 0;
+  uint64_t new_size = 0;
+  int32_t error = 0;
+  uint32_t i = 0;
+  sgx_status_t status;
+
+  uint8_t *page = (uint8_t*)scratch_alloc(CRED_DB_PAGE_SIZE);
+  if (page == NULL) {
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+  cred_db_page_t *header = (cred_db_page_t*)page;
+
+  uint64_t rp_hash;
+  memcpy(&rp_hash, record->rp_id_hash, sizeof(rp_hash));
+
+  sgx_thread_mutex_lock(&db_mutex);
+  const uint64_t generation = cache_current_generation();
+  if (db_map == NULL) {
+    status = SGX_ERROR_INVALID_STATE;
+  } else {
+    // Add to the host's last page while it has room, reseal it with the
+    // new record. If it cannot be read, start a page of our own
+    memcpy(&db_header, db_map->base, sizeof(db_header));
+    uint64_t tail = db_header.tail_page;
+
+    if (tail && read_page(db_map, tail, page) == SGX_SUCCESS && header->count < CRED_DB_PAGE_RECORDS &&
+        unseal_page(page, &secrets) == SGX_SUCCESS) {
+      i = header->count;
+    } else {
+      tail = 0;
+      memset(page, 0, CRED_DB_PAGE_SIZE);
+      memset(&secrets, 0, sizeof(secrets));
+    }
+
+    memcpy(header->ids[i], record->id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+    memcpy(secrets.sk[i], record->sk.r, SGX_ECP256_KEY_SIZE);
+    memcpy(secrets.rp_id_hash[i], record->rp_id_hash, SHA256_DIGEST_SIZE);
+    secrets.meta[i] = record->meta;
+    secrets.counter[i] = record->counter;
+    secrets.counter_epoch[i] = record->counter_epoch;
+    header->count = i + 1;
+
+    status = seal_page(page, &secrets);
+    memset_s(&secrets, sizeof(secrets), 0, sizeof(secrets));
+
+    // Written and synced before the OCALL returns. Whether or not it
+    // succeeded, the mapping may have moved
+    if (!status) {
+      status = untrusted_cred_db_put(&error, tail, record->id, rp_hash, page + sizeof(*header),
+                                     header->sealed_size, &new_base, &new_size);
+    }
+    if (!status) {
+      status = attach_locked((const uint8_t*)(uintptr_t)new_base, new_size);
+    }
+    if (!status && error) {
+      LOG_ERROR("The host failed to write a credential to the database");
+      status = SGX_ERROR_UNEXPECTED;
+    }
+  }
+  sgx_thread_mutex_unlock(&db_mutex);
+  scratch_free(page);
+
+  if (status) {
+    return status;
+  }
+
+  cache_put(record, generation);
+  if (pk != NULL) {
+    uint8_t compressed[ECDSA_COMPRESSED_KEY_SIZE];
+
+    ecdsa_compress_public_key(pk, compressed);
+    cache_put_public_key(record->id, compressed);
+  }
+  return SGX_SUCCESS;
+}
+
+sgx_status_t cred_db_put_batch(const cred_record_t *records, uint32_t count) {
+  seal_key_item_t items[CRED_DB_BATCH_PAGES];
+  uint64_t new_base = 0;
+  uint64_t new_size = 0;
+  int32_t error = 0;
+  uint32_t p;
+  uint32_t i;
+  sgx_status_t status;
+
+  if (count == 0 || count > CRED_DB_BATCH_RECORDS) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  const uint32_t num_pages = (count + CRED_DB_PAGE_RECORDS - 1) / CRED_DB_PAGE_RECORDS;
+  uint8_t *pages = (uint8_t*)scratch_alloc(num_pages * CRED_DB_PAGE_SIZE);
+  cred_db_page_secrets_t *secrets = (cred_db_page_secrets_t*)scratch_alloc(num_pages * sizeof(*secrets));
+  if (pages == NULL || secrets == NULL) {
+    scratch_free(secrets);
+    scratch_free(pages);
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+  memset(pages, 0, num_pages * CRED_DB_PAGE_SIZE);
+  memset(secrets, 0, num_pages * sizeof(*secrets));
+
+  // Fill whole pages of new records, the tail page is left to cred_db_put
+  for (i = 0; i < count; i++) {
+    cred_db_page_t *header = (cred_db_page_t*)(pages + (i / CRED_DB_PAGE_RECORDS) * CRED_DB_PAGE_SIZE);
+    cred_db_page_secrets_t *page_secrets = &secrets[i / CRED_DB_PAGE_RECORDS];
+    const uint32_t j = header->count++;
+
+    memcpy(header->ids[j], records[i].id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+    memcpy(&header->rp_hash[j], records[i].rp_id_hash, sizeof(header->rp_hash[j]));
+    memcpy(page_secrets->sk[j], records[i].sk.r, SGX_ECP256_KEY_SIZE);
+    memcpy(page_secrets->rp_id_hash[j], records[i].rp_id_hash, SHA256_DIGEST_SIZE);
+    page_secrets->meta[j] = records[i].meta;
+    page_secrets->counter[j] = records[i].counter;
+    page_secrets->counter_epoch[j] = records[i].counter_epoch;
+  }
+
+  // One key lookup for the whole batch, and no lock: the pages are ours
+  for (p = 0; p < num_pages; p++) {
+    cred_db_page_t *header = (cred_db_page_t*)(pages + p * CRED_DB_PAGE_SIZE);
+
+    header->sealed_size = SEAL_KEY_SEALED_SIZE(sizeof(*secrets));
+    items[p].aad = header->ids[0];
+    items[p].aad_size = header->count * WEBAUTHN_CREDENTIAL_ID_SIZE;
+    items[p].payload = (uint8_t*)&secrets[p];
+    items[p].payload_size = sizeof(*secrets);
+    items[p].sealed = (uint8_t*)header + sizeof(*header);
+    items[p].sealed_size = header->sealed_size;
+  }
+  status = seal_key_seal_batch(items, num_pages);
+  memset_s(secrets, num_pages * sizeof(*secrets), 0, num_pages * sizeof(*secrets));
+  scratch_free(secrets);
+
+  if (!status) {
+    sgx_thread_mutex_lock(&db_mutex);
+    if (db_map == NULL) {
+      status = SGX_ERROR_INVALID_STATE;
+    } else {
+      // As for cred_db_put, the mapping may have moved either way
+      status = untrusted_cred_db_put_pages(&error, pages, num_pages * CRED_DB_PAGE_SIZE, &new_base, &new_size);
+      if (!status) {
+        status = attach_locked((const uint8_t*)(uintptr_t)new_base, new_size);
+      }
+      if (!status && error) {
+        LOG_ERROR("The host failed to write %u pages of credentials to the database", num_pages);
+        status = SGX_ERROR_UNEXPECTED;
+      }
+    }
+    sgx_thread_mutex_unlock(&db_mutex);
+  }
+  scratch_free(pages);
+
+  return status;
+}
+
+sgx_status_t cred_db_get_public_key(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE], sgx_ec256_public_t *ret_pk) {
+  uint8_t compressed[ECDSA_COMPRESSED_KEY_SIZE];
+  cred_record_t record;
+  sgx_status_t status;
+
+  if (!cache_get_public_key(id, compressed)) {
+    status = cred_db_get(id, &record);
+    if (!status) {
+      status = ecdsa_public_key(&record.sk, compressed);
+    }
+    memset_s(&record, sizeof(record), 0, sizeof(record));
+
+    if (status) {
+      return status;
+    }
+    cache_put_public_key(id, compressed);
+  }
+
+  ecdsa_decompress_public_key(compressed, ret_pk);
+  return SGX_SUCCESS;
+}
+
+sgx_status_t cred_db_delete(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE]) {
+  cred_db_page_secrets_t secrets;
+  uint64_t page_offset;
+  uint32_t i;
+  int32_t error = 0;
+  sgx_status_t status;
+
+  uint8_t *page = (uint8_t*)scratch_alloc(CRED_DB_PAGE_SIZE);
+  if (page == NULL) {
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+  cred_db_page_t *header = (cred_db_page_t*)page;
+
+  sgx_thread_mutex_lock(&db_mutex);
+  status = find_record(db_map, id, page, &page_offset, &i);
+
+  // Wipe the private key from the page. The host still drops the record
+  // if the page cannot be unsealed, it is of no use then
+  if (!status) {
+    uint32_t sealed_size = 0;
+
+    if (unseal_page(page, &secrets) == SGX_SUCCESS) {
+      memset(secrets.sk[i], 0, SGX_ECP256_KEY_SIZE);
+      memset(secrets.rp_id_hash[i], 0, SHA256_DIGEST_SIZE);
+      secrets.meta[i] = 0;
+      secrets.counter[i] = 0;
+      secrets.counter_epoch[i] = 0;
+
+      if (seal_page(page, &secrets) == SGX_SUCCESS) {
+        sealed_size = header->sealed_size;
+      }
+      memset_s(&secrets, sizeof(secrets), 0, sizeof(secrets));
+    }
+
+    status = untrusted_cred_db_delete(&error, id, page + sizeof(*header), sealed_size);
+    if (!status && error) {
+      status = SGX_ERROR_INVALID_PARAMETER;
+    }
+  }
+
+  // Also keeps lookups that read the record before the delete from caching it
+  sgx_spin_lock(&cache_lock);
+  cache_generation++;
+  const int32_t index = cache_find_locked(id);
+  if (index >= 0) {
+    cache_drop_locked(index);
+  }
+  sgx_spin_unlock(&cache_lock);
+  sgx_thread_mutex_unlock(&db_mutex);
+  scratch_free(page);
+
+  return status;
+}
+
+// Walk the rp index list of `rp_hash` in `map` for at most `max_ids` credential IDs
+static uint32_t list_rp(const db_map_t *map, uint64_t rp_hash, uint8_t *ids, uint32_t max_ids) {
+  const cred_db_rp_slot_t *index = (const cred_db_rp_slot_t*)(map->base + CRED_DB_RP_INDEX_OFFSET(map->slots));
+  uint64_t ref = 0;
+  uint64_t probe;
+  uint32_t count = 0;
+
+  for (probe = 0; probe < map->slots; probe++) {
+    cred_db_rp_slot_t slot;
+
+    memcpy(&slot, &index[(rp_hash + probe) & (map->slots - 1)], sizeof(slot));
+    if (!slot.used) {
+      break;
+    }
+    if (slot.rp_hash == rp_hash) {
+      ref = slot.head;
+      break;
+    }
+  }
+
+  // At most `max_ids` hops, however the host links the records
+  while (ref && count < max_ids) {
+    const uint64_t page_offset = CRED_DB_REF_PAGE(ref);
+    const uint32_t i = CRED_DB_REF_INDEX(ref);
+    uint64_t record_rp_hash;
+
+    if (i >= CRED_DB_PAGE_RECORDS || !page_in_bounds(map, page_offset)) {
+      break;
+    }
+    __builtin_ia32_lfence();
+
+    const uint8_t *page = map->base + page_offset;
+    memcpy(&record_rp_hash, page + offsetof(cred_db_page_t, rp_hash) + i * sizeof(uint64_t), sizeof(record_rp_hash));
+    if (record_rp_hash != rp_hash) {
+      break;
+    }
+
+    memcpy(ids + count * WEBAUTHN_CREDENTIAL_ID_SIZE,
+           page + offsetof(cred_db_page_t, ids) + i * WEBAUTHN_CREDENTIAL_ID_SIZE, WEBAUTHN_CREDENTIAL_ID_SIZE);
+    count++;
+    memcpy(&ref, page + offsetof(cred_db_page_t, rp_next) + i * sizeof(uint64_t), sizeof(ref));
+  }
+
+  return count;
+}
+
+sgx_status_t cred_db_list(const uint8_t rp_id_hash[SHA256_DIGEST_SIZE],
+                          uint8_t *ret_ids, uint32_t max_ids, uint32_t *ret_count) {
+  cred_record_t record;
+  uint64_t rp_hash;
+  uint32_t candidates;
+  uint32_t count = 0;
+  uint32_t i;
+
+  memcpy(&rp_hash, rp_id_hash, sizeof(rp_hash));
+
+  // As for cred_db_get, IDs copied from a page the host was rewriting
+  // are copied again under `db_mutex`
+  tcs_context_t *context = tcs_context_get();
+  const db_map_t *map = map_read_begin(context);
+  if (map == NULL) {
+    map_read_end(context);
+    return SGX_ERROR_INVALID_STATE;
+  }
+  const uint64_t seq = map_page_seq(map);
+  candidates = list_rp(map, rp_hash, ret_ids, max_ids);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  const int torn = (seq & 1) || map_page_seq(map) != seq;
+  map_read_end(context);
+
+  if (torn) {
+    sgx_thread_mutex_lock(&db_mutex);
+    candidates = (db_map != NULL) ? list_rp(db_map, rp_hash, ret_ids, max_ids) : 0;
+    sgx_thread_mutex_unlock(&db_mutex);
+  }
+
+  // The list is only the host's word: keep the IDs whose sealed
+  // record really belongs to this relying party
+  for (i = 0; i < candidates; i++) {
+    const uint8_t *id = ret_ids + i * WEBAUTHN_CREDENTIAL_ID_SIZE;
+
+    if (cred_db_get(id, &record) == SGX_SUCCESS &&
+        memcmp(record.rp_id_hash, rp_id_hash, SHA256_DIGEST_SIZE) == 0) {
+      memmove(ret_ids + count * WEBAUTHN_CREDENTIAL_ID_SIZE, id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+      count++;
+    }
+    memset_s(&record, sizeof(record), 0, sizeof(record));
+  }
+
+  *ret_count = count;
+  return SGX_SUCCESS;
+}
+
+// Unseal the key pair of older versions, if the host still has one
+static sgx_status_t load_legacy_key_pair(cred_record_t *record, sgx_ec256_public_t *ret_pk) {
+  legacy_key_pair_t key_pair;
+  uint32_t key_pair_size = sizeof(key_pair);
+  int32_t error = 0;
+  sgx_status_t status;
+
+  const uint32_t sealed_size = sgx_calc_sealed_data_size(0, sizeof(key_pair));
+  uint8_t *sealed = (uint8_t*)malloc(sealed_size);
+  if (sealed == NULL) {
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+
+  status = untrusted_load_enclave_data(&error, sealed, sealed_size);
+  if (!status && error) {
+    status = SGX_ERROR_INVALID_PARAMETER;
+  }
+  if (!status) {
+    status = sgx_unseal_data((const sgx_sealed_data_t*)sealed, NULL, NULL, (uint8_t*)&key_pair, &key_pair_size);
+  }
+  free(sealed);
+
+  if (!status) {
+    *ret_pk = key_pair.pk;
+    record->sk = key_pair.sk;
+  }
+  memset_s(&key_pair, sizeof(key_pair), 0, sizeof(key_pair));
+
+  return status;
+}
+
+sgx_status_t cred_db_get_device(cred_record_t *ret_record) {
+  sgx_status_t status = cred_db_get(device_id, ret_record);
+  if (status != SGX_ERROR_INVALID_PARAMETER) {
+    return status;
+  }
+
+  // Not found: create it, once
+  sgx_thread_mutex_lock(&device_mutex);
+  status = cred_db_get(device_id, ret_record);
+
+  if (status == SGX_ERROR_INVALID_PARAMETER) {
+    sgx_ec256_public_t pk;
+
+    memset(ret_record, 0, sizeof(*ret_record));
+    ret_record->meta = CRED_META(CRED_ALG_ES256, CRED_FLAG_DEVICE);
+    ret_record->counter_epoch = sign_counter_epoch();
+
+    if (load_legacy_key_pair(ret_record, &pk)) {
+      status = ecdsa_make_key_pair(&ret_record->sk, &pk);
+    } else {
+      status = SGX_SUCCESS;
+    }
+
+    if (!status) {
+      status = cred_db_put(ret_record, &pk);
+    }
+    if (status) {
+      memset_s(ret_record, sizeof(*ret_record), 0, sizeof(*ret_record));
+    }
+  }
+  sgx_thread_mutex_unlock(&device_mutex);
+
+  return status;
+}
+
+sgx_status_t cred_db_get_counter(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE],
+                                 uint32_t *ret_counter, uint32_t *ret_epoch) {
+  cred_record_t record;
+  sgx_status_t status;
+
+  if (memcmp(id, device_id, WEBAUTHN_CREDENTIAL_ID_SIZE) == 0) {
+    status = cred_db_get_device(&record);
+  } else {
+    status = cred_db_get(id, &record);
+  }
+
+  if (!status) {
+    *ret_counter = record.counter;
+    *ret_epoch = record.counter_epoch;
+  }
+  memset_s(&record, sizeof(record), 0, sizeof(record));
+
+  return status;
+}
+
+// Record `i` of `secrets` with `counter` as of `epoch` merged in: both as
+// of the later epoch, the larger one is kept
+static void merge_counter(cred_db_page_secrets_t *secrets, uint32_t i, uint32_t counter, uint32_t epoch) {
+  if (secrets->counter_epoch[i] > epoch) {
+    counter = sign_counter_rebase(counter, epoch, secrets->counter_epoch[i]);
+    epoch = secrets->counter_epoch[i];
+  }
+  const uint32_t stored = sign_counter_rebase(secrets->counter[i], secrets->counter_epoch[i], epoch);
+  secrets->counter[i] = stored > counter ? stored : counter;
+  secrets->counter_epoch[i] = epoch;
+}
+
+// A counter of `cred_db_set_counters` and where its record is
+typedef struct {
+  uint64_t page_offset;
+  uint32_t index;      // in the page, CRED_DB_PAGE_RECORDS if the record is gone
+  uint32_t counter;    // as written back, with `epoch`
+  uint32_t epoch;
+  const uint8_t *id;
+} located_counter_t;
+
+// Keep the cached records of `located` in step with their pages, and
+// lookups that read a page before it was written from caching the old
+// counter. Called with `db_mutex` held
+static void cache_set_counters(const located_counter_t *located, uint32_t count) {
+  uint32_t i;
+
+  sgx_spin_lock(&cache_lock);
+  cache_generation++;
+  for (i = 0; i < count; i++) {
+    const int32_t index = located[i].index < CRED_DB_PAGE_RECORDS ? cache_find_locked(located[i].id) : -1;
+    if (index >= 0) {
+      cred_cache_entry_t *entry = &cache_table->entries[index];
+      entry_write_begin(entry);
+      entry->record.counter = located[i].counter;
+      entry->record.counter_epoch = located[i].epoch;
+      entry_write_end(entry);
+    }
+  }
+  sgx_spin_unlock(&cache_lock);
+}
+
+sgx_status_t cred_db_set_counters(const cred_counter_t *counters, uint32_t count, uint32_t epoch) {
+  const size_t update_size = sizeof(cred_db_update_t) + SEAL_KEY_SEALED_SIZE(sizeof(cred_db_page_secrets_t));
+  cred_db_page_secrets_t secrets;
+  uint32_t num_located = 0;
+  uint32_t i;
+  int32_t error = 0;
+  sgx_status_t status = SGX_SUCCESS;
+
+  if (count == 0) {
+    return SGX_SUCCESS;
+  }
+
+  located_counter_t *located = (located_counter_t*)scratch_alloc(count * sizeof(*located));
+  uint8_t *page = (uint8_t*)scratch_alloc(CRED_DB_PAGE_SIZE);
+  uint8_t *updates = (uint8_t*)scratch_alloc(CRED_DB_UPDATE_PAGES * update_size);
+  if (located == NULL || page == NULL || updates == NULL) {
+    scratch_free(updates);
+    scratch_free(page);
+    scratch_free(located);
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+  const cred_db_page_t *header = (const cred_db_page_t*)page;
+
+  sgx_thread_mutex_lock(&db_mutex);
+
+  // A deleted credential has no record left to write to
+  for (i = 0; i < count; i++) {
+    located_counter_t *entry = &located[num_located];
+
+    if (find_record(db_map, counters[i].id, page, &entry->page_offset, &entry->index) == SGX_SUCCESS) {
+      entry->counter = counters[i].counter;
+      entry->epoch = epoch;
+      entry->id = counters[i].id;
+      num_located++;
+    }
+  }
+
+  // Insertion sort by page, the counters of a page are written together
+  for (i = 1; i < num_located; i++) {
+    const located_counter_t entry = located[i];
+    uint32_t j = i;
+
+    while (j > 0 && located[j - 1].page_offset > entry.page_offset) {
+      located[j] = located[j - 1];
+      j--;
+    }
+    located[j] = entry;
+  }
+
+  // Up to CRED_DB_UPDATE_PAGES pages per OCALL, the host syncs once per call
+  uint32_t start = 0;
+  uint32_t written = 0;
+  uint32_t num_updates = 0;
+  size_t updates_size = 0;
+
+  while (start < num_located && !status) {
+    uint32_t end = start;
+    int found = 0;
+
+    // A page that no longer reads or unseals has no record left to write to either
+    sgx_status_t page_status = read_page(db_map, located[start].page_offset, page);
+    if (!page_status) {
+      page_status = unseal_page(page, &secrets);
+    }
+    for (; end < num_located && located[end].page_offset == located[start].page_offset; end++) {
+      located_counter_t *entry = &located[end];
+
+      if (!page_status && entry->index < header->count &&
+          memcmp(header->ids[entry->index], entry->id, WEBAUTHN_CREDENTIAL_ID_SIZE) == 0) {
+        merge_counter(&secrets, entry->index, entry->counter, entry->epoch);
+        entry->counter = secrets.counter[entry->index];
+        entry->epoch = secrets.counter_epoch[entry->index];
+        found = 1;
+      } else {
+        entry->index = CRED_DB_PAGE_RECORDS;
+      }
+    }
+
+    if (found) {
+      cred_db_update_t update;
+
+      status = seal_page(page, &secrets);
+      if (!status) {
+        uint32_t k = start;
+        while (located[k].index == CRED_DB_PAGE_RECORDS) {
+          k++;
+        }
+        memcpy(update.id, located[k].id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+        update.sealed_size = header->sealed_size;
+        memcpy(updates + updates_size, &update, sizeof(update));
+        memcpy(updates + updates_size + sizeof(update), page + sizeof(*header), header->sealed_size);
+        updates_size += sizeof(update) + header->sealed_size;
+        num_updates++;
+      }
+    }
+    memset_s(&secrets, sizeof(secrets), 0, sizeof(secrets));
+    start = end;
+
+    if (!status && num_updates && (num_updates == CRED_DB_UPDATE_PAGES || start == num_located)) {
+      status = untrusted_cred_db_update(&error, updates, updates_size);
+      if (!status && error) {
+        LOG_ERROR("The host failed to write back signature counters");
+        status = SGX_ERROR_UNEXPECTED;
+      }
+      if (!status) {
+        cache_set_counters(located + written, start - written);
+        written = start;
+      }
+      num_updates = 0;
+      updates_size = 0;
+    }
+  }
+  sgx_thread_mutex_unlock(&db_mutex);
+
+  scratch_free(updates);
+  scratch_free(page);
+  scratch_free(located);
+
+  return status;
+}
@@ -0,0 +1,110 @@
+/*
+ * cred_db.h - Credential database.
+ *
+ * Credentials live in a database file kept by the host, see
+ * cred_db_defs.h. The host maps it and passes the mapping in with
+ * `cred_db_attach`; lookups probe its index in place, copy the one
+ * page of sealed records they find into the enclave and unseal it there.
+ * Only the private key and the signature counter are stored; the public
+ * key is derived from the private key when it is asked for and then
+ * cached, compressed, with the record. Startup
+ * costs nothing however many credentials are stored, and recently used
+ * credentials are kept unsealed in a CLOCK cache whose size in bytes is
+ * bounded, so it fits the enclave heap however many credentials there
+ * are. Lookups take no lock, whether they hit the cache or read the
+ * mapping, so registrations and deletes on one TCS do not hold up
+ * signatures on the others, even while the host syncs their writes. The credentials of a
+ * relying party are listed through the rp index, each one checked
+ * against its sealed rpIdHash.
+ */
+
+#ifndef _CRED_DB_H_
+#define _CRED_DB_H_
+
+#include <stdint.h>
+
+#include "cred_db_defs.h"
+#include "sgx_error.h"
+#include "sgx_tcrypto.h"
+#include "sha256.h"
+#include "webauthn_defs.h"
+
+#ifndef CRED_DB_CACHE_BUDGET
+#define CRED_DB_CACHE_BUDGET (64 << 10)       // bytes of unsealed credentials until cred_db_set_cache_budget
+#endif
+#define CRED_DB_CACHE_MAX_BUDGET (512 << 10)  // half of HeapMaxSize
+
+#define CRED_DB_BATCH_RECORDS (CRED_DB_BATCH_PAGES * CRED_DB_PAGE_RECORDS)
+
+// `meta` of a credential: its algorithm and CRED_FLAG_*
+#define CRED_ALG_ES256   1
+#define CRED_FLAG_DEVICE (1 << 0)
+
+#define CRED_META(alg, flags) \
+  (((uint32_t)(alg) << 24) | ((uint32_t)(flags) << 16))
+#define CRED_META_ALG(meta)     ((meta) >> 24)
+#define CRED_META_FLAGS(meta)   (((meta) >> 16) & 0xff)
+
+typedef struct {
+  uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE];
+  uint8_t rp_id_hash[SHA256_DIGEST_SIZE];
+  uint32_t meta;
+  uint32_t counter;        // signature counter as of `counter_epoch`, see sign_counter.h
+  uint32_t counter_epoch;
+  sgx_ec256_private_t sk;
+} cred_record_t;
+
+// A signature counter to write back, see `cred_db_set_counters`
+typedef struct {
+  uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE];
+  uint32_t counter;
+} cred_counter_t;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Find the credential `id`, SGX_ERROR_INVALID_PARAMETER if there is none.
+// `ret_record` holds the private key, wipe it after use
+sgx_status_t cred_db_get(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE], cred_record_t *ret_record);
+
+// Seal `record` and have the host add it to the database. `pk`, if not
+// NULL, is cached so it need not be derived again
+sgx_status_t cred_db_put(const cred_record_t *record, const sgx_ec256_public_t *pk);
+
+// Seal up to CRED_DB_BATCH_RECORDS records into new pages of their own
+// and have the host add them all at once. The records are not cached
+sgx_status_t cred_db_put_batch(const cred_record_t *records, uint32_t count);
+
+// Public key of the credential `id`, derived from its private key the
+// first time and cached from then on
+sgx_status_t cred_db_get_public_key(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE], sgx_ec256_public_t *ret_pk);
+
+// Have the host remove the credential `id` from the database
+sgx_status_t cred_db_delete(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE]);
+
+// IDs of the credentials of the relying party `rp_id_hash`, at most
+// `max_ids`. Costs one index probe plus one lookup per credential found
+sgx_status_t cred_db_list(const uint8_t rp_id_hash[SHA256_DIGEST_SIZE],
+                          uint8_t *ret_ids, uint32_t max_ids, uint32_t *ret_count);
+
+// The device credential, created (or migrated from the old single-key
+// enclave_data.seal) on first use
+sgx_status_t cred_db_get_device(cred_record_t *ret_record);
+
+// The signature counter of the credential `id` as last written back, and
+// its epoch. Creates the device credential if need be
+sgx_status_t cred_db_get_counter(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE],
+                                 uint32_t *ret_counter, uint32_t *ret_epoch);
+
+// Write back the signature counters of `count` credentials, each as of
+// `epoch`, rewriting every page once and syncing once per
+// CRED_DB_UPDATE_PAGES pages. Never moves a stored counter back, and
+// skips credentials that were deleted
+sgx_status_t cred_db_set_counters(const cred_counter_t *counters, uint32_t count, uint32_t epoch);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_CRED_DB_H_ */
@@ -0,0 +1,147 @@
+/*
+ * drbg.cpp - Buffered per-thread ChaCha20 DRBG.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "drbg.h"
+#include "tcs_context.h"
+
+#include "sgx_trts.h"
+
+#define CHACHA20_KEY_WORDS DRBG_KEY_WORDS
+#define CHACHA20_BLOCK_SIZE 64
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d) do {            \
+    a += b; d ^= a; d = ROTL32(d, 16);            \
+    c += d; b ^= c; b = ROTL32(b, 12);            \
+    a += b; d ^= a; d = ROTL32(d, 8);             \
+    c += d; b ^= c; b = ROTL32(b, 7);             \
+  } while (0)
+
+// One ChaCha20 block with an all-zero nonce, the key never
+// encrypts more than one buffer's worth before it is replaced
+static void chacha20_block(const uint32_t key[CHACHA20_KEY_WORDS], uint32_t counter,
+                           uint8_t out[CHACHA20_BLOCK_SIZE]) {
+  uint32_t input[16] = {
+    0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+    key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+    counter, 0, 0, 0
+  };
+  uint32_t x[16];
+  int i;
+
+  memcpy(x, input, sizeof(x));
+  for (i = 0; i < 10; i++) {
+    QUARTER_ROUND(x[0], x[4], x[8],  x[12]);
+    QUARTER_ROUND(x[1], x[5], x[9],  x[13]);
+    QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+    QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+    QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+    QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+    QUARTER_ROUND(x[2], x[7], x[8],  x[13]);
+    QUARTER_ROUND(x[3], x[4], x[9],  x[14]);
+  }
+
+  for (i = 0; i < 16; i++) {
+    const uint32_t v = x[i] + input[i];
+    out[4 * i + 0] = (uint8_t)(v);
+    out[4 * i + 1] = (uint8_t)(v >> 8);
+    out[4 * i + 2] = (uint8_t)(v >> 16);
+    out[4 * i + 3] = (uint8_t)(v >> 24);
+  }
+
+  memset_s(x, sizeof(x), 0, sizeof(x));
+  memset_s(input, sizeof(input), 0, sizeof(input));
+}
+
+// Mix `sgx_read_rand` output into the key. The first call seeds the
+// generator, later calls add fresh entropy on top of the existing key
+static int drbg_reseed(drbg_state_t *state) {
+  uint32_t entropy[CHACHA20_KEY_WORDS];
+  int i;
+
+  if (sgx_read_rand((unsigned char*)entropy, sizeof(entropy)) != SGX_SUCCESS) {
+    return 0;
+  }
+
+  for (i = 0; i < CHACHA20_KEY_WORDS; i++) {
+    state->key[i] ^= entropy[i];
+  }
+  memset_s(entropy, sizeof(entropy), 0, sizeof(entropy));
+
+  state->since_reseed = 0;
+  state->seeded = 1;
+  return 1;
+}
+
+// Regenerate the buffer from the current key. The leading keystream
+// bytes become the next key, so output already handed out cannot be
+// recomputed from the state later on
+static int drbg_refill(drbg_state_t *state) {
+  uint8_t block[CHACHA20_BLOCK_SIZE];
+  uint32_t key[CHACHA20_KEY_WORDS];
+  uint32_t counter = 0;
+  uint32_t offset = 0;
+
+  if (!state->seeded || state->since_reseed >= DRBG_RESEED_INTERVAL) {
+    if (!drbg_reseed(state)) {
+      return 0;
+    }
+  }
+
+  memcpy(key, state->key, sizeof(key));
+
+  chacha20_block(key, counter++, block);
+  memcpy(state->key, block, sizeof(state->key));
+  memcpy(state->buffer, block + sizeof(state->key), sizeof(block) - sizeof(state->key));
+  offset = sizeof(block) - sizeof(state->key);
+
+  while (offset < DRBG_BUFFER_SIZE) {
+    chacha20_block(key, counter++, block);
+    const uint32_t n = (DRBG_BUFFER_SIZE - offset < sizeof(block)) ? DRBG_BUFFER_SIZE - offset : sizeof(block);
+    memcpy(state->buffer + offset, block, n);
+    offset += n;
+  }
+
+  memset_s(block, sizeof(block), 0, sizeof(block));
+  memset_s(key, sizeof(key), 0, sizeof(key));
+
+  state->available = DRBG_BUFFER_SIZE;
+  state->since_reseed += DRBG_BUFFER_SIZE;
+  return 1;
+}
+
+int drbg_generate(uint8_t *dest, size_t size) {
+  tcs_context_t *context = tcs_context_get();
+
+  if (context == NULL) {
+    return sgx_read_rand(dest, size) == SGX_SUCCESS;
+  }
+  drbg_state_t *state = &context->drbg;
+
+  while (size) {
+    if (!state->available && !drbg_refill(state)) {
+      return 0;
+    }
+
+    // Serve the unread tail of the buffer and wipe what was handed out
+    const uint32_t n = (size < state->available) ? (uint32_t)size : state->available;
+    uint8_t *src = state->buffer + DRBG_BUFFER_SIZE - state->available;
+    memcpy(dest, src, n);
+    memset_s(src, n, 0, n);
+
+    state->available -= n;
+    dest += n;
+    size -= n;
+  }
+
+  return 1;
+}
+
+int drbg_uecc_rng(uint8_t *dest, unsigned size) {
+  return drbg_generate(dest, size);
+}
@@ -0,0 +1,48 @@
+/*
+ * drbg.h - Buffered per-thread ChaCha20 DRBG.
+ *
+ * Each TCS gets its own generator, kept in its context (tcs_context.h),
+ * seeded and periodically reseeded with a single `sgx_read_rand` call,
+ * so the RDRAND instruction is only hit once per reseed instead of once
+ * per request for random bytes. Output is served from a keystream buffer and the key is
+ * replaced after every refill (fast key erasure).
+ */
+
+#ifndef _DRBG_H_
+#define _DRBG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Keystream bytes generated per refill, enough for a few signatures
+#define DRBG_BUFFER_SIZE 512
+
+// Mix fresh `sgx_read_rand` entropy into the key after this many bytes
+#define DRBG_RESEED_INTERVAL (1 << 20)
+
+#define DRBG_KEY_WORDS 8  // a ChaCha20 key
+
+// Threads without a context fall back to `sgx_read_rand` directly
+typedef struct {
+  uint32_t key[DRBG_KEY_WORDS];
+  uint8_t buffer[DRBG_BUFFER_SIZE];
+  uint32_t available;         // unread bytes at the end of `buffer`
+  uint32_t since_reseed;      // bytes generated under the current seed
+  int seeded;
+} drbg_state_t;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Fill `dest` with `size` random bytes, returns 1 on success and 0 on failure
+int drbg_generate(uint8_t *dest, size_t size);
+
+// `uECC_RNG_Function` backed by `drbg_generate`, install with `uECC_set_rng`
+int drbg_uecc_rng(uint8_t *dest, unsigned size);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_DRBG_H_ */
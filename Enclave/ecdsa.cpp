@@ -0,0 +1,267 @@
+/*
+ * ecdsa.cpp - ECDSA P-256 signing on top of uECC, using the SGX key and
+ * signature formats so callers can keep using the sgx_tcrypto types.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Enclave_t.h"
+#include "ecdsa.h"
+#include "nonce_pool.h"
+#include "sha256.h"
+#include "uECC.h"
+#include "webauthn_defs.h"
+
+#include "sgx_spinlock.h"
+
+static volatile uint32_t signing_mode = SIGNING_MODE_RANDOMIZED;
+
+// HMAC-SHA256 states right after absorbing the padded key `K`
+typedef struct {
+  uint8_t K[SHA256_DIGEST_SIZE];
+  sha256_ctx_t inner;  // K ^ ipad absorbed
+  sha256_ctx_t outer;  // K ^ opad absorbed
+} hmac_pad_states_t;
+
+// uECC hash context for RFC 6979 nonces. uECC calls `init_hmac_pad`
+// for every HMAC, which restores a cached state instead of hashing the
+// key pads again. Every derivation starts from an all-zero K, whose
+// states are computed once for the enclave lifetime; each later K is
+// used for at least two HMACs and is cached for the signature
+typedef struct {
+  uECC_HashContext uECC;
+  sha256_ctx_t ctx;
+  hmac_pad_states_t current;
+  int current_valid;
+  uint8_t tmp[2 * SHA256_DIGEST_SIZE + SHA256_BLOCK_SIZE];
+} rfc6979_hash_context_t;
+
+// Table of uECC_make_key_fixed_base, built once
+static sgx_spinlock_t fixed_base_lock = SGX_SPINLOCK_INITIALIZER;
+static int fixed_base_ready = 0;
+
+static sgx_spinlock_t zero_key_lock = SGX_SPINLOCK_INITIALIZER;
+static hmac_pad_states_t zero_key_pads;
+static int zero_key_pads_ready = 0;
+
+// SGX stores keys and signatures as little-endian byte strings
+// (the signature as uint32_t words on a little-endian CPU), while
+// uECC expects big-endian byte strings. Convert by reversing.
+static void reverse_copy(uint8_t *dst, const uint8_t *src, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    dst[i] = src[n - 1 - i];
+  }
+}
+
+static void hmac_pad_states_compute(hmac_pad_states_t *pads, const uint8_t *K) {
+  uint8_t pad[SHA256_BLOCK_SIZE];
+  size_t i;
+
+  memcpy(pads->K, K, SHA256_DIGEST_SIZE);
+
+  for (i = 0; i < SHA256_BLOCK_SIZE; i++) {
+    pad[i] = (i < SHA256_DIGEST_SIZE ? K[i] : 0) ^ 0x36;
+  }
+  sha256_init(&pads->inner);
+  sha256_update(&pads->inner, pad, sizeof(pad));
+
+  for (i = 0; i < SHA256_BLOCK_SIZE; i++) {
+    pad[i] = (i < SHA256_DIGEST_SIZE ? K[i] : 0) ^ 0x5c;
+  }
+  sha256_init(&pads->outer);
+  sha256_update(&pads->outer, pad, sizeof(pad));
+
+  memset_s(pad, sizeof(pad), 0, sizeof(pad));
+}
+
+static const hmac_pad_states_t *zero_key_pad_states() {
+  if (!__atomic_load_n(&zero_key_pads_ready, __ATOMIC_ACQUIRE)) {
+    const uint8_t zero_key[SHA256_DIGEST_SIZE] = {0};
+    hmac_pad_states_t pads;
+    hmac_pad_states_compute(&pads, zero_key);
+
+    sgx_spin_lock(&zero_key_lock);
+    if (!zero_key_pads_ready) {
+      zero_key_pads = pads;
+      __atomic_store_n(&zero_key_pads_ready, 1, __ATOMIC_RELEASE);
+    }
+    sgx_spin_unlock(&zero_key_lock);
+  }
+
+  return &zero_key_pads;
+}
+
+static void rfc6979_init_hash(const uECC_HashContext *base) {
+  rfc6979_hash_context_t *context = (rfc6979_hash_context_t*)base;
+  sha256_init(&context->ctx);
+}
+
+static void rfc6979_update_hash(const uECC_HashContext *base,
+                                const uint8_t *message,
+                                unsigned message_size) {
+  rfc6979_hash_context_t *context = (rfc6979_hash_context_t*)base;
+  sha256_update(&context->ctx, message, message_size);
+}
+
+static void rfc6979_finish_hash(const uECC_HashContext *base, uint8_t *hash_result) {
+  rfc6979_hash_context_t *context = (rfc6979_hash_context_t*)base;
+  sha256_final(&context->ctx, hash_result);
+}
+
+static void rfc6979_init_hmac_pad(const uECC_HashContext *base, const uint8_t *K, uint8_t pad_byte) {
+  rfc6979_hash_context_t *context = (rfc6979_hash_context_t*)base;
+  const hmac_pad_states_t *pads;
+  uint8_t key_bits = 0;
+  size_t i;
+
+  for (i = 0; i < SHA256_DIGEST_SIZE; i++) {
+    key_bits |= K[i];
+  }
+
+  if (!key_bits) {
+    pads = zero_key_pad_states();
+  } else {
+    if (!context->current_valid || !consttime_memequal(context->current.K, K, SHA256_DIGEST_SIZE)) {
+      hmac_pad_states_compute(&context->current, K);
+      context->current_valid = 1;
+    }
+    pads = &context->current;
+  }
+
+  context->ctx = (pad_byte == 0x36) ? pads->inner : pads->outer;
+}
+
+static int sign_deterministic(const uint8_t *private_key,
+                              const uint8_t digest[SHA256_DIGEST_SIZE],
+                              uint8_t *signature) {
+  rfc6979_hash_context_t context;
+  memset(&context, 0, sizeof(context));
+  context.uECC.init_hash = &rfc6979_init_hash;
+  context.uECC.update_hash = &rfc6979_update_hash;
+  context.uECC.finish_hash = &rfc6979_finish_hash;
+  context.uECC.block_size = SHA256_BLOCK_SIZE;
+  context.uECC.result_size = SHA256_DIGEST_SIZE;
+  context.uECC.tmp = context.tmp;
+  context.uECC.init_hmac_pad = &rfc6979_init_hmac_pad;
+
+  const int signed_ok = uECC_sign_deterministic(private_key, digest, SHA256_DIGEST_SIZE,
+                                                &context.uECC, signature, uECC_secp256r1());
+
+  // K, V and the cached states all derive from the private key
+  memset_s(&context, sizeof(context), 0, sizeof(context));
+  return signed_ok;
+}
+
+sgx_status_t set_signing_mode(uint32_t mode) {
+  if (mode != SIGNING_MODE_RANDOMIZED && mode != SIGNING_MODE_DETERMINISTIC) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  signing_mode = mode;
+  return SGX_SUCCESS;
+}
+
+// Sign a SHA256 `digest` with `sk`. Equivalent to `sgx_ecdsa_sign` over
+// the message the digest was computed from
+sgx_status_t ecdsa_sign_digest(const sgx_ec256_private_t *sk,
+                               const uint8_t digest[SGX_SHA256_HASH_SIZE],
+                               sgx_ec256_signature_t *ret_signature) {
+  uint8_t private_key[SGX_ECP256_KEY_SIZE];
+  uint8_t signature[2 * SGX_ECP256_KEY_SIZE];
+  nonce_pool_entry_t entry;
+  int signed_ok = 0;
+
+  reverse_copy(private_key, sk->r, sizeof(private_key));
+
+  if (signing_mode == SIGNING_MODE_DETERMINISTIC) {
+    signed_ok = sign_deterministic(private_key, digest, signature);
+  } else {
+    // Fast path: k^-1 and r were precomputed offline, only the
+    // two scalar multiplications mod n are left to do
+    if (nonce_pool_take(&entry)) {
+      signed_ok = uECC_sign_with_precomputed(private_key, digest, SGX_SHA256_HASH_SIZE,
+                                             entry.k_inverse, entry.r,
+                                             signature, uECC_secp256r1());
+      nonce_pool_entry_clear(&entry);
+    }
+
+    // The pool ran dry, pay for the k*G point multiplication online
+    if (!signed_ok) {
+      signed_ok = uECC_sign(private_key, digest, SGX_SHA256_HASH_SIZE,
+                            signature, uECC_secp256r1());
+    }
+  }
+
+  memset_s(private_key, sizeof(private_key), 0, sizeof(private_key));
+
+  if (!signed_ok) {
+    return SGX_ERROR_UNEXPECTED;
+  }
+
+  reverse_copy((uint8_t*)ret_signature->x, signature, SGX_ECP256_KEY_SIZE);
+  reverse_copy((uint8_t*)ret_signature->y, signature + SGX_ECP256_KEY_SIZE, SGX_ECP256_KEY_SIZE);
+  return SGX_SUCCESS;
+}
+
+sgx_status_t ecdsa_public_key(const sgx_ec256_private_t *sk,
+                              uint8_t ret_compressed[ECDSA_COMPRESSED_KEY_SIZE]) {
+  uint8_t private_key[SGX_ECP256_KEY_SIZE];
+  uint8_t public_key[2 * SGX_ECP256_KEY_SIZE];
+
+  reverse_copy(private_key, sk->r, sizeof(private_key));
+  const int ok = uECC_compute_public_key(private_key, public_key, uECC_secp256r1());
+  memset_s(private_key, sizeof(private_key), 0, sizeof(private_key));
+
+  if (!ok) {
+    return SGX_ERROR_UNEXPECTED;
+  }
+
+  uECC_compress(public_key, ret_compressed, uECC_secp256r1());
+  return SGX_SUCCESS;
+}
+
+sgx_status_t ecdsa_make_key_pair(sgx_ec256_private_t *ret_sk, sgx_ec256_public_t *ret_pk) {
+  uint8_t private_key[SGX_ECP256_KEY_SIZE];
+  uint8_t public_key[2 * SGX_ECP256_KEY_SIZE];
+
+  // Keys are only made from the table once it is complete
+  if (!__atomic_load_n(&fixed_base_ready, __ATOMIC_ACQUIRE)) {
+    sgx_spin_lock(&fixed_base_lock);
+    if (!fixed_base_ready && uECC_fixed_base_init(uECC_secp256r1())) {
+      __atomic_store_n(&fixed_base_ready, 1, __ATOMIC_RELEASE);
+    }
+    sgx_spin_unlock(&fixed_base_lock);
+  }
+
+  const int ok = __atomic_load_n(&fixed_base_ready, __ATOMIC_ACQUIRE) &&
+                 uECC_make_key_fixed_base(public_key, private_key, uECC_secp256r1());
+
+  if (ok) {
+    reverse_copy(ret_sk->r, private_key, SGX_ECP256_KEY_SIZE);
+    reverse_copy(ret_pk->gx, public_key, SGX_ECP256_KEY_SIZE);
+    reverse_copy(ret_pk->gy, public_key + SGX_ECP256_KEY_SIZE, SGX_ECP256_KEY_SIZE);
+  }
+  memset_s(private_key, sizeof(private_key), 0, sizeof(private_key));
+
+  return ok ? SGX_SUCCESS : SGX_ERROR_UNEXPECTED;
+}
+
+void ecdsa_compress_public_key(const sgx_ec256_public_t *pk,
+                               uint8_t ret_compressed[ECDSA_COMPRESSED_KEY_SIZE]) {
+  uint8_t public_key[2 * SGX_ECP256_KEY_SIZE];
+
+  reverse_copy(public_key, pk->gx, SGX_ECP256_KEY_SIZE);
+  reverse_copy(public_key + SGX_ECP256_KEY_SIZE, pk->gy, SGX_ECP256_KEY_SIZE);
+  uECC_compress(public_key, ret_compressed, uECC_secp256r1());
+}
+
+void ecdsa_decompress_public_key(const uint8_t compressed[ECDSA_COMPRESSED_KEY_SIZE],
+                                 sgx_ec256_public_t *ret_pk) {
+  uint8_t public_key[2 * SGX_ECP256_KEY_SIZE];
+
+  uECC_decompress(compressed, public_key, uECC_secp256r1());
+  reverse_copy(ret_pk->gx, public_key, SGX_ECP256_KEY_SIZE);
+  reverse_copy(ret_pk->gy, public_key + SGX_ECP256_KEY_SIZE, SGX_ECP256_KEY_SIZE);
+}
@@ -0,0 +1,142 @@
+/*
+ * hotcall.cpp - Enclave workers serving requests from a ring in host
+ * memory, see hotcall_defs.h.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Enclave_t.h"
+#include "hotcall_defs.h"
+#include "scratch.h"
+
+#include "sgx_trts.h"
+
+// In host memory, every field of it untrusted
+static hotcall_ring_t *ring = NULL;
+static volatile uint32_t workers = 0;
+
+sgx_status_t hotcall_attach(hotcall_ring_t *host_ring) {
+  hotcall_ring_t *expected = NULL;
+
+  if (host_ring == NULL || !sgx_is_outside_enclave(host_ring, sizeof(*host_ring))) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  // Once: the host must keep the ring for the life of the enclave
+  if (!__atomic_compare_exchange_n(&ring, &expected, host_ring, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    return SGX_ERROR_INVALID_STATE;
+  }
+  return SGX_SUCCESS;
+}
+
+// Dequeue the index of the next call, 0 if the ring is empty
+static int ring_take(hotcall_ring_t *host_ring, uint32_t *ret_call) {
+  uint64_t pos = __atomic_load_n(&host_ring->dequeue_pos, __ATOMIC_RELAXED);
+
+  for (;;) {
+    hotcall_slot_t *slot = &host_ring->slots[pos & (HOTCALL_RING_SLOTS - 1)];
+    const uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    const int64_t diff = (int64_t)(seq - (pos + 1));
+
+    if (diff < 0) {
+      return 0;
+    }
+    if (diff > 0) {
+      // Another worker took it first
+      pos = __atomic_load_n(&host_ring->dequeue_pos, __ATOMIC_RELAXED);
+      continue;
+    }
+    if (__atomic_compare_exchange_n(&host_ring->dequeue_pos, &pos, pos + 1, true,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      *ret_call = __atomic_load_n(&slot->call, __ATOMIC_RELAXED);
+      __atomic_store_n(&slot->seq, pos + HOTCALL_RING_SLOTS, __ATOMIC_RELEASE);
+      return 1;
+    }
+  }
+}
+
+// Serve one call. Its request is copied into the enclave before it is
+// checked, the host may change it at any time
+static void run_call(hotcall_ring_t *host_ring, uint32_t index) {
+  if (index >= HOTCALL_CALLS) {
+    return;
+  }
+  __builtin_ia32_lfence();
+  hotcall_call_t *call = &host_ring->calls[index];
+
+  uint8_t authenticator_data[WEBAUTHN_AUTHENTICATOR_DATA_SIZE] = {0};
+  sgx_ec256_signature_t signature;
+  char rp_id[WEBAUTHN_RP_ID_MAX + 1];
+  sgx_status_t status = SGX_ERROR_INVALID_PARAMETER;
+
+  memset(&signature, 0, sizeof(signature));
+
+  const uint32_t op = call->op;
+  const uint32_t flags = call->flags;
+  const uint32_t data_size = call->data_size;
+
+  uint8_t *data = (uint8_t*)scratch_alloc(HOTCALL_DATA_MAX);
+  if (data == NULL) {
+    status = SGX_ERROR_OUT_OF_MEMORY;
+  } else if (data_size <= HOTCALL_DATA_MAX) {
+    memcpy(data, call->data, data_size);
+
+    switch (op) {
+    case HOTCALL_OP_SIGN_DIGEST:
+      if (data_size == sizeof(sgx_sha256_hash_t)) {
+        status = webauthn_sign_digest((const sgx_sha256_hash_t*)data, &signature);
+      }
+      break;
+
+    case HOTCALL_OP_GET_ASSERTION:
+      memcpy(rp_id, call->rp_id, sizeof(rp_id));
+      rp_id[WEBAUTHN_RP_ID_MAX] = '\0';
+      if (flags <= UINT8_MAX) {
+        status = webauthn_get_assertion(rp_id, (uint8_t)flags, data, data_size, authenticator_data, &signature);
+      }
+      break;
+    }
+  }
+  scratch_free(data);
+
+  call->status = status;
+  memcpy(call->authenticator_data, authenticator_data, sizeof(authenticator_data));
+  call->signature = signature;
+
+  // Results first, then the state the submitter waits on
+  const uint32_t previous = __atomic_exchange_n(&call->state, HOTCALL_STATE_DONE, __ATOMIC_ACQ_REL);
+  if (previous == HOTCALL_STATE_SLEEPING) {
+    untrusted_hotcall_wake(index);
+  }
+}
+
+sgx_status_t hotcall_worker(void) {
+  hotcall_ring_t *host_ring = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+  uint32_t index;
+
+  if (host_ring == NULL) {
+    return SGX_ERROR_INVALID_STATE;
+  }
+
+  // Keep TCS free for the ECALLs of other threads
+  if (__sync_add_and_fetch(&workers, 1) > HOTCALL_MAX_WORKERS) {
+    __sync_sub_and_fetch(&workers, 1);
+    return SGX_ERROR_BUSY;
+  }
+
+  // Tells the host this worker stays, see `hotcall_start`
+  __atomic_add_fetch(&host_ring->running, 1, __ATOMIC_RELEASE);
+
+  while (!__atomic_load_n(&host_ring->stop, __ATOMIC_ACQUIRE)) {
+    if (ring_take(host_ring, &index)) {
+      run_call(host_ring, index);
+    } else {
+      __builtin_ia32_pause();
+    }
+  }
+
+  __atomic_sub_fetch(&host_ring->running, 1, __ATOMIC_RELEASE);
+  __sync_sub_and_fetch(&workers, 1);
+  return SGX_SUCCESS;
+}
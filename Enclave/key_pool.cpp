@@ -0,0 +1,178 @@
+/*
+ * key_pool.cpp - Pool of pre-generated credential key pairs.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Enclave_t.h"
+#include "ecdsa.h"
+#include "key_pool.h"
+#include "webauthn_defs.h"
+
+#include "sgx_spinlock.h"
+
+typedef struct {
+  sgx_ec256_private_t sk;
+  sgx_ec256_public_t pk;
+} key_pool_entry_t;
+
+// All pool state is guarded by `pool_lock`. Entries [0, pool_count) are
+// ready to use, `pool_pending` slots are reserved by refills that are
+// still generating their pair outside of the lock. `pool_refilling` is
+// set once the pool falls to `pool_low_water` and cleared once it is full
+static sgx_spinlock_t pool_lock = SGX_SPINLOCK_INITIALIZER;
+static key_pool_entry_t *pool_entries = NULL;
+static uint32_t pool_capacity = 0;
+static uint32_t pool_low_water = 0;
+static uint32_t pool_count = 0;
+static uint32_t pool_pending = 0;
+static int pool_refilling = 0;
+static key_pool_stats_t pool_stats;
+
+static void entry_clear(key_pool_entry_t *entry) {
+  memset_s(entry, sizeof(*entry), 0, sizeof(*entry));
+}
+
+// Resize the pool to hold up to `capacity` pairs, refilled once it falls
+// to `low_water`. Pairs already generated are carried over as long as
+// they fit
+sgx_status_t key_pool_configure(uint32_t capacity, uint32_t low_water) {
+  if (capacity > KEY_POOL_MAX_CAPACITY || low_water > capacity) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  key_pool_entry_t *entries = NULL;
+  if (capacity) {
+    entries = (key_pool_entry_t*)calloc(capacity, sizeof(*entries));
+    if (entries == NULL) {
+      return SGX_ERROR_OUT_OF_MEMORY;
+    }
+  }
+
+  sgx_spin_lock(&pool_lock);
+
+  key_pool_entry_t *old_entries = pool_entries;
+  const uint32_t old_capacity = pool_capacity;
+
+  if (pool_count > capacity) {
+    pool_count = capacity;
+  }
+  if (pool_count) {
+    memcpy(entries, old_entries, pool_count * sizeof(*entries));
+  }
+
+  pool_entries = entries;
+  pool_capacity = capacity;
+  pool_low_water = low_water;
+  pool_refilling = pool_count <= low_water;
+  pool_stats.capacity = capacity;
+  pool_stats.low_water = low_water;
+  pool_stats.depth = pool_count;
+
+  sgx_spin_unlock(&pool_lock);
+
+  if (old_entries) {
+    memset_s(old_entries, old_capacity * sizeof(*old_entries), 0, old_capacity * sizeof(*old_entries));
+    free(old_entries);
+  }
+
+  return SGX_SUCCESS;
+}
+
+// Generate up to `max_entries` new pairs. Does nothing while the pool is
+// above its low-water mark, and stops early once it is full; `*ret_filled`
+// tells the host how many were added
+sgx_status_t key_pool_refill(uint32_t max_entries, uint32_t *ret_filled) {
+  sgx_status_t status = SGX_SUCCESS;
+  uint32_t filled = 0;
+
+  *ret_filled = 0;
+
+  sgx_spin_lock(&pool_lock);
+  const int configured = (pool_entries != NULL);
+  sgx_spin_unlock(&pool_lock);
+
+  if (!configured) {
+    status = key_pool_configure(KEY_POOL_DEFAULT_CAPACITY, KEY_POOL_DEFAULT_LOW_WATER);
+    if (status) {
+      return status;
+    }
+  }
+
+  while (filled < max_entries) {
+    // Reserve a slot first so concurrent refills do not overshoot
+    sgx_spin_lock(&pool_lock);
+    const int has_room = pool_refilling && (pool_count + pool_pending < pool_capacity);
+    if (has_room) {
+      pool_pending++;
+    }
+    sgx_spin_unlock(&pool_lock);
+
+    if (!has_room) {
+      break;
+    }
+
+    // The expensive part, done without holding the lock
+    key_pool_entry_t entry;
+    status = ecdsa_make_key_pair(&entry.sk, &entry.pk);
+
+    // The pool may have been shrunk in the meantime, re-check for room
+    sgx_spin_lock(&pool_lock);
+    pool_pending--;
+    const int stored = !status && (pool_count < pool_capacity);
+    if (stored) {
+      pool_entries[pool_count++] = entry;
+      pool_stats.depth = pool_count;
+      pool_stats.refilled++;
+      if (pool_count == pool_capacity) {
+        pool_refilling = 0;
+      }
+    }
+    sgx_spin_unlock(&pool_lock);
+
+    entry_clear(&entry);
+
+    if (!stored) {
+      break;
+    }
+
+    filled++;
+  }
+
+  *ret_filled = filled;
+  return status;
+}
+
+sgx_status_t key_pool_get_stats(key_pool_stats_t *ret_stats) {
+  sgx_spin_lock(&pool_lock);
+  *ret_stats = pool_stats;
+  sgx_spin_unlock(&pool_lock);
+
+  return SGX_SUCCESS;
+}
+
+int key_pool_take(sgx_ec256_private_t *ret_sk, sgx_ec256_public_t *ret_pk) {
+  int taken = 0;
+
+  sgx_spin_lock(&pool_lock);
+  if (pool_count) {
+    key_pool_entry_t *slot = &pool_entries[--pool_count];
+    *ret_sk = slot->sk;
+    *ret_pk = slot->pk;
+    entry_clear(slot);
+    taken = 1;
+
+    pool_stats.hits++;
+    if (pool_count <= pool_low_water) {
+      pool_refilling = 1;
+    }
+  } else {
+    pool_stats.misses++;
+  }
+  pool_stats.depth = pool_count;
+  sgx_spin_unlock(&pool_lock);
+
+  return taken;
+}
@@ -0,0 +1,39 @@
+/*
+ * key_pool.h - Pool of pre-generated credential key pairs.
+ *
+ * Host threads call the `key_pool_refill` ECALL on otherwise idle TCS to
+ * generate key pairs ahead of time. A registration pops one and only has
+ * to bind it to the new credential ID and write it to the database. The
+ * pool is refilled once it falls to its low-water mark, and then all the
+ * way up, so the refill threads are not woken for every registration.
+ */
+
+#ifndef _KEY_POOL_H_
+#define _KEY_POOL_H_
+
+#include <stdint.h>
+
+#include "sgx_tcrypto.h"
+
+// Capacity and low-water mark used when the host refills the pool
+// without configuring it
+#define KEY_POOL_DEFAULT_CAPACITY  64
+#define KEY_POOL_DEFAULT_LOW_WATER 16
+
+// Entries are 96 bytes, so this caps the pool at a tenth of the enclave
+// heap (`HeapMaxSize` is 0x100000 in Enclave.config.xml)
+#define KEY_POOL_MAX_CAPACITY 1024
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Pop a key pair, returns 0 if the pool is empty. The pair is removed
+// from the pool; wipe `ret_sk` once it has been used
+int key_pool_take(sgx_ec256_private_t *ret_sk, sgx_ec256_public_t *ret_pk);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_KEY_POOL_H_ */
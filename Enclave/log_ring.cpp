@@ -0,0 +1,69 @@
+/*
+ * log_ring.cpp - Enclave logging without an OCALL.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>      /* vsnprintf */
+#include <string.h>
+
+#include "Enclave_t.h"
+#include "log_ring.h"
+
+#include "sgx_error.h"
+#include "sgx_trts.h"
+
+// In host memory, only ever written
+static log_ring_t *ring = NULL;
+// Last message number handed out, kept here so the host cannot rewind it
+static uint64_t last_seq = 0;
+
+sgx_status_t log_ring_attach(log_ring_t *host_ring) {
+  log_ring_t *expected = NULL;
+
+  if (host_ring == NULL || !sgx_is_outside_enclave(host_ring, sizeof(*host_ring))) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  // Once: the host must keep the ring for the life of the enclave
+  if (!__atomic_compare_exchange_n(&ring, &expected, host_ring, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    return SGX_ERROR_INVALID_STATE;
+  }
+  return SGX_SUCCESS;
+}
+
+void log_vwrite(uint32_t level, const char *fmt, va_list ap) {
+  log_ring_t *host_ring = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+  char message[LOG_RING_MESSAGE_MAX + 1];
+
+  if (host_ring == NULL) {
+    return;
+  }
+
+  int size = vsnprintf(message, sizeof(message), fmt, ap);
+  if (size < 0) {
+    return;
+  }
+  if (size > LOG_RING_MESSAGE_MAX) {
+    size = LOG_RING_MESSAGE_MAX;
+  }
+
+  const uint64_t seq = __atomic_add_fetch(&last_seq, 1, __ATOMIC_RELAXED);
+  log_ring_entry_t *entry = &host_ring->entries[(seq - 1) % LOG_RING_ENTRIES];
+
+  // Marked busy before and numbered after the message, see log_ring_defs.h
+  __atomic_store_n(&entry->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  entry->level = level;
+  entry->size = (uint32_t)size;
+  memcpy(entry->message, message, size);
+  __atomic_store_n(&entry->seq, seq, __ATOMIC_RELEASE);
+}
+
+void log_write(uint32_t level, const char *fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  log_vwrite(level, fmt, ap);
+  va_end(ap);
+}
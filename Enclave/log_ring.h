@@ -0,0 +1,42 @@
+/*
+ * log_ring.h - Enclave logging without an OCALL.
+ *
+ * Messages are formatted inside the enclave and stored into the ring the
+ * host attached, see log_ring_defs.h. A host thread prints them later.
+ * Before the ring is attached, and when the host falls behind by more
+ * than LOG_RING_ENTRIES messages, they are lost: logging never waits.
+ *
+ * LOG_DEBUG compiles to nothing unless ENCLAVE_LOG_DEBUG is defined,
+ * which the Makefile only does for debug builds.
+ */
+
+#ifndef _LOG_RING_H_
+#define _LOG_RING_H_
+
+#include <stdarg.h>
+#include <stdint.h>
+
+#include "log_ring_defs.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+void log_write(uint32_t level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void log_vwrite(uint32_t level, const char *fmt, va_list ap);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#define LOG_ERROR(...) log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)  log_write(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...)  log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+
+#if defined(ENCLAVE_LOG_DEBUG)
+#define LOG_DEBUG(...) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do { } while (0)
+#endif
+
+#endif /* !_LOG_RING_H_ */
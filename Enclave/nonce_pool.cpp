@@ -0,0 +1,143 @@
+/*
+ * nonce_pool.cpp - Pool of precomputed ECDSA nonces.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Enclave_t.h"
+#include "nonce_pool.h"
+#include "uECC.h"
+
+#include "sgx_spinlock.h"
+
+// All pool state is guarded by `pool_lock`. Entries [0, pool_count) are
+// ready to use, `pool_pending` slots are reserved by refills that are
+// still computing their entry outside of the lock
+static sgx_spinlock_t pool_lock = SGX_SPINLOCK_INITIALIZER;
+static nonce_pool_entry_t *pool_entries = NULL;
+static uint32_t pool_capacity = 0;
+static uint32_t pool_count = 0;
+static uint32_t pool_pending = 0;
+
+void nonce_pool_entry_clear(nonce_pool_entry_t *entry) {
+  memset_s(entry, sizeof(*entry), 0, sizeof(*entry));
+}
+
+// Resize the pool to hold up to `capacity` entries. Entries already
+// computed are carried over as long as they fit
+sgx_status_t nonce_pool_configure(uint32_t capacity) {
+  if (capacity > NONCE_POOL_MAX_CAPACITY) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  nonce_pool_entry_t *entries = NULL;
+  if (capacity) {
+    entries = (nonce_pool_entry_t*)calloc(capacity, sizeof(*entries));
+    if (entries == NULL) {
+      return SGX_ERROR_OUT_OF_MEMORY;
+    }
+  }
+
+  sgx_spin_lock(&pool_lock);
+
+  nonce_pool_entry_t *old_entries = pool_entries;
+  const uint32_t old_capacity = pool_capacity;
+
+  if (pool_count > capacity) {
+    pool_count = capacity;
+  }
+  if (pool_count) {
+    memcpy(entries, old_entries, pool_count * sizeof(*entries));
+  }
+
+  pool_entries = entries;
+  pool_capacity = capacity;
+
+  sgx_spin_unlock(&pool_lock);
+
+  if (old_entries) {
+    memset_s(old_entries, old_capacity * sizeof(*old_entries), 0, old_capacity * sizeof(*old_entries));
+    free(old_entries);
+  }
+
+  return SGX_SUCCESS;
+}
+
+// Compute up to `max_entries` new entries. Stops early once the pool
+// is full, `*ret_filled` tells the host how many were added
+sgx_status_t nonce_pool_refill(uint32_t max_entries, uint32_t *ret_filled) {
+  sgx_status_t status = SGX_SUCCESS;
+  uint32_t filled = 0;
+
+  *ret_filled = 0;
+
+  sgx_spin_lock(&pool_lock);
+  const int configured = (pool_entries != NULL);
+  sgx_spin_unlock(&pool_lock);
+
+  if (!configured) {
+    status = nonce_pool_configure(NONCE_POOL_DEFAULT_CAPACITY);
+    if (status) {
+      return status;
+    }
+  }
+
+  while (filled < max_entries) {
+    // Reserve a slot first so concurrent refills do not overshoot
+    sgx_spin_lock(&pool_lock);
+    const int has_room = (pool_count + pool_pending < pool_capacity);
+    if (has_room) {
+      pool_pending++;
+    }
+    sgx_spin_unlock(&pool_lock);
+
+    if (!has_room) {
+      break;
+    }
+
+    // The expensive part, done without holding the lock
+    nonce_pool_entry_t entry;
+    const int computed = uECC_sign_precompute(entry.k_inverse, entry.r, uECC_secp256r1());
+
+    // The pool may have been shrunk in the meantime, re-check for room
+    sgx_spin_lock(&pool_lock);
+    pool_pending--;
+    const int stored = computed && (pool_count < pool_capacity);
+    if (stored) {
+      pool_entries[pool_count++] = entry;
+    }
+    sgx_spin_unlock(&pool_lock);
+
+    nonce_pool_entry_clear(&entry);
+
+    if (!computed) {
+      status = SGX_ERROR_UNEXPECTED;
+      break;
+    }
+    if (!stored) {
+      break;
+    }
+
+    filled++;
+  }
+
+  *ret_filled = filled;
+  return status;
+}
+
+int nonce_pool_take(nonce_pool_entry_t *entry) {
+  int taken = 0;
+
+  sgx_spin_lock(&pool_lock);
+  if (pool_count) {
+    nonce_pool_entry_t *slot = &pool_entries[--pool_count];
+    *entry = *slot;
+    nonce_pool_entry_clear(slot);
+    taken = 1;
+  }
+  sgx_spin_unlock(&pool_lock);
+
+  return taken;
+}
@@ -0,0 +1,42 @@
+/*
+ * nonce_pool.h - Pool of precomputed ECDSA nonces.
+ *
+ * The message-independent half of a signature, k^-1 and r = (k*G).x,
+ * is computed ahead of time by host threads calling the
+ * `nonce_pool_refill` ECALL on otherwise idle TCS. Signing then pops
+ * one entry and only has to do the cheap scalar arithmetic.
+ */
+
+#ifndef _NONCE_POOL_H_
+#define _NONCE_POOL_H_
+
+#include <stdint.h>
+
+#include "sgx_tcrypto.h"
+
+// Capacity used when the host refills the pool without configuring it
+#define NONCE_POOL_DEFAULT_CAPACITY 256
+
+// Entries are 64 bytes, so this caps the pool at a quarter of the
+// enclave heap (`HeapMaxSize` is 0x100000 in Enclave.config.xml)
+#define NONCE_POOL_MAX_CAPACITY 4096
+
+typedef struct {
+  uint8_t k_inverse[SGX_ECP256_KEY_SIZE];
+  uint8_t r[SGX_ECP256_KEY_SIZE];
+} nonce_pool_entry_t;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Pop one entry, returns 0 if the pool is empty. The entry is removed
+// from the pool and must be cleared by the caller once it has been used
+int nonce_pool_take(nonce_pool_entry_t *entry);
+void nonce_pool_entry_clear(nonce_pool_entry_t *entry);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_NONCE_POOL_H_ */
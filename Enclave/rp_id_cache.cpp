@@ -0,0 +1,66 @@
+/*
+ * rp_id_cache.cpp - Memoized rpIdHash values.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "rp_id_cache.h"
+#include "webauthn_defs.h"
+
+#include "sgx_spinlock.h"
+
+typedef struct {
+  uint32_t last_used;  // `cache_clock` at the last hit, 0 for an empty entry
+  uint32_t rp_id_len;
+  char rp_id[WEBAUTHN_RP_ID_MAX];
+  uint8_t hash[SHA256_DIGEST_SIZE];
+} rp_id_cache_entry_t;
+
+static rp_id_cache_entry_t cache[RP_ID_CACHE_ENTRIES];
+static uint32_t cache_clock = 0;
+static sgx_spinlock_t cache_lock = SGX_SPINLOCK_INITIALIZER;
+
+sgx_status_t rp_id_hash(const char *rp_id, size_t rp_id_len, uint8_t hash[SHA256_DIGEST_SIZE]) {
+  rp_id_cache_entry_t *victim = &cache[0];
+  sgx_status_t status;
+  uint32_t i;
+
+  if (rp_id_len == 0 || rp_id_len > WEBAUTHN_RP_ID_MAX) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  sgx_spin_lock(&cache_lock);
+  for (i = 0; i < RP_ID_CACHE_ENTRIES; i++) {
+    rp_id_cache_entry_t *entry = &cache[i];
+
+    if (entry->last_used && entry->rp_id_len == rp_id_len &&
+        memcmp(entry->rp_id, rp_id, rp_id_len) == 0) {
+      entry->last_used = ++cache_clock;
+      memcpy(hash, entry->hash, SHA256_DIGEST_SIZE);
+      sgx_spin_unlock(&cache_lock);
+      return SGX_SUCCESS;
+    }
+    if (entry->last_used < victim->last_used) {
+      victim = entry;
+    }
+  }
+  sgx_spin_unlock(&cache_lock);
+
+  // Miss, hash outside the lock
+  status = sha256_msg((const uint8_t*)rp_id, rp_id_len, hash);
+  if (status) {
+    return status;
+  }
+
+  // Replace the least recently used entry. Another thread may have
+  // taken it meanwhile, that only costs one more miss later
+  sgx_spin_lock(&cache_lock);
+  victim->last_used = ++cache_clock;
+  victim->rp_id_len = (uint32_t)rp_id_len;
+  memcpy(victim->rp_id, rp_id, rp_id_len);
+  memcpy(victim->hash, hash, SHA256_DIGEST_SIZE);
+  sgx_spin_unlock(&cache_lock);
+
+  return SGX_SUCCESS;
+}
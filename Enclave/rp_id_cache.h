@@ -0,0 +1,31 @@
+/*
+ * rp_id_cache.h - Memoized rpIdHash values.
+ *
+ * A handful of relying parties make up nearly all assertions, so
+ * SHA-256(rpId) is kept for the most recently used rpIds instead of
+ * being recomputed on every login.
+ */
+
+#ifndef _RP_ID_CACHE_H_
+#define _RP_ID_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sgx_error.h"
+#include "sha256.h"
+
+#define RP_ID_CACHE_ENTRIES 16
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// SHA-256 of the `rp_id_len`-byte rpId, at most WEBAUTHN_RP_ID_MAX bytes
+sgx_status_t rp_id_hash(const char *rp_id, size_t rp_id_len, uint8_t hash[SHA256_DIGEST_SIZE]);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_RP_ID_CACHE_H_ */
@@ -0,0 +1,151 @@
+/*
+ * scratch.cpp - Per-thread arenas for request-scoped buffers.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Enclave_t.h"
+#include "scratch.h"
+#include "tcs_context.h"
+#include "webauthn_defs.h"
+
+#define SCRATCH_ALIGN 16
+#define SCRATCH_NONE  0xffffffff  // `prev` of the bottom block in an arena
+#define SCRATCH_HEAP  0xfffffffe  // `prev` of a fallback block
+
+// Precedes every buffer, 16 bytes so the buffer stays aligned
+typedef struct {
+  uint32_t prev;      // offset of the block below in the arena, or SCRATCH_*
+  uint32_t size;      // bytes asked for
+  uint32_t released;
+  uint32_t reserved;
+} scratch_block_t;
+
+// Heap bytes held by fallbacks from every thread
+static volatile uint64_t fallback_bytes = 0;
+static volatile uint64_t fallback_peak = 0;
+static volatile uint64_t contextless_fallbacks = 0;
+
+// The arena of the calling thread, taken from the heap on first use (or
+// again later, if the heap was short then)
+static scratch_arena_t *arena_get(tcs_context_t *context) {
+  if (context == NULL) {
+    return NULL;
+  }
+
+  scratch_arena_t *arena = &context->scratch;
+  if (arena->base == NULL) {
+    arena->base = (uint8_t*)malloc(SCRATCH_ARENA_SIZE);
+    if (arena->base == NULL) {
+      return NULL;
+    }
+    arena->used = 0;
+    arena->top = SCRATCH_NONE;
+  }
+  return arena;
+}
+
+static void *heap_alloc(tcs_context_t *context, size_t size) {
+  scratch_block_t *block = (scratch_block_t*)malloc(sizeof(scratch_block_t) + size);
+  if (block == NULL) {
+    return NULL;
+  }
+  block->prev = SCRATCH_HEAP;
+  block->size = (uint32_t)size;
+
+  if (context != NULL) {
+    context->stats.scratch_fallbacks++;
+  } else {
+    __sync_fetch_and_add(&contextless_fallbacks, 1);
+  }
+  const uint64_t in_use = __sync_add_and_fetch(&fallback_bytes, size);
+  uint64_t peak = fallback_peak;
+  while (in_use > peak && !__sync_bool_compare_and_swap(&fallback_peak, peak, in_use)) {
+    peak = fallback_peak;
+  }
+
+  return block + 1;
+}
+
+void *scratch_alloc(size_t size) {
+  tcs_context_t *context = tcs_context_get();
+
+  if (size > SCRATCH_ARENA_SIZE - sizeof(scratch_block_t)) {
+    return heap_alloc(context, size);
+  }
+
+  const uint32_t needed = sizeof(scratch_block_t) + (((uint32_t)size + SCRATCH_ALIGN - 1) & ~(SCRATCH_ALIGN - 1));
+  scratch_arena_t *arena = arena_get(context);
+  if (arena == NULL || needed > SCRATCH_ARENA_SIZE - arena->used) {
+    return heap_alloc(context, size);
+  }
+
+  scratch_block_t *block = (scratch_block_t*)(arena->base + arena->used);
+  block->prev = arena->top;
+  block->size = (uint32_t)size;
+  block->released = 0;
+
+  arena->top = arena->used;
+  arena->used += needed;
+  context->stats.scratch_allocations++;
+  if (arena->used > arena->peak) {
+    arena->peak = arena->used;
+  }
+
+  return block + 1;
+}
+
+void scratch_free(void *buffer) {
+  if (buffer == NULL) {
+    return;
+  }
+
+  scratch_block_t *block = (scratch_block_t*)buffer - 1;
+  if (block->prev == SCRATCH_HEAP) {
+    __sync_fetch_and_sub(&fallback_bytes, block->size);
+    free(block);
+    return;
+  }
+
+  scratch_arena_t *arena = &tcs_context_get()->scratch;
+  block->released = 1;
+
+  // Pop it and every released block right below it
+  while (arena->top != SCRATCH_NONE) {
+    const scratch_block_t *top = (const scratch_block_t*)(arena->base + arena->top);
+    if (!top->released) {
+      break;
+    }
+    arena->used = arena->top;
+    arena->top = top->prev;
+  }
+}
+
+sgx_status_t scratch_get_stats(scratch_stats_t *ret_stats) {
+  uint32_t i;
+
+  memset(ret_stats, 0, sizeof(*ret_stats));
+  ret_stats->arena_size = SCRATCH_ARENA_SIZE;
+  ret_stats->fallbacks = contextless_fallbacks;
+  ret_stats->fallback_peak = fallback_peak;
+
+  // Read without the owners' cooperation, the counters may be a request behind
+  for (i = 0; i < TCS_CONTEXT_MAX; i++) {
+    const tcs_context_t *context = tcs_context_at(i);
+    if (context == NULL) {
+      continue;
+    }
+    if (context->scratch.base != NULL) {
+      ret_stats->arenas++;
+    }
+    if (context->scratch.peak > ret_stats->peak) {
+      ret_stats->peak = context->scratch.peak;
+    }
+    ret_stats->allocations += context->stats.scratch_allocations;
+    ret_stats->fallbacks += context->stats.scratch_fallbacks;
+  }
+
+  return SGX_SUCCESS;
+}
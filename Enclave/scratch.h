@@ -0,0 +1,51 @@
+/*
+ * scratch.h - Per-thread arenas for request-scoped buffers.
+ *
+ * Page images, sealed blobs and batch descriptors only live for one
+ * request, on the thread that handles it. Each TCS keeps an arena in its
+ * context (tcs_context.h), taken from the heap the first time the thread
+ * needs it. Buffers are bumped off it and popped again when freed, so a
+ * request in the steady state makes no `malloc` calls. Requests that do not fit, and
+ * threads without a context, fall back to the heap.
+ *
+ * `scratch_get_stats` reports the peak use of the arenas and of the
+ * fallback allocations, to size SCRATCH_ARENA_SIZE and `HeapMaxSize`.
+ */
+
+#ifndef _SCRATCH_H_
+#define _SCRATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes of each arena. A page write takes 4 KiB and a bulk credential
+// batch a little over 16 KiB. A full counter snapshot, about 50 KiB, is
+// rare enough to fall back to the heap
+#define SCRATCH_ARENA_SIZE (32 << 10)
+
+typedef struct {
+  uint8_t *base;      // SCRATCH_ARENA_SIZE bytes, NULL until first used
+  uint32_t used;
+  uint32_t top;       // offset of the topmost block, valid once `base` is set
+  uint32_t peak;
+} scratch_arena_t;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// `size` bytes aligned to 16, or NULL when the heap is exhausted too.
+// The contents are undefined, as with `malloc`
+void *scratch_alloc(size_t size);
+
+// Release a buffer of `scratch_alloc`, on the thread that allocated it.
+// Buffers may be released in any order, though an arena only gets its
+// space back once the ones above it are released as well. Wipe secrets
+// before releasing them, the arena hands the bytes out again as they are
+void scratch_free(void *buffer);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_SCRATCH_H_ */
@@ -0,0 +1,282 @@
+/*
+ * seal_key.cpp - Sealing with a cached seal key.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "log_ring.h"
+#include "seal_key.h"
+
+#include "sgx_attributes.h"
+#include "sgx_spinlock.h"
+#include "sgx_trts.h"
+#include "sgx_tseal.h"
+#include "sgx_utils.h"
+
+typedef struct {
+  int valid;
+  uint16_t key_policy;
+  sgx_isv_svn_t isv_svn;
+  sgx_cpu_svn_t cpu_svn;
+  sgx_key_id_t key_id;
+  sgx_key_128bit_t key;
+} cached_key_t;
+
+// Under `key_lock`. New blobs are sealed under `current`; the keys of
+// older blobs are kept in `old_keys`, replaced round robin
+static cached_key_t current;
+static uint32_t current_uses = 0;
+static cached_key_t old_keys[SEAL_KEY_CACHE_ENTRIES];
+static uint32_t old_keys_next = 0;
+static sgx_spinlock_t key_lock = SGX_SPINLOCK_INITIALIZER;
+
+// EGETKEY, with the same masks as `sgx_seal_data`
+static sgx_status_t derive_key(cached_key_t *key) {
+  sgx_key_request_t request;
+
+  memset(&request, 0, sizeof(request));
+  request.key_name = SGX_KEYSELECT_SEAL;
+  request.key_policy = key->key_policy;
+  request.isv_svn = key->isv_svn;
+  request.cpu_svn = key->cpu_svn;
+  request.key_id = key->key_id;
+  request.attribute_mask.flags = TSEAL_DEFAULT_FLAGSMASK;
+  request.attribute_mask.xfrm = 0x0;
+  request.misc_mask = TSEAL_DEFAULT_MISCMASK;
+
+  sgx_status_t status = sgx_get_key(&request, &key->key);
+  key->valid = status == SGX_SUCCESS;
+  return status;
+}
+
+static int key_names(const cached_key_t *key, const seal_key_header_t *header) {
+  return key->valid && key->key_policy == header->key_policy && key->isv_svn == header->isv_svn &&
+         memcmp(&key->cpu_svn, &header->cpu_svn, sizeof(key->cpu_svn)) == 0 &&
+         memcmp(&key->key_id, &header->key_id, sizeof(key->key_id)) == 0;
+}
+
+static void forget_key(cached_key_t *key) {
+  memset_s(key, sizeof(*key), 0, sizeof(*key));
+}
+
+// Keep `key` for unsealing. Called with `key_lock` held
+static void remember_key_locked(const cached_key_t *key) {
+  old_keys[old_keys_next] = *key;
+  old_keys_next = (old_keys_next + 1) % SEAL_KEY_CACHE_ENTRIES;
+}
+
+// Copy the current key into `ret_key` for `count` more blobs, drawing a
+// new key ID first if there is none yet or it is worn out
+static sgx_status_t take_current_key(uint32_t count, cached_key_t *ret_key) {
+  sgx_status_t status = SGX_SUCCESS;
+
+  sgx_spin_lock(&key_lock);
+  if (!current.valid || current_uses > SEAL_KEY_MAX_USES - count) {
+    const sgx_report_t *report = sgx_self_report();
+    cached_key_t key;
+
+    memset(&key, 0, sizeof(key));
+    key.key_policy = SGX_KEYPOLICY_MRSIGNER;
+    key.isv_svn = report->body.isv_svn;
+    key.cpu_svn = report->body.cpu_svn;
+
+    status = sgx_read_rand(key.key_id.id, sizeof(key.key_id.id));
+    if (!status) {
+      status = derive_key(&key);
+    }
+    if (!status) {
+      if (current.valid) {
+        LOG_DEBUG("Seal key rotated after %u blobs", current_uses);
+        remember_key_locked(&current);
+      }
+      current = key;
+      current_uses = 0;
+    }
+    forget_key(&key);
+  }
+
+  if (!status) {
+    *ret_key = current;
+    current_uses += count;
+  }
+  sgx_spin_unlock(&key_lock);
+
+  return status;
+}
+
+// The key `header` names into `ret_key`, derived only if it is not cached
+static sgx_status_t find_key(const seal_key_header_t *header, cached_key_t *ret_key) {
+  sgx_status_t status = SGX_SUCCESS;
+  uint32_t i;
+
+  sgx_spin_lock(&key_lock);
+  if (key_names(&current, header)) {
+    *ret_key = current;
+    sgx_spin_unlock(&key_lock);
+    return SGX_SUCCESS;
+  }
+  for (i = 0; i < SEAL_KEY_CACHE_ENTRIES; i++) {
+    if (key_names(&old_keys[i], header)) {
+      *ret_key = old_keys[i];
+      sgx_spin_unlock(&key_lock);
+      return SGX_SUCCESS;
+    }
+  }
+
+  ret_key->key_policy = header->key_policy;
+  ret_key->isv_svn = header->isv_svn;
+  ret_key->cpu_svn = header->cpu_svn;
+  ret_key->key_id = header->key_id;
+  status = derive_key(ret_key);
+  if (!status) {
+    remember_key_locked(ret_key);
+  }
+  sgx_spin_unlock(&key_lock);
+
+  return status;
+}
+
+int seal_key_is_sealed(const uint8_t *sealed, uint32_t sealed_size) {
+  uint32_t magic;
+
+  if (sealed_size < sizeof(seal_key_header_t)) {
+    return 0;
+  }
+  memcpy(&magic, sealed, sizeof(magic));
+  return magic == SEAL_KEY_MAGIC;
+}
+
+sgx_status_t seal_key_seal_batch(seal_key_item_t *items, uint32_t count) {
+  seal_key_header_t header;
+  cached_key_t key;
+  uint32_t i;
+  sgx_status_t status;
+
+  if (count == 0) {
+    return SGX_SUCCESS;
+  }
+  if (count > SEAL_KEY_MAX_USES) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  for (i = 0; i < count; i++) {
+    if (items[i].payload_size > UINT32_MAX - sizeof(seal_key_header_t) ||
+        items[i].sealed_size < SEAL_KEY_SEALED_SIZE(items[i].payload_size)) {
+      return SGX_ERROR_INVALID_PARAMETER;
+    }
+  }
+
+  status = take_current_key(count, &key);
+  if (status) {
+    return status;
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = SEAL_KEY_MAGIC;
+  header.key_policy = key.key_policy;
+  header.isv_svn = key.isv_svn;
+  header.cpu_svn = key.cpu_svn;
+  header.key_id = key.key_id;
+
+  // One random IV per batch, its last 4 bytes count the blobs in it
+  uint32_t iv_counter;
+  status = sgx_read_rand(header.iv, sizeof(header.iv));
+  memcpy(&iv_counter, header.iv + SGX_AESGCM_IV_SIZE - sizeof(iv_counter), sizeof(iv_counter));
+
+  for (i = 0; i < count && !status; i++) {
+    const uint32_t iv_low = iv_counter + i;
+
+    memcpy(header.iv + SGX_AESGCM_IV_SIZE - sizeof(iv_low), &iv_low, sizeof(iv_low));
+    header.payload_size = items[i].payload_size;
+
+    status = sgx_rijndael128GCM_encrypt((const sgx_aes_gcm_128bit_key_t*)&key.key,
+                                        items[i].payload, items[i].payload_size,
+                                        items[i].sealed + sizeof(header),
+                                        header.iv, sizeof(header.iv),
+                                        items[i].aad, items[i].aad_size, &header.tag);
+    memcpy(items[i].sealed, &header, sizeof(header));
+  }
+  forget_key(&key);
+
+  return status;
+}
+
+sgx_status_t seal_key_unseal_batch(seal_key_item_t *items, uint32_t count) {
+  seal_key_header_t header;
+  cached_key_t key;
+  uint32_t i;
+  sgx_status_t status = SGX_SUCCESS;
+
+  memset(&key, 0, sizeof(key));
+
+  for (i = 0; i < count && !status; i++) {
+    if (!seal_key_is_sealed(items[i].sealed, items[i].sealed_size)) {
+      status = SGX_ERROR_INVALID_PARAMETER;
+      break;
+    }
+    memcpy(&header, items[i].sealed, sizeof(header));
+    if (header.payload_size != items[i].sealed_size - sizeof(header) ||
+        header.payload_size > items[i].payload_size) {
+      status = SGX_ERROR_INVALID_PARAMETER;
+      break;
+    }
+
+    // Blobs of a batch are usually all under the same key
+    if (!key_names(&key, &header)) {
+      forget_key(&key);
+      status = find_key(&header, &key);
+      if (status) {
+        break;
+      }
+    }
+
+    status = sgx_rijndael128GCM_decrypt((const sgx_aes_gcm_128bit_key_t*)&key.key,
+                                        items[i].sealed + sizeof(header), header.payload_size,
+                                        items[i].payload,
+                                        header.iv, sizeof(header.iv),
+                                        items[i].aad, items[i].aad_size,
+                                        (const sgx_aes_gcm_128bit_tag_t*)&header.tag);
+    if (status) {
+      memset_s(items[i].payload, items[i].payload_size, 0, items[i].payload_size);
+    } else {
+      items[i].payload_size = header.payload_size;
+    }
+  }
+  forget_key(&key);
+
+  return status;
+}
+
+sgx_status_t seal_key_seal(const uint8_t *aad, uint32_t aad_size,
+                           const uint8_t *payload, uint32_t payload_size,
+                           uint8_t *sealed, uint32_t sealed_size) {
+  seal_key_item_t item;
+
+  item.aad = aad;
+  item.aad_size = aad_size;
+  item.payload = (uint8_t*)payload;
+  item.payload_size = payload_size;
+  item.sealed = sealed;
+  item.sealed_size = sealed_size;
+
+  return seal_key_seal_batch(&item, 1);
+}
+
+sgx_status_t seal_key_unseal(const uint8_t *aad, uint32_t aad_size,
+                             const uint8_t *sealed, uint32_t sealed_size,
+                             uint8_t *payload, uint32_t *payload_size) {
+  seal_key_item_t item;
+
+  item.aad = aad;
+  item.aad_size = aad_size;
+  item.payload = payload;
+  item.payload_size = *payload_size;
+  item.sealed = (uint8_t*)sealed;
+  item.sealed_size = sealed_size;
+
+  sgx_status_t status = seal_key_unseal_batch(&item, 1);
+  if (!status) {
+    *payload_size = item.payload_size;
+  }
+  return status;
+}
@@ -0,0 +1,74 @@
+/*
+ * seal_key.h - Sealing with a cached seal key.
+ *
+ * `sgx_seal_data` derives the seal key with EGETKEY for every blob and
+ * stores the 512-byte key request in front of it. Here the key is derived
+ * once, cached, and each blob is encrypted under it with AES-GCM and its
+ * own IV, behind a short header naming the key: its key ID, the SVNs and
+ * the key policy. A batch of blobs costs one key lookup.
+ *
+ * Blobs stay readable when the key is rotated or the SVNs are raised,
+ * their key is derived again from the header and cached for the next one.
+ */
+
+#ifndef _SEAL_KEY_H_
+#define _SEAL_KEY_H_
+
+#include <stdint.h>
+
+#include "sgx_error.h"
+#include "sgx_key.h"
+#include "sgx_tcrypto.h"
+
+#define SEAL_KEY_MAGIC          0x4b534157  // "WASK"
+#define SEAL_KEY_MAX_USES       (1u << 30)  // blobs sealed under one key ID before it is rotated
+#define SEAL_KEY_CACHE_ENTRIES  4           // keys of older blobs kept for unsealing
+
+typedef struct {
+  uint32_t magic;                      // SEAL_KEY_MAGIC
+  uint16_t key_policy;                 // SGX_KEYPOLICY_*
+  sgx_isv_svn_t isv_svn;
+  sgx_cpu_svn_t cpu_svn;
+  sgx_key_id_t key_id;
+  uint32_t payload_size;
+  uint8_t iv[SGX_AESGCM_IV_SIZE];
+  sgx_aes_gcm_128bit_tag_t tag;
+} seal_key_header_t;
+
+#define SEAL_KEY_SEALED_SIZE(payload_size) ((uint32_t)sizeof(seal_key_header_t) + (payload_size))
+
+typedef struct {
+  const uint8_t *aad;                  // authenticated along with the payload, not stored
+  uint32_t aad_size;
+  uint8_t *payload;                    // sealed from, or unsealed into
+  uint32_t payload_size;               // to unseal: the room in `payload`, then its size
+  uint8_t *sealed;                     // SEAL_KEY_SEALED_SIZE(payload_size) bytes
+  uint32_t sealed_size;
+} seal_key_item_t;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Whether `sealed` was sealed here rather than by `sgx_seal_data`
+int seal_key_is_sealed(const uint8_t *sealed, uint32_t sealed_size);
+
+// Seal `count` payloads under the current key
+sgx_status_t seal_key_seal_batch(seal_key_item_t *items, uint32_t count);
+
+// Unseal `count` blobs, deriving each key they name once. Stops at the
+// first one that does not unseal
+sgx_status_t seal_key_unseal_batch(seal_key_item_t *items, uint32_t count);
+
+sgx_status_t seal_key_seal(const uint8_t *aad, uint32_t aad_size,
+                           const uint8_t *payload, uint32_t payload_size,
+                           uint8_t *sealed, uint32_t sealed_size);
+sgx_status_t seal_key_unseal(const uint8_t *aad, uint32_t aad_size,
+                             const uint8_t *sealed, uint32_t sealed_size,
+                             uint8_t *payload, uint32_t *payload_size);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_SEAL_KEY_H_ */
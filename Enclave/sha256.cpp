@@ -0,0 +1,502 @@
+/*
+ * sha256.cpp - In-enclave SHA-256 with a plain-struct state.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "cpu_features.h"
+#include "sha256.h"
+
+#include "sgx_tcrypto.h"
+
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_h0[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define ROTR32(v, n) (((v) >> (n)) | ((v) << (32 - (n))))
+
+// Absorb `nblocks` full 64-byte blocks into `state`
+static void sha256_compress_generic(uint32_t state[8], const uint8_t *data, size_t nblocks) {
+  uint32_t w[64];
+  int i;
+
+  while (nblocks--) {
+    for (i = 0; i < 16; i++) {
+      w[i] = ((uint32_t)data[4 * i] << 24) | ((uint32_t)data[4 * i + 1] << 16) |
+             ((uint32_t)data[4 * i + 2] << 8) | (uint32_t)data[4 * i + 3];
+    }
+    for (i = 16; i < 64; i++) {
+      const uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (i = 0; i < 64; i++) {
+      const uint32_t S1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+      const uint32_t ch = (e & f) ^ (~e & g);
+      const uint32_t t1 = h + S1 + ch + sha256_k[i] + w[i];
+      const uint32_t S0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+      const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      const uint32_t t2 = S0 + maj;
+
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+
+    data += SHA256_BLOCK_SIZE;
+  }
+
+  memset_s(w, sizeof(w), 0, sizeof(w));
+}
+
+// Four rounds on the message words `msg` (W[t..t+3]), t = `k`
+#define SHA_NI_ROUNDS(msg, k)                                                      \
+  do {                                                                             \
+    tmp = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)&sha256_k[k]));       \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, tmp);                           \
+    tmp = _mm_shuffle_epi32(tmp, 0x0e);                                            \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, tmp);                           \
+  } while (0)
+
+// W[t+16..t+19] from m0 = W[t..t+3], m1 = W[t+4..], m2 = W[t+8..], m3 = W[t+12..]
+#define SHA_NI_SCHEDULE(m0, m1, m2, m3)                                            \
+  m0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1),            \
+                                          _mm_alignr_epi8(m3, m2, 4)), m3)
+
+// Same as `sha256_compress_generic` using the SHA extensions. The
+// hardware keeps the state as {ABEF, CDGH} rather than {ABCD, EFGH}
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha256_compress_sha_ni(uint32_t state[8], const uint8_t *data, size_t nblocks) {
+  const __m128i bswap_mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, tmp;
+  __m128i m0, m1, m2, m3;
+  int i;
+
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xb1);     // CDAB
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1b);  // EFGH
+  state0 = _mm_alignr_epi8(tmp, state1, 8);                                       // ABEF
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);                                    // CDGH
+
+  while (nblocks--) {
+    const __m128i abef = state0;
+    const __m128i cdgh = state1;
+
+    m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), bswap_mask);
+    m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), bswap_mask);
+    m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), bswap_mask);
+    m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), bswap_mask);
+
+    SHA_NI_ROUNDS(m0, 0);
+    SHA_NI_ROUNDS(m1, 4);
+    SHA_NI_ROUNDS(m2, 8);
+    SHA_NI_ROUNDS(m3, 12);
+
+    for (i = 16; i < 64; i += 16) {
+      SHA_NI_SCHEDULE(m0, m1, m2, m3);
+      SHA_NI_ROUNDS(m0, i);
+      SHA_NI_SCHEDULE(m1, m2, m3, m0);
+      SHA_NI_ROUNDS(m1, i + 4);
+      SHA_NI_SCHEDULE(m2, m3, m0, m1);
+      SHA_NI_ROUNDS(m2, i + 8);
+      SHA_NI_SCHEDULE(m3, m0, m1, m2);
+      SHA_NI_ROUNDS(m3, i + 12);
+    }
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+
+    data += SHA256_BLOCK_SIZE;
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1b);     // FEBA
+  state1 = _mm_shuffle_epi32(state1, 0xb1);  // DCHG
+  _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xf0));  // DCBA
+  _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));     // HGFE
+}
+
+static void sha256_compress(uint32_t state[8], const uint8_t *data, size_t nblocks) {
+  if (cpu_has_feature(CPU_FEATURE_SHA_NI)) {
+    sha256_compress_sha_ni(state, data, nblocks);
+  } else {
+    sha256_compress_generic(state, data, nblocks);
+  }
+}
+
+void sha256_init(sha256_ctx_t *ctx) {
+  memcpy(ctx->state, sha256_h0, sizeof(ctx->state));
+  ctx->length = 0;
+}
+
+void sha256_update(sha256_ctx_t *ctx, const uint8_t *data, size_t size) {
+  size_t used = (size_t)(ctx->length % SHA256_BLOCK_SIZE);
+
+  ctx->length += size;
+
+  // Top up a pending partial block first
+  if (used) {
+    const size_t n = (size < SHA256_BLOCK_SIZE - used) ? size : SHA256_BLOCK_SIZE - used;
+    memcpy(ctx->block + used, data, n);
+    data += n;
+    size -= n;
+    used += n;
+
+    if (used < SHA256_BLOCK_SIZE) {
+      return;
+    }
+    sha256_compress(ctx->state, ctx->block, 1);
+  }
+
+  // Full blocks straight from the input
+  if (size >= SHA256_BLOCK_SIZE) {
+    const size_t nblocks = size / SHA256_BLOCK_SIZE;
+    sha256_compress(ctx->state, data, nblocks);
+    data += nblocks * SHA256_BLOCK_SIZE;
+    size -= nblocks * SHA256_BLOCK_SIZE;
+  }
+
+  if (size) {
+    memcpy(ctx->block, data, size);
+  }
+}
+
+void sha256_final(sha256_ctx_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]) {
+  const uint64_t bit_length = ctx->length * 8;
+  size_t used = (size_t)(ctx->length % SHA256_BLOCK_SIZE);
+  int i;
+
+  // Append 0x80, zero-pad and put the bit length in the last 8 bytes
+  ctx->block[used++] = 0x80;
+  if (used > SHA256_BLOCK_SIZE - 8) {
+    memset(ctx->block + used, 0, SHA256_BLOCK_SIZE - used);
+    sha256_compress(ctx->state, ctx->block, 1);
+    used = 0;
+  }
+  memset(ctx->block + used, 0, SHA256_BLOCK_SIZE - 8 - used);
+  for (i = 0; i < 8; i++) {
+    ctx->block[SHA256_BLOCK_SIZE - 1 - i] = (uint8_t)(bit_length >> (8 * i));
+  }
+  sha256_compress(ctx->state, ctx->block, 1);
+
+  for (i = 0; i < 8; i++) {
+    digest[4 * i + 0] = (uint8_t)(ctx->state[i] >> 24);
+    digest[4 * i + 1] = (uint8_t)(ctx->state[i] >> 16);
+    digest[4 * i + 2] = (uint8_t)(ctx->state[i] >> 8);
+    digest[4 * i + 3] = (uint8_t)(ctx->state[i]);
+  }
+
+  memset_s(ctx, sizeof(*ctx), 0, sizeof(*ctx));
+}
+
+sgx_status_t sha256_msg(const uint8_t *data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]) {
+  if (!cpu_has_feature(CPU_FEATURE_SHA_NI)) {
+    if (size > UINT32_MAX) {
+      return SGX_ERROR_INVALID_PARAMETER;
+    }
+    return sgx_sha256_msg(data, (uint32_t)size, (sgx_sha256_hash_t*)digest);
+  }
+
+  sha256_ctx_t ctx;
+  sha256_init(&ctx);
+  sha256_update(&ctx, data, size);
+  sha256_final(&ctx, digest);
+
+  return SGX_SUCCESS;
+}
+
+/*
+ * Multi-buffer hashing: lane `l` of every vector belongs to message `l`,
+ * so the state is kept transposed, `state[word][lane]`.
+ */
+
+#define SHA256_MB_MAX_LANES 16
+
+// Messages sorted by length together, so lanes in a group finish close together
+#define SHA256_MB_SORT_WINDOW 64
+
+typedef void (*sha256_mb_kernel_t)(uint32_t state[8][SHA256_MB_MAX_LANES],
+                                   const uint8_t *const blocks[SHA256_MB_MAX_LANES],
+                                   uint32_t active);
+
+typedef struct {
+  const uint8_t *data;  // full blocks are read straight from the message
+  size_t full_blocks;
+  size_t total_blocks;  // full blocks plus the 1 or 2 padded tail blocks
+  uint8_t tail[2 * SHA256_BLOCK_SIZE];
+} sha256_mb_lane_t;
+
+// Feeds inactive lanes, their results are discarded
+static const uint8_t sha256_mb_idle_block[SHA256_BLOCK_SIZE] = {0};
+
+#define MB_ROTR(v, n) _mm256_or_si256(_mm256_srli_epi32(v, n), _mm256_slli_epi32(v, 32 - (n)))
+
+// One block for each of 8 lanes; lanes not set in `active` keep their state
+__attribute__((target("avx2")))
+static void sha256_mb_kernel_avx2(uint32_t state[8][SHA256_MB_MAX_LANES],
+                                  const uint8_t *const blocks[SHA256_MB_MAX_LANES],
+                                  uint32_t active) {
+  __m256i w[16];
+  __m256i s[8];
+  __m256i mask;
+  int i;
+
+  // Gather word `i` of every lane's block, then byte swap to big endian
+  const __m256i addr_lo = _mm256_loadu_si256((const __m256i*)&blocks[0]);
+  const __m256i addr_hi = _mm256_loadu_si256((const __m256i*)&blocks[4]);
+  const __m256i bswap_mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                              3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  for (i = 0; i < 16; i++) {
+    const __m256i offset = _mm256_set1_epi64x(4 * i);
+    const __m128i lo = _mm256_i64gather_epi32((const int*)0, _mm256_add_epi64(addr_lo, offset), 1);
+    const __m128i hi = _mm256_i64gather_epi32((const int*)0, _mm256_add_epi64(addr_hi, offset), 1);
+    w[i] = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), bswap_mask);
+  }
+
+  for (i = 0; i < 8; i++) {
+    s[i] = _mm256_loadu_si256((const __m256i*)state[i]);
+  }
+
+  __m256i a = s[0], b = s[1], c = s[2], d = s[3];
+  __m256i e = s[4], f = s[5], g = s[6], h = s[7];
+
+  for (i = 0; i < 64; i++) {
+    if (i >= 16) {
+      const __m256i w15 = w[(i - 15) & 15];
+      const __m256i w2 = w[(i - 2) & 15];
+      const __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(MB_ROTR(w15, 7), MB_ROTR(w15, 18)),
+                                          _mm256_srli_epi32(w15, 3));
+      const __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(MB_ROTR(w2, 17), MB_ROTR(w2, 19)),
+                                          _mm256_srli_epi32(w2, 10));
+      w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0),
+                                   _mm256_add_epi32(w[(i - 7) & 15], s1));
+    }
+
+    const __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(MB_ROTR(e, 6), MB_ROTR(e, 11)), MB_ROTR(e, 25));
+    const __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+    const __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, S1),
+                                        _mm256_add_epi32(_mm256_add_epi32(ch, w[i & 15]),
+                                                         _mm256_set1_epi32((int)sha256_k[i])));
+    const __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(MB_ROTR(a, 2), MB_ROTR(a, 13)), MB_ROTR(a, 22));
+    const __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+    const __m256i t2 = _mm256_add_epi32(S0, maj);
+
+    h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+    d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+  }
+
+  mask = _mm256_cmpgt_epi32(_mm256_and_si256(_mm256_set1_epi32((int)active),
+                                             _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128)),
+                            _mm256_setzero_si256());
+
+  const __m256i out[8] = { a, b, c, d, e, f, g, h };
+  for (i = 0; i < 8; i++) {
+    _mm256_storeu_si256((__m256i*)state[i],
+                        _mm256_blendv_epi8(s[i], _mm256_add_epi32(s[i], out[i]), mask));
+  }
+}
+
+// AVX-512 has rotates and a ternary logic op for ch, maj and the sigmas
+#define MB512_XOR3(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0x96)
+
+// One block for each of 16 lanes; lanes not set in `active` keep their state
+__attribute__((target("avx512f")))
+static void sha256_mb_kernel_avx512(uint32_t state[8][SHA256_MB_MAX_LANES],
+                                    const uint8_t *const blocks[SHA256_MB_MAX_LANES],
+                                    uint32_t active) {
+  __m512i w[16];
+  __m512i s[8];
+  int i;
+
+  // Gather word `i` of every lane's block, then byte swap to big endian
+  const __m512i addr_lo = _mm512_loadu_si512((const void*)&blocks[0]);
+  const __m512i addr_hi = _mm512_loadu_si512((const void*)&blocks[8]);
+  const __m512i odd_bytes = _mm512_set1_epi32((int)0xff00ff00);
+  for (i = 0; i < 16; i++) {
+    const __m512i offset = _mm512_set1_epi64(4 * i);
+    const __m256i lo = _mm512_i64gather_epi32(_mm512_add_epi64(addr_lo, offset), (const void*)0, 1);
+    const __m256i hi = _mm512_i64gather_epi32(_mm512_add_epi64(addr_hi, offset), (const void*)0, 1);
+    const __m512i v = _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1);
+    w[i] = _mm512_ternarylogic_epi32(odd_bytes, _mm512_ror_epi32(v, 8), _mm512_rol_epi32(v, 8), 0xca);
+  }
+
+  for (i = 0; i < 8; i++) {
+    s[i] = _mm512_loadu_si512((const void*)state[i]);
+  }
+
+  __m512i a = s[0], b = s[1], c = s[2], d = s[3];
+  __m512i e = s[4], f = s[5], g = s[6], h = s[7];
+
+  for (i = 0; i < 64; i++) {
+    if (i >= 16) {
+      const __m512i w15 = w[(i - 15) & 15];
+      const __m512i w2 = w[(i - 2) & 15];
+      const __m512i s0 = MB512_XOR3(_mm512_ror_epi32(w15, 7), _mm512_ror_epi32(w15, 18), _mm512_srli_epi32(w15, 3));
+      const __m512i s1 = MB512_XOR3(_mm512_ror_epi32(w2, 17), _mm512_ror_epi32(w2, 19), _mm512_srli_epi32(w2, 10));
+      w[i & 15] = _mm512_add_epi32(_mm512_add_epi32(w[i & 15], s0),
+                                   _mm512_add_epi32(w[(i - 7) & 15], s1));
+    }
+
+    const __m512i S1 = MB512_XOR3(_mm512_ror_epi32(e, 6), _mm512_ror_epi32(e, 11), _mm512_ror_epi32(e, 25));
+    const __m512i ch = _mm512_ternarylogic_epi32(e, f, g, 0xca);
+    const __m512i t1 = _mm512_add_epi32(_mm512_add_epi32(h, S1),
+                                        _mm512_add_epi32(_mm512_add_epi32(ch, w[i & 15]),
+                                                         _mm512_set1_epi32((int)sha256_k[i])));
+    const __m512i S0 = MB512_XOR3(_mm512_ror_epi32(a, 2), _mm512_ror_epi32(a, 13), _mm512_ror_epi32(a, 22));
+    const __m512i maj = _mm512_ternarylogic_epi32(a, b, c, 0xe8);
+    const __m512i t2 = _mm512_add_epi32(S0, maj);
+
+    h = g; g = f; f = e; e = _mm512_add_epi32(d, t1);
+    d = c; c = b; b = a; a = _mm512_add_epi32(t1, t2);
+  }
+
+  const __m512i out[8] = { a, b, c, d, e, f, g, h };
+  for (i = 0; i < 8; i++) {
+    _mm512_storeu_si512((void*)state[i], _mm512_mask_add_epi32(s[i], (__mmask16)active, s[i], out[i]));
+  }
+}
+
+// Hash the `n` (<= `lanes`) messages `order[0..n)` side by side
+static void sha256_mb_group(const uint8_t *const *msgs, const size_t *sizes, const uint32_t *order,
+                            size_t n, size_t lanes, sha256_mb_kernel_t kernel,
+                            uint8_t (*digests)[SHA256_DIGEST_SIZE]) {
+  sha256_mb_lane_t lane[SHA256_MB_MAX_LANES];
+  uint32_t state[8][SHA256_MB_MAX_LANES];
+  const uint8_t *blocks[SHA256_MB_MAX_LANES];
+  size_t max_blocks = 0;
+  size_t l, j;
+  int i;
+
+  for (l = 0; l < n; l++) {
+    const size_t size = sizes[order[l]];
+    const size_t rem = size % SHA256_BLOCK_SIZE;
+    const uint64_t bit_length = (uint64_t)size * 8;
+
+    lane[l].data = msgs[order[l]];
+    lane[l].full_blocks = size / SHA256_BLOCK_SIZE;
+
+    // Same padding as `sha256_final`
+    const size_t tail_size = (rem + 9 <= SHA256_BLOCK_SIZE) ? SHA256_BLOCK_SIZE : 2 * SHA256_BLOCK_SIZE;
+    memset(lane[l].tail, 0, tail_size);
+    if (rem) {
+      memcpy(lane[l].tail, lane[l].data + size - rem, rem);
+    }
+    lane[l].tail[rem] = 0x80;
+    for (i = 0; i < 8; i++) {
+      lane[l].tail[tail_size - 1 - i] = (uint8_t)(bit_length >> (8 * i));
+    }
+
+    lane[l].total_blocks = lane[l].full_blocks + tail_size / SHA256_BLOCK_SIZE;
+    if (lane[l].total_blocks > max_blocks) {
+      max_blocks = lane[l].total_blocks;
+    }
+  }
+
+  for (i = 0; i < 8; i++) {
+    for (l = 0; l < lanes; l++) {
+      state[i][l] = sha256_h0[i];
+    }
+  }
+
+  for (j = 0; j < max_blocks; j++) {
+    uint32_t active = 0;
+
+    for (l = 0; l < lanes; l++) {
+      if (l >= n || j >= lane[l].total_blocks) {
+        blocks[l] = sha256_mb_idle_block;
+      } else if (j < lane[l].full_blocks) {
+        blocks[l] = lane[l].data + j * SHA256_BLOCK_SIZE;
+        active |= 1u << l;
+      } else {
+        blocks[l] = lane[l].tail + (j - lane[l].full_blocks) * SHA256_BLOCK_SIZE;
+        active |= 1u << l;
+      }
+    }
+
+    kernel(state, blocks, active);
+  }
+
+  for (l = 0; l < n; l++) {
+    uint8_t *digest = digests[order[l]];
+    for (i = 0; i < 8; i++) {
+      digest[4 * i + 0] = (uint8_t)(state[i][l] >> 24);
+      digest[4 * i + 1] = (uint8_t)(state[i][l] >> 16);
+      digest[4 * i + 2] = (uint8_t)(state[i][l] >> 8);
+      digest[4 * i + 3] = (uint8_t)(state[i][l]);
+    }
+  }
+
+  memset_s(lane, sizeof(lane), 0, sizeof(lane));
+  memset_s(state, sizeof(state), 0, sizeof(state));
+}
+
+sgx_status_t sha256_msg_batch(size_t count, const uint8_t *const *msgs, const size_t *sizes,
+                              uint8_t (*digests)[SHA256_DIGEST_SIZE]) {
+  sha256_mb_kernel_t kernel = NULL;
+  size_t lanes = 1;
+  uint32_t order[SHA256_MB_SORT_WINDOW];
+  sgx_status_t status;
+
+  if (cpu_has_feature(CPU_FEATURE_AVX512F)) {
+    kernel = sha256_mb_kernel_avx512;
+    lanes = 16;
+  } else if (cpu_has_feature(CPU_FEATURE_AVX2) && !cpu_has_feature(CPU_FEATURE_SHA_NI)) {
+    // 8 AVX2 lanes do not keep up with the SHA extensions
+    kernel = sha256_mb_kernel_avx2;
+    lanes = 8;
+  }
+
+  while (count) {
+    const size_t window = (count < SHA256_MB_SORT_WINDOW) ? count : SHA256_MB_SORT_WINDOW;
+    size_t n, k;
+
+    // Insertion sort of the window by message length
+    for (n = 0; n < window; n++) {
+      for (k = n; k > 0 && sizes[order[k - 1]] > sizes[n]; k--) {
+        order[k] = order[k - 1];
+      }
+      order[k] = (uint32_t)n;
+    }
+
+    for (n = 0; n < window; n += k) {
+      k = (window - n < lanes) ? window - n : lanes;
+
+      // Groups at most half full are cheaper one message at a time
+      if (kernel && k > lanes / 2) {
+        sha256_mb_group(msgs, sizes, order + n, k, lanes, kernel, digests);
+        continue;
+      }
+
+      for (size_t m = n; m < n + k; m++) {
+        status = sha256_msg(msgs[order[m]], sizes[order[m]], digests[order[m]]);
+        if (status) {
+          return status;
+        }
+      }
+    }
+
+    msgs += window;
+    sizes += window;
+    digests += window;
+    count -= window;
+  }
+
+  return SGX_SUCCESS;
+}
@@ -0,0 +1,50 @@
+/*
+ * sha256.h - In-enclave SHA-256 with a plain-struct state.
+ *
+ * Unlike `sgx_sha_state_handle_t`, a `sha256_ctx_t` can be copied, so
+ * partially absorbed states (e.g. HMAC key pads) can be cached and
+ * restored instead of being hashed again.
+ *
+ * All enclave hashing goes through this interface. Blocks are compressed
+ * with the SHA extensions when the CPU has them (see cpu_features.h).
+ */
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sgx_error.h"
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t length;                   // total bytes absorbed
+  uint8_t block[SHA256_BLOCK_SIZE];  // pending partial block
+} sha256_ctx_t;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+void sha256_init(sha256_ctx_t *ctx);
+void sha256_update(sha256_ctx_t *ctx, const uint8_t *data, size_t size);
+void sha256_final(sha256_ctx_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+// One-shot hash. Without the SHA extensions this defers to the SDK's
+// `sgx_sha256_msg`, which beats the portable compression function
+sgx_status_t sha256_msg(const uint8_t *data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+// Hash `count` independent messages, `digests[i]` = SHA256(`msgs[i]`, `sizes[i]`).
+// With AVX2/AVX-512 up to 8/16 messages are hashed side by side, one per vector lane
+sgx_status_t sha256_msg_batch(size_t count, const uint8_t *const *msgs, const size_t *sizes,
+                              uint8_t (*digests)[SHA256_DIGEST_SIZE]);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_SHA256_H_ */
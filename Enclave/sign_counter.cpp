@@ -0,0 +1,850 @@
+/*
+ * sign_counter.cpp - Per-credential signature counters.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Enclave_t.h"
+#include "cred_db.h"
+#include "log_ring.h"
+#include "scratch.h"
+#include "seal_key.h"
+#include "sign_counter.h"
+
+#include "sgx_spinlock.h"
+#include "sgx_thread.h"
+#include "sgx_tseal.h"
+
+#define WAL_RECORD_MAGIC    0x57414c32  // "WAL2"
+#define WAL_RECORD_SNAPSHOT (1u << 0)   // holds every non-zero counter in memory, replaces the log
+#define WAL_RECORD_CLEAN    (1u << 1)   // written at shutdown, nothing was issued after it
+
+typedef struct {
+  uint32_t magic;
+  uint32_t flags;        // WAL_RECORD_*
+  uint64_t seq;          // increases by one per record written
+  uint32_t num_entries;
+  uint32_t epoch;        // see sign_counter.h
+} wal_record_header_t;
+
+typedef struct {
+  uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE];
+  uint32_t value;
+} wal_record_entry_t;
+
+// The counter of one credential in memory
+typedef struct {
+  uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE];
+  uint32_t value;
+  int16_t next;          // in its bucket's chain, -1 at the end
+  uint8_t used;
+  uint8_t dirty;         // changed since the last record was built
+  uint8_t loaded;        // merged with the counter in the credential's record
+  uint8_t referenced;    // set by every use, cleared as the clock hand passes
+  uint8_t writing_back;  // being written back by an eviction
+} counter_slot_t;
+
+// The counter of a credential evicted from `slots`, until the flush
+// thread has written it back to the credential's record. Until then it is
+// carried by the log like the counters in `slots`
+typedef struct {
+  uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE];
+  uint32_t value;
+  uint8_t dirty;         // changed since the last record was built
+  uint8_t writing_back;  // in the batch being written back
+} evicted_counter_t;
+
+#define COUNTER_BUCKETS SIGN_COUNTER_MAX_ACTIVE
+
+// Counter state, under `counter_lock`. The buckets chain the slots by
+// credential ID, the clock hand sweeps them for one to write back
+static counter_slot_t slots[SIGN_COUNTER_MAX_ACTIVE];
+static int16_t buckets[COUNTER_BUCKETS];
+static int16_t free_slots[SIGN_COUNTER_MAX_ACTIVE];
+static uint32_t num_free = 0;
+static uint32_t slot_hand = 0;
+static int slots_ready = 0;
+static evicted_counter_t evicted[SIGN_COUNTER_WRITE_BACK_MAX];
+static uint32_t num_evicted = 0;
+static uint64_t removals = 0;          // slots and evicted counters given up, see load_counter
+static uint32_t epoch = 0;             // constant once opened
+static uint16_t dirty_list[SIGN_COUNTER_GROUP_COMMIT];
+static uint32_t pending = 0;           // updates since the last record was built
+static uint64_t issued_total = 0;      // updates since `sign_counter_open`
+static int need_snapshot = 0;          // a record was lost, write everything next time
+static volatile int opened = 0;
+static sgx_spinlock_t counter_lock = SGX_SPINLOCK_INITIALIZER;
+
+// Serializes write-backs of `evicted`
+static sgx_thread_mutex_t write_back_mutex = SGX_THREAD_MUTEX_INITIALIZER;
+
+// Log state, under `flush_mutex`. A mutex rather than a spinlock
+// since it is held while waiting for room in `inflight`
+static uint64_t wal_seq = 0;
+static uint32_t wal_records = 0;       // appended since the last snapshot
+static sgx_thread_mutex_t flush_mutex = SGX_THREAD_MUTEX_INITIALIZER;
+
+// Records handed to the host, by seq
+typedef struct {
+  uint64_t total;                      // `issued_total` when the record was built
+  uint32_t flags;
+} inflight_record_t;
+
+// Durability state, under `durable_mutex`. The host reports records
+// in the order they were written
+static inflight_record_t inflight[SIGN_COUNTER_MAX_INFLIGHT];
+static uint64_t completed_seq = 0;     // last record reported by the host
+static uint64_t durable_seq = 0;       // last record that made counters durable
+static uint64_t durable_total = 0;     // `issued_total` covered by durable records
+static int awaiting_snapshot = 0;      // a record failed, only a snapshot is durable now
+static sgx_thread_mutex_t durable_mutex = SGX_THREAD_MUTEX_INITIALIZER;
+static sgx_thread_cond_t durable_cond = SGX_THREAD_COND_INITIALIZER;
+
+// Recovery state, before `sign_counter_open`
+static uint64_t replay_seq = 0;
+static int replayed = 0;
+static int replay_clean = 0;
+
+// Called with `counter_lock` held
+static void slots_init_locked(void) {
+  uint32_t i;
+
+  if (slots_ready) {
+    return;
+  }
+  for (i = 0; i < COUNTER_BUCKETS; i++) {
+    buckets[i] = -1;
+  }
+  for (i = 0; i < SIGN_COUNTER_MAX_ACTIVE; i++) {
+    free_slots[i] = (int16_t)(SIGN_COUNTER_MAX_ACTIVE - 1 - i);
+  }
+  num_free = SIGN_COUNTER_MAX_ACTIVE;
+  slots_ready = 1;
+}
+
+static int16_t *slot_bucket(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE]) {
+  uint32_t hash;
+  memcpy(&hash, id, sizeof(hash));
+  return &buckets[hash % COUNTER_BUCKETS];
+}
+
+// The slot of credential `id`, -1 if it has none. Called with `counter_lock` held
+static int32_t slot_find_locked(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE]) {
+  int32_t index;
+
+  slots_init_locked();
+  for (index = *slot_bucket(id); index >= 0; index = slots[index].next) {
+    if (memcmp(slots[index].id, id, WEBAUTHN_CREDENTIAL_ID_SIZE) == 0) {
+      return index;
+    }
+  }
+  return -1;
+}
+
+// A new slot for credential `id`, -1 if all are taken. Called with
+// `counter_lock` held
+static int32_t slot_insert_locked(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE], uint32_t value) {
+  slots_init_locked();
+  if (num_free == 0) {
+    return -1;
+  }
+
+  const int32_t index = free_slots[--num_free];
+  counter_slot_t *slot = &slots[index];
+  int16_t *bucket = slot_bucket(id);
+
+  memcpy(slot->id, id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+  slot->value = value;
+  slot->used = 1;
+  slot->dirty = 0;
+  slot->loaded = 0;
+  slot->referenced = 1;
+  slot->writing_back = 0;
+  slot->next = *bucket;
+  *bucket = (int16_t)index;
+  return index;
+}
+
+// Give up slot `index`. Called with `counter_lock` held
+static void slot_remove_locked(int32_t index) {
+  counter_slot_t *slot = &slots[index];
+  int16_t *link = slot_bucket(slot->id);
+
+  while (*link != index) {
+    link = &slots[*link].next;
+  }
+  *link = slot->next;
+
+  memset(slot, 0, sizeof(*slot));
+  slot->next = -1;
+  free_slots[num_free++] = (int16_t)index;
+  removals++;
+}
+
+// The evicted counter of credential `id`, -1 if it has none. Called with
+// `counter_lock` held
+static int32_t evicted_find_locked(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE]) {
+  uint32_t i;
+
+  for (i = 0; i < num_evicted; i++) {
+    if (memcmp(evicted[i].id, id, WEBAUTHN_CREDENTIAL_ID_SIZE) == 0) {
+      return (int32_t)i;
+    }
+  }
+  return -1;
+}
+
+// Keep `value` for credential `id` until it is written back, 0 if
+// `evicted` is full. Called with `counter_lock` held
+static int evicted_put_locked(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE], uint32_t value, int dirty) {
+  int32_t index = evicted_find_locked(id);
+
+  if (index < 0) {
+    if (num_evicted == SIGN_COUNTER_WRITE_BACK_MAX) {
+      return 0;
+    }
+    index = (int32_t)num_evicted++;
+    memcpy(evicted[index].id, id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+    evicted[index].value = 0;
+    evicted[index].dirty = 0;
+  }
+
+  // A batch writing an older value back no longer covers it
+  evicted_counter_t *entry = &evicted[index];
+  if (value > entry->value) {
+    entry->value = value;
+  }
+  entry->dirty |= dirty;
+  entry->writing_back = 0;
+  return 1;
+}
+
+uint32_t sign_counter_epoch(void) {
+  return __atomic_load_n(&epoch, __ATOMIC_ACQUIRE);
+}
+
+uint32_t sign_counter_rebase(uint32_t counter, uint32_t from, uint32_t to) {
+  if (to <= from) {
+    return counter;
+  }
+  return (counter > UINT32_MAX - (to - from)) ? UINT32_MAX : counter + (to - from);
+}
+
+// Build, seal and write one record. Called with `flush_mutex` held
+static sgx_status_t flush_locked(uint32_t flags) {
+  wal_record_entry_t *entries;
+  uint32_t num_entries = 0;
+  uint32_t i;
+  int32_t error = 0;
+  sgx_status_t status;
+
+  // Decided under the lock: a failed record sets `need_snapshot` from
+  // another thread, and only a snapshot may clear it
+  sgx_spin_lock(&counter_lock);
+  if (need_snapshot || wal_records >= SIGN_COUNTER_WAL_COMPACT) {
+    flags |= WAL_RECORD_SNAPSHOT;
+  }
+  sgx_spin_unlock(&counter_lock);
+
+  const uint32_t max_entries = (flags & WAL_RECORD_SNAPSHOT) ? SIGN_COUNTER_MAX_ACTIVE + SIGN_COUNTER_WRITE_BACK_MAX
+                                                              : SIGN_COUNTER_GROUP_COMMIT;
+  const uint32_t record_size = sizeof(wal_record_header_t) + max_entries * sizeof(wal_record_entry_t);
+  uint8_t *record = (uint8_t*)scratch_alloc(record_size);
+  if (record == NULL) {
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+  entries = (wal_record_entry_t*)(record + sizeof(wal_record_header_t));
+
+  // Wait for the host to report an older record before reusing its slot
+  sgx_thread_mutex_lock(&durable_mutex);
+  while (wal_seq - completed_seq >= SIGN_COUNTER_MAX_INFLIGHT) {
+    sgx_thread_cond_wait(&durable_cond, &durable_mutex);
+  }
+  sgx_thread_mutex_unlock(&durable_mutex);
+
+  sgx_spin_lock(&counter_lock);
+  if (flags & WAL_RECORD_SNAPSHOT) {
+    for (i = 0; i < SIGN_COUNTER_MAX_ACTIVE; i++) {
+      if (slots[i].used && slots[i].value) {
+        memcpy(entries[num_entries].id, slots[i].id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+        entries[num_entries].value = slots[i].value;
+        num_entries++;
+      }
+      slots[i].dirty = 0;
+    }
+    for (i = 0; i < num_evicted; i++) {
+      memcpy(entries[num_entries].id, evicted[i].id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+      entries[num_entries].value = evicted[i].value;
+      num_entries++;
+      evicted[i].dirty = 0;
+    }
+  } else {
+    // A slot written back since may have been taken by another
+    // credential, only the dirty ones are current
+    for (i = 0; i < pending; i++) {
+      counter_slot_t *slot = &slots[dirty_list[i]];
+      if (slot->used && slot->dirty) {
+        memcpy(entries[num_entries].id, slot->id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+        entries[num_entries].value = slot->value;
+        num_entries++;
+        slot->dirty = 0;
+      }
+    }
+    // Each one was evicted from a dirty slot in `dirty_list`, so these
+    // are still within SIGN_COUNTER_GROUP_COMMIT
+    for (i = 0; i < num_evicted && num_entries < max_entries; i++) {
+      if (evicted[i].dirty) {
+        memcpy(entries[num_entries].id, evicted[i].id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+        entries[num_entries].value = evicted[i].value;
+        num_entries++;
+        evicted[i].dirty = 0;
+      }
+    }
+  }
+  const uint64_t total = issued_total;
+  if (flags & WAL_RECORD_SNAPSHOT) {
+    need_snapshot = 0;
+  }
+  // Still owed a snapshot, the next update writes it
+  pending = need_snapshot ? SIGN_COUNTER_GROUP_COMMIT : 0;
+  sgx_spin_unlock(&counter_lock);
+
+  wal_record_header_t *header = (wal_record_header_t*)record;
+  header->magic = WAL_RECORD_MAGIC;
+  header->flags = flags;
+  header->seq = ++wal_seq;
+  header->num_entries = num_entries;
+  header->epoch = epoch;
+
+  // Sealed under the cached key: a record per group commit no longer
+  // costs an EGETKEY
+  const uint32_t plain_size = sizeof(wal_record_header_t) + num_entries * sizeof(wal_record_entry_t);
+  const uint32_t sealed_size = SEAL_KEY_SEALED_SIZE(plain_size);
+  uint8_t *sealed = (uint8_t*)scratch_alloc(sealed_size);
+
+  if (sealed == NULL) {
+    status = SGX_ERROR_OUT_OF_MEMORY;
+  } else {
+    status = seal_key_seal(NULL, 0, record, plain_size, sealed, sealed_size);
+  }
+
+  if (!status) {
+    sgx_thread_mutex_lock(&durable_mutex);
+    inflight[wal_seq % SIGN_COUNTER_MAX_INFLIGHT].total = total;
+    inflight[wal_seq % SIGN_COUNTER_MAX_INFLIGHT].flags = flags;
+    sgx_thread_mutex_unlock(&durable_mutex);
+
+    // Only queued by the host, reported later through `sign_counter_persisted`
+    if (flags & WAL_RECORD_SNAPSHOT) {
+      status = untrusted_wal_reset(&error, sealed, sealed_size, wal_seq);
+    } else {
+      status = untrusted_wal_append(&error, sealed, sealed_size, wal_seq);
+    }
+    if (!status && error) {
+      status = SGX_ERROR_UNEXPECTED;
+    }
+  }
+
+  scratch_free(sealed);
+  scratch_free(record);
+
+  if (status) {
+    // Never queued, so the host will not report it. The updates in it
+    // are not durable: the next record has to be a snapshot
+    wal_seq--;
+    sgx_spin_lock(&counter_lock);
+    need_snapshot = 1;
+    pending = SIGN_COUNTER_GROUP_COMMIT;
+    sgx_spin_unlock(&counter_lock);
+
+    sgx_thread_mutex_lock(&durable_mutex);
+    sgx_thread_cond_broadcast(&durable_cond);
+    sgx_thread_mutex_unlock(&durable_mutex);
+    return status;
+  }
+
+  wal_records = (flags & WAL_RECORD_SNAPSHOT) ? 0 : wal_records + 1;
+  return SGX_SUCCESS;
+}
+
+// Wait until the host has reported record `seq`, successful if it is durable
+static sgx_status_t wait_durable(uint64_t seq) {
+  sgx_status_t status;
+
+  sgx_thread_mutex_lock(&durable_mutex);
+  while (completed_seq < seq) {
+    sgx_thread_cond_wait(&durable_cond, &durable_mutex);
+  }
+  status = (durable_seq >= seq) ? SGX_SUCCESS : SGX_ERROR_UNEXPECTED;
+  sgx_thread_mutex_unlock(&durable_mutex);
+
+  return status;
+}
+
+// The host's report for record `seq`, `error` is 0 once it is on disk
+sgx_status_t sign_counter_persisted(uint64_t seq, int32_t error) {
+  sgx_thread_mutex_lock(&durable_mutex);
+  if (seq != completed_seq + 1) {
+    sgx_thread_mutex_unlock(&durable_mutex);
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+  completed_seq = seq;
+
+  const inflight_record_t *record = &inflight[seq % SIGN_COUNTER_MAX_INFLIGHT];
+  if (error) {
+    LOG_WARN("Signature counter record %llu was not persisted, writing a snapshot", (unsigned long long)seq);
+
+    // Later appends may sit behind a torn write, only a snapshot counts again
+    awaiting_snapshot = 1;
+    sgx_spin_lock(&counter_lock);
+    need_snapshot = 1;
+    pending = SIGN_COUNTER_GROUP_COMMIT;
+    sgx_spin_unlock(&counter_lock);
+  } else if (!awaiting_snapshot || (record->flags & WAL_RECORD_SNAPSHOT)) {
+    awaiting_snapshot = 0;
+    durable_seq = seq;
+    if (record->total > durable_total) {
+      __atomic_store_n(&durable_total, record->total, __ATOMIC_RELEASE);
+    }
+  }
+
+  sgx_thread_cond_broadcast(&durable_cond);
+  sgx_thread_mutex_unlock(&durable_mutex);
+
+  return SGX_SUCCESS;
+}
+
+// Give up the slot of a credential unused since the clock hand last
+// passed, its counter kept in `evicted` for the flush thread to write
+// back. Only if that is full is it written back here, unless it was
+// counted again meanwhile
+static sgx_status_t evict_counter(void) {
+  cred_counter_t counter;
+  int32_t victim = -1;
+  uint32_t n;
+
+  sgx_spin_lock(&counter_lock);
+  for (n = 0; n < 2 * SIGN_COUNTER_MAX_ACTIVE; n++) {
+    const int32_t index = (int32_t)slot_hand;
+    counter_slot_t *slot = &slots[index];
+
+    slot_hand = (slot_hand + 1) % SIGN_COUNTER_MAX_ACTIVE;
+    if (!slot->used || slot->writing_back) {
+      continue;
+    }
+    if (slot->referenced) {
+      slot->referenced = 0;
+      continue;
+    }
+    victim = index;
+    break;
+  }
+
+  // Every slot is being written back by another thread
+  if (victim < 0) {
+    sgx_spin_unlock(&counter_lock);
+    return SGX_ERROR_BUSY;
+  }
+
+  counter_slot_t *slot = &slots[victim];
+  if (evicted_put_locked(slot->id, slot->value, slot->dirty)) {
+    slot_remove_locked(victim);
+    sgx_spin_unlock(&counter_lock);
+    return SGX_SUCCESS;
+  }
+
+  const uint32_t value = slot->value;
+  slot->writing_back = 1;
+  memcpy(counter.id, slot->id, sizeof(counter.id));
+  counter.counter = value;
+  sgx_spin_unlock(&counter_lock);
+
+  sgx_status_t status = cred_db_set_counters(&counter, 1, sign_counter_epoch());
+
+  sgx_spin_lock(&counter_lock);
+  slot->writing_back = 0;
+  if (!status && slot->value == value) {
+    slot_remove_locked(victim);
+  }
+  sgx_spin_unlock(&counter_lock);
+
+  return status;
+}
+
+// Write the counters in `evicted` back to their records, in one batch,
+// and forget the ones that were not evicted again meanwhile
+static sgx_status_t write_back_evicted(void) {
+  uint32_t count = 0;
+  uint32_t i;
+  sgx_status_t status = SGX_SUCCESS;
+
+  sgx_thread_mutex_lock(&write_back_mutex);
+
+  cred_counter_t *batch = (cred_counter_t*)scratch_alloc(SIGN_COUNTER_WRITE_BACK_MAX * sizeof(*batch));
+  if (batch == NULL) {
+    sgx_thread_mutex_unlock(&write_back_mutex);
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+
+  sgx_spin_lock(&counter_lock);
+  for (i = 0; i < num_evicted; i++) {
+    memcpy(batch[count].id, evicted[i].id, WEBAUTHN_CREDENTIAL_ID_SIZE);
+    batch[count].counter = evicted[i].value;
+    evicted[i].writing_back = 1;
+    count++;
+  }
+  sgx_spin_unlock(&counter_lock);
+
+  if (count) {
+    status = cred_db_set_counters(batch, count, sign_counter_epoch());
+  }
+
+  sgx_spin_lock(&counter_lock);
+  uint32_t kept = 0;
+  for (i = 0; i < num_evicted; i++) {
+    if (status || !evicted[i].writing_back) {
+      evicted[i].writing_back = 0;
+      evicted[kept++] = evicted[i];
+    }
+  }
+  if (kept != num_evicted) {
+    num_evicted = kept;
+    removals++;
+  }
+  sgx_spin_unlock(&counter_lock);
+
+  scratch_free(batch);
+  sgx_thread_mutex_unlock(&write_back_mutex);
+
+  return status;
+}
+
+// Bring the counter of credential `id` into memory, merged with the one
+// in its record. The record is read without the lock, so it is read again
+// if a slot was given up meanwhile: that may have been this credential's,
+// written back after the read
+static sgx_status_t load_counter(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE]) {
+  uint32_t counter;
+  uint32_t counter_epoch;
+  sgx_status_t status;
+
+  for (;;) {
+    sgx_spin_lock(&counter_lock);
+    const uint64_t seen = removals;
+    int32_t index = slot_find_locked(id);
+    const int loaded = index >= 0 && slots[index].loaded;
+    const int room = index >= 0 || num_free > 0;
+    sgx_spin_unlock(&counter_lock);
+
+    if (loaded) {
+      return SGX_SUCCESS;
+    }
+    if (!room) {
+      status = evict_counter();
+      if (status) {
+        return status;
+      }
+      continue;
+    }
+
+    status = cred_db_get_counter(id, &counter, &counter_epoch);
+    if (status) {
+      return status;
+    }
+    const uint32_t value = sign_counter_rebase(counter, counter_epoch, sign_counter_epoch());
+
+    sgx_spin_lock(&counter_lock);
+    if (removals == seen) {
+      // Evicted and not yet written back, the record is behind
+      const int32_t pending_index = evicted_find_locked(id);
+      const uint32_t newest = (pending_index >= 0 && evicted[pending_index].value > value) ?
+                              evicted[pending_index].value : value;
+
+      index = slot_find_locked(id);
+      if (index < 0) {
+        index = slot_insert_locked(id, newest);
+      } else if (!slots[index].loaded && newest > slots[index].value) {
+        // Replayed from the log, but written back to the record since
+        slots[index].value = newest;
+      }
+      if (index >= 0) {
+        slots[index].loaded = 1;
+      }
+    } else {
+      index = -1;
+    }
+    sgx_spin_unlock(&counter_lock);
+
+    if (index >= 0) {
+      return SGX_SUCCESS;
+    }
+  }
+}
+
+sgx_status_t sign_counter_next(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE], uint32_t *ret_count) {
+  sgx_status_t status;
+  int32_t index;
+
+  if (!opened) {
+    return SGX_ERROR_INVALID_STATE;
+  }
+
+  for (;;) {
+    sgx_spin_lock(&counter_lock);
+    if (pending < SIGN_COUNTER_GROUP_COMMIT &&
+        issued_total - __atomic_load_n(&durable_total, __ATOMIC_ACQUIRE) < SIGN_COUNTER_RECOVERY_JUMP) {
+      index = slot_find_locked(id);
+      if (index >= 0 && slots[index].loaded) {
+        break;
+      }
+      sgx_spin_unlock(&counter_lock);
+
+      status = load_counter(id);
+      if (status) {
+        return status;
+      }
+      continue;
+    }
+    const int must_flush = pending >= SIGN_COUNTER_GROUP_COMMIT;
+    sgx_spin_unlock(&counter_lock);
+
+    if (!must_flush) {
+      // Too far ahead of the disk, wait for the host to report a record
+      sgx_thread_mutex_lock(&durable_mutex);
+      while (opened &&
+             __atomic_load_n(&pending, __ATOMIC_RELAXED) < SIGN_COUNTER_GROUP_COMMIT &&
+             __atomic_load_n(&issued_total, __ATOMIC_RELAXED) - durable_total >= SIGN_COUNTER_RECOVERY_JUMP) {
+        sgx_thread_cond_wait(&durable_cond, &durable_mutex);
+      }
+      sgx_thread_mutex_unlock(&durable_mutex);
+
+      if (!opened) {
+        return SGX_ERROR_INVALID_STATE;
+      }
+      continue;
+    }
+
+    // Group commit on behalf of everyone waiting, unless another
+    // thread's flush already made room
+    sgx_thread_mutex_lock(&flush_mutex);
+    status = SGX_SUCCESS;
+    if (__atomic_load_n(&pending, __ATOMIC_RELAXED) >= SIGN_COUNTER_GROUP_COMMIT) {
+      status = flush_locked(0);
+    }
+    sgx_thread_mutex_unlock(&flush_mutex);
+
+    if (status) {
+      return status;
+    }
+  }
+
+  // Checked again under the lock, so nothing is issued after the clean record
+  if (!opened) {
+    sgx_spin_unlock(&counter_lock);
+    return SGX_ERROR_INVALID_STATE;
+  }
+
+  counter_slot_t *slot = &slots[index];
+
+  // A wrapped counter would look like a cloned authenticator to the relying party
+  if (slot->value == UINT32_MAX) {
+    sgx_spin_unlock(&counter_lock);
+    return SGX_ERROR_UNEXPECTED;
+  }
+
+  const uint32_t count = ++slot->value;
+  slot->referenced = 1;
+  if (!slot->dirty) {
+    slot->dirty = 1;
+    dirty_list[pending] = (uint16_t)index;
+  }
+  pending++;
+  issued_total++;
+  sgx_spin_unlock(&counter_lock);
+
+  *ret_count = count;
+  return SGX_SUCCESS;
+}
+
+// Apply one record of the host's log, in any order, before `sign_counter_open`
+sgx_status_t sign_counter_replay(const uint8_t *sealed, uint32_t sealed_size) {
+  sgx_status_t status;
+  uint32_t i;
+
+  if (opened) {
+    return SGX_ERROR_INVALID_STATE;
+  }
+
+  // Records written before the cached key are still `sgx_seal_data` blobs
+  const int legacy = !seal_key_is_sealed(sealed, sealed_size);
+  uint32_t plain_size;
+
+  if (legacy) {
+    if (sealed_size < sizeof(sgx_sealed_data_t)) {
+      return SGX_ERROR_INVALID_PARAMETER;
+    }
+    plain_size = sgx_get_encrypt_txt_len((const sgx_sealed_data_t*)sealed);
+  } else {
+    plain_size = sealed_size - sizeof(seal_key_header_t);
+  }
+  if (plain_size < sizeof(wal_record_header_t) || plain_size > sealed_size) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  uint8_t *record = (uint8_t*)scratch_alloc(plain_size);
+  if (record == NULL) {
+    return SGX_ERROR_OUT_OF_MEMORY;
+  }
+
+  if (legacy) {
+    status = sgx_unseal_data((const sgx_sealed_data_t*)sealed, NULL, NULL, record, &plain_size);
+  } else {
+    status = seal_key_unseal(NULL, 0, sealed, sealed_size, record, &plain_size);
+  }
+  if (status) {
+    scratch_free(record);
+    return status;
+  }
+
+  const wal_record_header_t *header = (const wal_record_header_t*)record;
+  const wal_record_entry_t *entries = (const wal_record_entry_t*)(record + sizeof(wal_record_header_t));
+
+  if (header->magic != WAL_RECORD_MAGIC ||
+      header->num_entries > SIGN_COUNTER_MAX_ACTIVE + SIGN_COUNTER_WRITE_BACK_MAX ||
+      plain_size != sizeof(wal_record_header_t) + header->num_entries * sizeof(wal_record_entry_t)) {
+    scratch_free(record);
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  // Counters only move forward, whatever order the records come in.
+  // The log may name more credentials than there are slots, the rest
+  // wait in `evicted` and past that are written back to their records
+  for (i = 0; i < header->num_entries && !status; i++) {
+    sgx_spin_lock(&counter_lock);
+    int32_t index = slot_find_locked(entries[i].id);
+    if (index < 0 && evicted_find_locked(entries[i].id) < 0) {
+      index = slot_insert_locked(entries[i].id, entries[i].value);
+    } else if (index >= 0 && entries[i].value > slots[index].value) {
+      slots[index].value = entries[i].value;
+    }
+    const int kept = index >= 0 || evicted_put_locked(entries[i].id, entries[i].value, 0);
+    sgx_spin_unlock(&counter_lock);
+
+    if (!kept) {
+      cred_counter_t counter;
+
+      memcpy(counter.id, entries[i].id, sizeof(counter.id));
+      counter.counter = entries[i].value;
+      status = cred_db_set_counters(&counter, 1, header->epoch);
+    }
+  }
+  if (header->epoch > epoch) {
+    epoch = header->epoch;
+  }
+
+  if (!replayed || header->seq > replay_seq) {
+    replay_seq = header->seq;
+    replay_clean = (header->flags & WAL_RECORD_CLEAN) != 0;
+  }
+  replayed = 1;
+
+  scratch_free(record);
+  return status;
+}
+
+// Finish recovery and start issuing counts. Unless the log ended with a
+// clean shutdown, values issued after its last record may be lost, so
+// every counter jumps past them. The result is written as a snapshot
+sgx_status_t sign_counter_open(void) {
+  sgx_status_t status;
+  uint32_t i;
+
+  sgx_thread_mutex_lock(&flush_mutex);
+  if (opened) {
+    sgx_thread_mutex_unlock(&flush_mutex);
+    return SGX_ERROR_INVALID_STATE;
+  }
+
+  // Counters only in their records jump through the epoch as they are loaded
+  if (replayed && !replay_clean) {
+    sgx_spin_lock(&counter_lock);
+    for (i = 0; i < SIGN_COUNTER_MAX_ACTIVE; i++) {
+      if (slots[i].used) {
+        slots[i].value = sign_counter_rebase(slots[i].value, 0, SIGN_COUNTER_RECOVERY_JUMP);
+      }
+    }
+    for (i = 0; i < num_evicted; i++) {
+      evicted[i].value = sign_counter_rebase(evicted[i].value, 0, SIGN_COUNTER_RECOVERY_JUMP);
+    }
+    sgx_spin_unlock(&counter_lock);
+    __atomic_store_n(&epoch, sign_counter_rebase(epoch, 0, SIGN_COUNTER_RECOVERY_JUMP), __ATOMIC_RELEASE);
+  }
+  wal_seq = replay_seq;
+  completed_seq = replay_seq;
+  durable_seq = replay_seq;
+  durable_total = 0;
+  issued_total = 0;
+  awaiting_snapshot = 0;
+
+  status = flush_locked(WAL_RECORD_SNAPSHOT);
+  if (!status) {
+    // Nothing is issued before the jumped counters are on disk
+    status = wait_durable(wal_seq);
+  }
+  if (!status) {
+    opened = 1;
+  }
+  sgx_thread_mutex_unlock(&flush_mutex);
+
+  return status;
+}
+
+// Group commit of whatever is pending, called by the host every few ms,
+// then write back the evicted counters. Both are off the signing path
+sgx_status_t sign_counter_flush(void) {
+  sgx_status_t status = SGX_SUCCESS;
+
+  if (!opened) {
+    return SGX_ERROR_INVALID_STATE;
+  }
+
+  sgx_thread_mutex_lock(&flush_mutex);
+  if (__atomic_load_n(&pending, __ATOMIC_RELAXED) || need_snapshot) {
+    status = flush_locked(0);
+  }
+  sgx_thread_mutex_unlock(&flush_mutex);
+
+  if (!status && __atomic_load_n(&num_evicted, __ATOMIC_RELAXED)) {
+    status = write_back_evicted();
+  }
+
+  return status;
+}
+
+// Write the final record at shutdown, after which no more counts are issued
+sgx_status_t sign_counter_close(void) {
+  sgx_status_t status;
+
+  if (!opened) {
+    return SGX_ERROR_INVALID_STATE;
+  }
+
+  sgx_thread_mutex_lock(&flush_mutex);
+  sgx_spin_lock(&counter_lock);
+  opened = 0;
+  sgx_spin_unlock(&counter_lock);
+
+  // Release updates waiting for the disk, they fail now
+  sgx_thread_mutex_lock(&durable_mutex);
+  sgx_thread_cond_broadcast(&durable_cond);
+  sgx_thread_mutex_unlock(&durable_mutex);
+
+  status = flush_locked(WAL_RECORD_CLEAN);
+  if (!status) {
+    status = wait_durable(wal_seq);
+  }
+  sgx_thread_mutex_unlock(&flush_mutex);
+
+  return status;
+}
@@ -0,0 +1,69 @@
+/*
+ * sign_counter.h - Per-credential signature counters.
+ *
+ * Every credential has a counter of its own, stored in its sealed record
+ * in the credential database (cred_db.h). The counters are the only
+ * source of the signCount in authenticatorData; the host never supplies
+ * one.
+ *
+ * Rewriting a page for every signature would cost two syncs, so the
+ * counters of the SIGN_COUNTER_MAX_ACTIVE most recently used credentials
+ * are kept in enclave memory instead. A counter is loaded from its
+ * record when its credential is first used. When it is evicted to make
+ * room for another one, it waits with up to SIGN_COUNTER_WRITE_BACK_MAX
+ * others until `sign_counter_flush` writes them back to their records
+ * in one batch. A signature only waits for a page to be rewritten when
+ * that many are already waiting.
+ *
+ * The counters in memory are persisted as sealed records in a
+ * write-ahead log kept by the host. Updates are group committed: a
+ * record with every counter changed since the last one is handed to the
+ * host once SIGN_COUNTER_GROUP_COMMIT updates are pending, or earlier
+ * when the host's timer calls `sign_counter_flush`. The host queues the record
+ * and returns at once, then reports it through `sign_counter_persisted`
+ * when it is on disk. A new update waits while SIGN_COUNTER_RECOVERY_JUMP
+ * issued values are not yet covered by a durable record, so after a
+ * crash moving every counter that far forward, never back, is enough.
+ * Counters in the log are moved directly. Counters that are only in the
+ * database are moved through the epoch, which is the sum of all jumps so
+ * far and is carried by every log record. A record stores its counter
+ * together with the epoch it was written at, and the counter moves
+ * forward by the difference when it is loaded.
+ */
+
+#ifndef _SIGN_COUNTER_H_
+#define _SIGN_COUNTER_H_
+
+#include <stdint.h>
+
+#include "sgx_error.h"
+#include "webauthn_defs.h"
+
+#define SIGN_COUNTER_MAX_ACTIVE      1024  // counters in memory, the rest are in their records
+#define SIGN_COUNTER_WRITE_BACK_MAX  256   // evicted counters waiting to be written back, logged meanwhile
+#define SIGN_COUNTER_GROUP_COMMIT    64    // pending updates that force a flush
+#define SIGN_COUNTER_RECOVERY_JUMP   (2 * SIGN_COUNTER_GROUP_COMMIT)
+#define SIGN_COUNTER_MAX_INFLIGHT    16    // records handed to the host and not yet reported
+#ifndef SIGN_COUNTER_WAL_COMPACT
+#define SIGN_COUNTER_WAL_COMPACT     1024  // appended records before the log is rewritten as one snapshot
+#endif
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Increment the counter of the credential `id` and return its new value.
+// Fails until the counters have been opened with `sign_counter_open`
+sgx_status_t sign_counter_next(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE], uint32_t *ret_count);
+
+// The epoch new records store their counters with
+uint32_t sign_counter_epoch(void);
+
+// A counter stored at epoch `from` as of epoch `to`, never lower
+uint32_t sign_counter_rebase(uint32_t counter, uint32_t from, uint32_t to);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_SIGN_COUNTER_H_ */
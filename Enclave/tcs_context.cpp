@@ -0,0 +1,75 @@
+/*
+ * tcs_context.cpp - Per-TCS enclave state.
+ */
+
+#include <stdint.h>
+
+#include "tcs_context.h"
+
+#include "sgx_thread.h"
+
+static tcs_context_t contexts[TCS_CONTEXT_MAX];
+static volatile sgx_thread_t owners[TCS_CONTEXT_MAX];
+
+// Reset to NULL on every ECALL, see tcs_context.h
+static __thread tcs_context_t *current = NULL;
+
+tcs_context_t *tcs_context_get(void) {
+  if (current != NULL) {
+    return current;
+  }
+
+  const sgx_thread_t self = sgx_thread_self();
+  int i;
+
+  for (i = 0; i < TCS_CONTEXT_MAX && current == NULL; i++) {
+    if (owners[i] == self) {
+      current = &contexts[i];
+    }
+  }
+
+  for (i = 0; i < TCS_CONTEXT_MAX && current == NULL; i++) {
+    if (owners[i] == 0 &&
+        __sync_bool_compare_and_swap(&owners[i], (sgx_thread_t)0, self)) {
+      current = &contexts[i];
+    }
+  }
+
+  return current;
+}
+
+const tcs_context_t *tcs_context_at(uint32_t index) {
+  if (index >= TCS_CONTEXT_MAX || owners[index] == 0) {
+    return NULL;
+  }
+  return &contexts[index];
+}
+
+void tcs_read_begin(tcs_context_t *context) {
+  __atomic_store_n(&context->read_seq, context->read_seq + 1, __ATOMIC_RELAXED);
+
+  // Seen by writers before anything the section reads
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void tcs_read_end(tcs_context_t *context) {
+  __atomic_store_n(&context->read_seq, context->read_seq + 1, __ATOMIC_RELEASE);
+}
+
+void tcs_read_synchronize(void) {
+  uint32_t i;
+
+  // Whatever the writer unpublished is seen by sections that begin from here on
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  for (i = 0; i < TCS_CONTEXT_MAX; i++) {
+    if (__atomic_load_n(&owners[i], __ATOMIC_ACQUIRE) == 0) {
+      continue;
+    }
+
+    const uint64_t seq = __atomic_load_n(&contexts[i].read_seq, __ATOMIC_ACQUIRE);
+    while ((seq & 1) && __atomic_load_n(&contexts[i].read_seq, __ATOMIC_ACQUIRE) == seq) {
+      __builtin_ia32_pause();
+    }
+  }
+}
@@ -0,0 +1,74 @@
+/*
+ * tcs_context.h - Per-TCS enclave state.
+ *
+ * Everything a thread keeps for itself between requests lives in one
+ * context per TCS: its DRBG, its scratch arena and its shard of the
+ * counters that every request bumps. Contexts are cache-line aligned so
+ * threads never write to a line another thread uses, and counters are
+ * only summed up when they are read.
+ *
+ * A thread claims a context the first time it needs one and finds it
+ * again by its `sgx_thread_self` handle, which is bound to the TCS. The
+ * lookup is cached in thread-local storage, which with `TCSPolicy` 1 the
+ * SDK resets at the start of every ECALL, so it is done once per ECALL.
+ *
+ * Contexts also mark lock-free read sections, for shared data whose
+ * writers free memory that readers may still be using. A reader brackets
+ * its reads with `tcs_read_begin` and `tcs_read_end`, which only store to
+ * its own context. A writer unpublishes the memory, then waits in
+ * `tcs_read_synchronize` for the sections already under way to end
+ * before it frees it.
+ */
+
+#ifndef _TCS_CONTEXT_H_
+#define _TCS_CONTEXT_H_
+
+#include <stdint.h>
+
+#include "drbg.h"
+#include "scratch.h"
+
+// Number of contexts, must be at least `TCSNum` in Enclave.config.xml.
+// Threads beyond that get none and fall back to shared state
+#define TCS_CONTEXT_MAX 16
+
+// Counters bumped on every request, summed up by the ECALLs that report them
+typedef struct {
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t scratch_allocations;
+  uint64_t scratch_fallbacks;
+} tcs_stats_t;
+
+typedef struct {
+  drbg_state_t drbg;
+  scratch_arena_t scratch;
+  tcs_stats_t stats;
+  uint64_t read_seq;  // odd inside a read section
+} __attribute__((aligned(64))) tcs_context_t;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// The context of the calling thread, claimed on first use. NULL once
+// TCS_CONTEXT_MAX threads have claimed one
+tcs_context_t *tcs_context_get(void);
+
+// Context `index` if a thread has claimed it, else NULL. Only for
+// reading counters, the owner may be writing to it at the same time
+const tcs_context_t *tcs_context_at(uint32_t index);
+
+// A read section of the thread owning `context`. Sections do not nest,
+// and make no OCALLs so that writers never wait on the host
+void tcs_read_begin(tcs_context_t *context);
+void tcs_read_end(tcs_context_t *context);
+
+// Wait until every read section that began before the call has ended
+void tcs_read_synchronize(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_TCS_CONTEXT_H_ */
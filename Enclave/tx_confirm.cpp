@@ -0,0 +1,89 @@
+/*
+ * tx_confirm.cpp - Transactions waiting for the user's decision.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "tx_confirm.h"
+
+#include "sgx_spinlock.h"
+#include "sgx_trts.h"
+
+typedef struct {
+  uint32_t id;  // handed to the host, 0 while the slot is free
+  tx_confirm_request_t request;
+} tx_pending_t;
+
+// Under `pending_lock`
+static tx_pending_t pending[WEBAUTHN_TX_PENDING_MAX];
+static uint32_t pending_generation = 0;
+static sgx_cmac_128bit_key_t mac_key;
+static int mac_key_ready = 0;
+static sgx_spinlock_t pending_lock = SGX_SPINLOCK_INITIALIZER;
+
+// Same scheme as the stream ids, see client_data_stream.cpp
+#define TX_ID(generation, slot) (((generation) << 8) | ((slot) + 1))
+#define TX_SLOT(id)             (((id) & 0xff) - 1)
+
+// MAC of `id` and the data that will be signed under it
+static sgx_status_t handle_mac(uint32_t id, const tx_confirm_request_t *request, uint8_t mac[16]) {
+  uint8_t msg[sizeof(id) + WEBAUTHN_SIGNED_DATA_SIZE];
+
+  memcpy(msg, &id, sizeof(id));
+  memcpy(msg + sizeof(id), request->data, WEBAUTHN_SIGNED_DATA_SIZE);
+
+  return sgx_rijndael128_cmac_msg(&mac_key, msg, sizeof(msg), (sgx_cmac_128bit_tag_t*)mac);
+}
+
+sgx_status_t tx_confirm_park(const tx_confirm_request_t *request, webauthn_tx_handle_t *ret_handle) {
+  sgx_status_t status = SGX_ERROR_BUSY;
+  uint32_t slot;
+
+  sgx_spin_lock(&pending_lock);
+  if (!mac_key_ready) {
+    if (sgx_read_rand(mac_key, sizeof(mac_key)) != SGX_SUCCESS) {
+      sgx_spin_unlock(&pending_lock);
+      return SGX_ERROR_UNEXPECTED;
+    }
+    mac_key_ready = 1;
+  }
+
+  for (slot = 0; slot < WEBAUTHN_TX_PENDING_MAX; slot++) {
+    if (pending[slot].id == 0) {
+      pending_generation++;
+      ret_handle->id = TX_ID(pending_generation, slot);
+      status = handle_mac(ret_handle->id, request, ret_handle->mac);
+      if (!status) {
+        pending[slot].id = ret_handle->id;
+        pending[slot].request = *request;
+      }
+      break;
+    }
+  }
+  sgx_spin_unlock(&pending_lock);
+
+  return status;
+}
+
+sgx_status_t tx_confirm_take(const webauthn_tx_handle_t *handle, tx_confirm_request_t *ret_request) {
+  const uint32_t slot = TX_SLOT(handle->id);
+  uint8_t mac[16];
+  sgx_status_t status = SGX_ERROR_INVALID_PARAMETER;
+
+  if (slot >= WEBAUTHN_TX_PENDING_MAX) {
+    return SGX_ERROR_INVALID_PARAMETER;
+  }
+
+  sgx_spin_lock(&pending_lock);
+  tx_pending_t *entry = &pending[slot];
+  if (entry->id == handle->id && handle_mac(entry->id, &entry->request, mac) == SGX_SUCCESS &&
+      consttime_memequal(mac, handle->mac, sizeof(mac))) {
+    *ret_request = entry->request;
+    memset_s(entry, sizeof(*entry), 0, sizeof(*entry));
+    status = SGX_SUCCESS;
+  }
+  sgx_spin_unlock(&pending_lock);
+
+  return status;
+}
@@ -0,0 +1,50 @@
+/*
+ * tx_confirm.h - Transactions waiting for the user's decision.
+ *
+ * A txAuthSimple assertion is confirmed in two ECALLs. The first checks
+ * and parses the request, parks what is needed to sign it here and hands
+ * the host a handle. The second takes the handle with the user's decision
+ * and signs. No TCS is held while the user makes up their mind.
+ *
+ * A handle carries a MAC under a key that never leaves the enclave, so a
+ * pending transaction can only be completed by whoever began it, and only
+ * once: its slot is freed as soon as it is taken. The user may take as
+ * long as the host lets them, a pending transaction is never dropped
+ * behind their back: the host frees the slot of one it gives up on with
+ * `cancel_tx_confirmation`.
+ */
+
+#ifndef _TX_CONFIRM_H_
+#define _TX_CONFIRM_H_
+
+#include <stdint.h>
+
+#include "sgx_error.h"
+#include "sgx_tcrypto.h"
+#include "webauthn_defs.h"
+
+typedef struct {
+  uint8_t data[WEBAUTHN_SIGNED_DATA_SIZE];  // signed as is, unless `assertion`
+  int assertion;                            // the signature counter and flags are filled in on completion
+  uint8_t flags;
+  uint8_t credential_id[WEBAUTHN_CREDENTIAL_ID_SIZE];  // whose signature counter to count with
+  int device_key;                           // signed with the device credential, else `sk`
+  sgx_ec256_private_t sk;
+} tx_confirm_request_t;
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Park `request` until it is taken back with `ret_handle`. Fails with
+// SGX_ERROR_BUSY while WEBAUTHN_TX_PENDING_MAX transactions are pending
+sgx_status_t tx_confirm_park(const tx_confirm_request_t *request, webauthn_tx_handle_t *ret_handle);
+
+// The request `handle` names, which is no longer pending afterwards
+sgx_status_t tx_confirm_take(const webauthn_tx_handle_t *handle, tx_confirm_request_t *ret_request);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* !_TX_CONFIRM_H_ */
@@ -1203,6 +1203,201 @@ int uECC_compute_public_key(const uint8_t *private_key, uint8_t *public_key, uEC
 }
 
 
+/* -------- Fixed-base key generation -------- */
+
+/* Comb method for k * G. Bit i of each of the uECC_FIXED_BASE_TEETH slices of k, `spacing`
+   bits apart, index a table of the 2^teeth sums of their G * 2^(slice * spacing), so k * G
+   takes `spacing` doublings and additions instead of a ladder step per bit. Every entry has
+   c * G added for a random c, so a lookup never yields the point at infinity and the
+   additions are never doublings; `correction` takes the sum of those back off. */
+#define FIXED_BASE_ENTRIES (1 << uECC_FIXED_BASE_TEETH)
+
+static struct {
+    uECC_Curve curve;
+    bitcount_t spacing;
+    uECC_word_t points[FIXED_BASE_ENTRIES][uECC_MAX_WORDS * 2];
+    uECC_word_t correction[uECC_MAX_WORDS * 2];
+} g_fixed_base;
+
+/* (X1, Y1, Z1) => (X1, Y1, Z1) + (x2, y2). Z1 becomes 0 if both points have the same x. */
+static void EccPoint_add_affine(uECC_word_t * X1,
+                                uECC_word_t * Y1,
+                                uECC_word_t * Z1,
+                                const uECC_word_t * const point,
+                                uECC_Curve curve) {
+    uECC_word_t t1[uECC_MAX_WORDS];
+    uECC_word_t t2[uECC_MAX_WORDS];
+    uECC_word_t t3[uECC_MAX_WORDS];
+    wordcount_t num_words = curve->num_words;
+
+    uECC_vli_modSquare_fast(t1, Z1, curve);                  /* t1 = z1^2 */
+    uECC_vli_modMult_fast(t2, t1, Z1, curve);                /* t2 = z1^3 */
+    uECC_vli_modMult_fast(t1, t1, point, curve);             /* t1 = x2*z1^2 = U */
+    uECC_vli_modMult_fast(t2, t2, point + num_words, curve); /* t2 = y2*z1^3 = S */
+    uECC_vli_modSub(t1, t1, X1, curve->p, num_words);        /* t1 = U - x1 = H */
+    uECC_vli_modSub(t2, t2, Y1, curve->p, num_words);        /* t2 = S - y1 = R */
+    uECC_vli_modMult_fast(Z1, Z1, t1, curve);                /* z3 = z1*H */
+
+    uECC_vli_modSquare_fast(t3, t1, curve);                  /* t3 = H^2 */
+    uECC_vli_modMult_fast(t1, t1, t3, curve);                /* t1 = H^3 */
+    uECC_vli_modMult_fast(t3, t3, X1, curve);                /* t3 = x1*H^2 = V */
+    uECC_vli_modSquare_fast(X1, t2, curve);                  /* x1 = R^2 */
+    uECC_vli_modSub(X1, X1, t1, curve->p, num_words);        /* x1 = R^2 - H^3 */
+    uECC_vli_modSub(X1, X1, t3, curve->p, num_words);
+    uECC_vli_modSub(X1, X1, t3, curve->p, num_words);        /* x3 = R^2 - H^3 - 2V */
+
+    uECC_vli_modSub(t3, t3, X1, curve->p, num_words);        /* t3 = V - x3 */
+    uECC_vli_modMult_fast(t3, t3, t2, curve);                /* t3 = R*(V - x3) */
+    uECC_vli_modMult_fast(t1, t1, Y1, curve);                /* t1 = y1*H^3 */
+    uECC_vli_modSub(Y1, t3, t1, curve->p, num_words);        /* y3 = R*(V - x3) - y1*H^3 */
+}
+
+/* The table index of column `column` of the comb over k. */
+static unsigned fixed_base_index(const uECC_word_t *k, bitcount_t column, bitcount_t spacing) {
+    unsigned index = 0;
+    unsigned tooth;
+
+    for (tooth = 0; tooth < uECC_FIXED_BASE_TEETH; ++tooth) {
+        bitcount_t bit = column + (bitcount_t)tooth * spacing;
+        index |= (unsigned)((k[bit >> uECC_WORD_BITS_SHIFT] >> (bit & uECC_WORD_BITS_MASK)) & 1) << tooth;
+    }
+    return index;
+}
+
+/* Copy table entry `index` into point, reading every entry so the access pattern does not
+   depend on it. */
+static void fixed_base_select(uECC_word_t *point, unsigned index, wordcount_t num_words) {
+    unsigned j;
+    wordcount_t i;
+
+    uECC_vli_clear(point, num_words * 2);
+    for (j = 0; j < FIXED_BASE_ENTRIES; ++j) {
+        uECC_word_t diff = (uECC_word_t)(j ^ index);
+        uECC_word_t mask = ((diff | (0 - diff)) >> (uECC_WORD_BITS - 1)) - 1; /* all ones if j == index */
+        for (i = 0; i < num_words * 2; ++i) {
+            point[i] |= g_fixed_base.points[j][i] & mask;
+        }
+    }
+}
+
+int uECC_fixed_base_init(uECC_Curve curve) {
+    uECC_word_t c[uECC_MAX_WORDS];
+    uECC_word_t s[uECC_MAX_WORDS];
+    uECC_word_t t[uECC_MAX_WORDS];
+    wordcount_t num_n_words = BITS_TO_WORDS(curve->num_n_bits);
+    bitcount_t spacing =
+        (curve->num_n_bits + uECC_FIXED_BASE_TEETH - 1) / uECC_FIXED_BASE_TEETH;
+    unsigned j;
+    unsigned tooth;
+    int ok = 0;
+
+    g_fixed_base.curve = 0;
+    g_fixed_base.spacing = spacing;
+
+    if (!uECC_generate_random_int(c, curve->n, num_n_words)) {
+        return 0;
+    }
+
+    /* points[j] = (c + sum of 2^(tooth * spacing) for the teeth set in j) * G */
+    for (j = 0; j < FIXED_BASE_ENTRIES; ++j) {
+        uECC_vli_set(s, c, num_n_words);
+        for (tooth = 0; tooth < uECC_FIXED_BASE_TEETH; ++tooth) {
+            bitcount_t bit = (bitcount_t)tooth * spacing;
+            if (!(j & (1u << tooth))) {
+                continue;
+            }
+            uECC_vli_clear(t, num_n_words);
+            t[bit >> uECC_WORD_BITS_SHIFT] = (uECC_word_t)1 << (bit & uECC_WORD_BITS_MASK);
+            uECC_vli_modAdd(s, s, t, curve->n, num_n_words);
+        }
+        if (!EccPoint_compute_public_key(g_fixed_base.points[j], s, curve)) {
+            goto done;
+        }
+    }
+
+    /* Each of the `spacing` columns added c * G once more than the last doubled it:
+       (2^spacing - 1) * c * G in all. */
+    uECC_vli_clear(t, num_n_words);
+    t[spacing >> uECC_WORD_BITS_SHIFT] = (uECC_word_t)1 << (spacing & uECC_WORD_BITS_MASK);
+    uECC_vli_clear(s, num_n_words);
+    s[0] = 1;
+    uECC_vli_sub(t, t, s, num_n_words);                    /* 2^spacing - 1 */
+    uECC_vli_modMult(s, t, c, curve->n, num_n_words);
+    uECC_vli_clear(t, num_n_words);
+    uECC_vli_modSub(s, t, s, curve->n, num_n_words);       /* -(2^spacing - 1) * c */
+    if (!EccPoint_compute_public_key(g_fixed_base.correction, s, curve)) {
+        goto done;
+    }
+
+    g_fixed_base.curve = curve;
+    ok = 1;
+
+done:
+    uECC_vli_clear(c, num_n_words);
+    uECC_vli_clear(s, num_n_words);
+    return ok;
+}
+
+int uECC_make_key_fixed_base(uint8_t *public_key, uint8_t *private_key, uECC_Curve curve) {
+    /* Zero-extended, the last comb column may run past num_n_bits */
+    uECC_word_t _private[uECC_MAX_WORDS * 2];
+    uECC_word_t _public[uECC_MAX_WORDS * 2];
+    uECC_word_t point[uECC_MAX_WORDS * 2];
+    uECC_word_t Z[uECC_MAX_WORDS];
+    wordcount_t num_words = curve->num_words;
+    wordcount_t num_n_words = BITS_TO_WORDS(curve->num_n_bits);
+    bitcount_t spacing = g_fixed_base.spacing;
+    bitcount_t column;
+    uECC_word_t tries;
+    int ok = 0;
+
+    if (g_fixed_base.curve != curve) {
+        return 0;
+    }
+
+    for (tries = 0; tries < uECC_RNG_MAX_TRIES && !ok; ++tries) {
+        uECC_vli_clear(_private, uECC_MAX_WORDS * 2);
+        if (!uECC_generate_random_int(_private, curve->n, num_n_words) ||
+                !uECC_generate_random_int(Z, curve->p, num_words)) {
+            break;
+        }
+
+        /* Start from a random Z so the inversion at the end reveals nothing about k. */
+        fixed_base_select(point, fixed_base_index(_private, spacing - 1, spacing), num_words);
+        uECC_vli_set(_public, point, num_words);
+        uECC_vli_set(_public + num_words, point + num_words, num_words);
+        apply_z(_public, _public + num_words, Z, curve);
+
+        for (column = spacing - 1; column > 0; --column) {
+            curve->double_jacobian(_public, _public + num_words, Z, curve);
+            fixed_base_select(point, fixed_base_index(_private, column - 1, spacing), num_words);
+            EccPoint_add_affine(_public, _public + num_words, Z, point, curve);
+        }
+        EccPoint_add_affine(_public, _public + num_words, Z, g_fixed_base.correction, curve);
+
+        uECC_vli_modInv(Z, Z, curve->p, num_words);
+        apply_z(_public, _public + num_words, Z, curve);
+
+        /* Z was 0, an intermediate sum hit a table entry or its negation: draw another k */
+        ok = uECC_valid_point(_public, curve);
+    }
+
+    if (ok) {
+#if uECC_VLI_NATIVE_LITTLE_ENDIAN
+        bcopy(private_key, (uint8_t *)_private, BITS_TO_BYTES(curve->num_n_bits));
+        bcopy(public_key, (uint8_t *)_public, curve->num_bytes * 2);
+#else
+        uECC_vli_nativeToBytes(private_key, BITS_TO_BYTES(curve->num_n_bits), _private);
+        uECC_vli_nativeToBytes(public_key, curve->num_bytes, _public);
+        uECC_vli_nativeToBytes(
+            public_key + curve->num_bytes, curve->num_bytes, _public + num_words);
+#endif
+    }
+    uECC_vli_clear(_private, uECC_MAX_WORDS * 2);
+    uECC_vli_clear(point, num_words * 2);
+    return ok;
+}
+
 /* -------- ECDSA code -------- */
 
 static void bits2int(uECC_word_t *native,
@@ -1346,11 +1541,130 @@ int uECC_sign(const uint8_t *private_key,
     return 0;
 }
 
+int uECC_sign_precompute(uint8_t *k_inverse, uint8_t *r, uECC_Curve curve) {
+    uECC_word_t k[uECC_MAX_WORDS];
+    uECC_word_t tmp[uECC_MAX_WORDS];
+    uECC_word_t s[uECC_MAX_WORDS];
+    uECC_word_t *k2[2] = {tmp, s};
+    uECC_word_t p[uECC_MAX_WORDS * 2];
+    uECC_word_t carry;
+    uECC_word_t tries;
+    wordcount_t num_words = curve->num_words;
+    wordcount_t num_n_words = BITS_TO_WORDS(curve->num_n_bits);
+    bitcount_t num_n_bits = curve->num_n_bits;
+
+    for (tries = 0; tries < uECC_RNG_MAX_TRIES; ++tries) {
+        if (!uECC_generate_random_int(k, curve->n, num_n_words)) {
+            return 0;
+        }
+
+        /* Always use a random initial Z; the RNG is required here anyway. */
+        carry = regularize_k(k, tmp, s, curve);
+        if (!uECC_generate_random_int(k2[carry], curve->p, num_words)) {
+            return 0;
+        }
+        EccPoint_mult(p, curve->G, k2[!carry], k2[carry], num_n_bits + 1, curve);
+
+        /* r = x1 (mod n) */
+        uECC_vli_clear(s, num_n_words);
+        uECC_vli_set(s, p, num_words);
+        if (uECC_vli_cmp_unsafe(curve->n, s, num_n_words) != 1) {
+            uECC_vli_sub(s, s, curve->n, num_n_words);
+        }
+        if (uECC_vli_isZero(s, num_n_words)) {
+            continue;
+        }
+
+        /* Prevent side channel analysis of uECC_vli_modInv() to determine
+           bits of k by premultiplying by a random number */
+        if (!uECC_generate_random_int(tmp, curve->n, num_n_words)) {
+            return 0;
+        }
+        uECC_vli_modMult(k, k, tmp, curve->n, num_n_words); /* k' = rand * k */
+        uECC_vli_modInv(k, k, curve->n, num_n_words);       /* k = 1 / k' */
+        uECC_vli_modMult(k, k, tmp, curve->n, num_n_words); /* k = 1 / k */
+
+#if uECC_VLI_NATIVE_LITTLE_ENDIAN
+        bcopy(k_inverse, (uint8_t *) k, BITS_TO_BYTES(num_n_bits));
+        bcopy(r, (uint8_t *) s, curve->num_bytes);
+#else
+        uECC_vli_nativeToBytes(k_inverse, BITS_TO_BYTES(num_n_bits), k);
+        uECC_vli_nativeToBytes(r, curve->num_bytes, s);
+#endif
+        uECC_vli_clear(k, num_n_words);
+        return 1;
+    }
+    return 0;
+}
+
+int uECC_sign_with_precomputed(const uint8_t *private_key,
+                               const uint8_t *message_hash,
+                               unsigned hash_size,
+                               const uint8_t *k_inverse,
+                               const uint8_t *r,
+                               uint8_t *signature,
+                               uECC_Curve curve) {
+    uECC_word_t k[uECC_MAX_WORDS];
+    uECC_word_t tmp[uECC_MAX_WORDS];
+    uECC_word_t s[uECC_MAX_WORDS];
+    wordcount_t num_bytes = curve->num_bytes;
+    wordcount_t num_n_words = BITS_TO_WORDS(curve->num_n_bits);
+    wordcount_t i;
+
+    uECC_vli_clear(k, num_n_words);
+    uECC_vli_clear(s, num_n_words);
+#if uECC_VLI_NATIVE_LITTLE_ENDIAN
+    bcopy((uint8_t *) k, k_inverse, BITS_TO_BYTES(curve->num_n_bits));
+    bcopy((uint8_t *) s, r, num_bytes);
+#else
+    uECC_vli_bytesToNative(k, k_inverse, BITS_TO_BYTES(curve->num_n_bits));
+    uECC_vli_bytesToNative(s, r, num_bytes);
+#endif
+
+    /* Make sure 0 < k^-1 < curve_n and 0 < r < curve_n */
+    if (uECC_vli_isZero(k, num_n_words) || uECC_vli_cmp(curve->n, k, num_n_words) != 1 ||
+            uECC_vli_isZero(s, num_n_words) ||
+            uECC_vli_cmp_unsafe(curve->n, s, num_n_words) != 1) {
+        return 0;
+    }
+
+    for (i = 0; i < num_bytes; ++i) {
+        signature[i] = r[i]; /* store r */
+    }
+
+#if uECC_VLI_NATIVE_LITTLE_ENDIAN
+    bcopy((uint8_t *) tmp, private_key, BITS_TO_BYTES(curve->num_n_bits));
+#else
+    uECC_vli_bytesToNative(tmp, private_key, BITS_TO_BYTES(curve->num_n_bits)); /* tmp = d */
+#endif
+
+    uECC_vli_modMult(s, tmp, s, curve->n, num_n_words); /* s = r*d */
+
+    bits2int(tmp, message_hash, hash_size, curve);
+    uECC_vli_modAdd(s, tmp, s, curve->n, num_n_words); /* s = e + r*d */
+    uECC_vli_modMult(s, s, k, curve->n, num_n_words);  /* s = (e + r*d) / k */
+    uECC_vli_clear(k, num_n_words);
+    if (uECC_vli_isZero(s, num_n_words) ||
+            uECC_vli_numBits(s, num_n_words) > (bitcount_t)num_bytes * 8) {
+        return 0;
+    }
+#if uECC_VLI_NATIVE_LITTLE_ENDIAN
+    bcopy((uint8_t *) signature + num_bytes, (uint8_t *) s, num_bytes);
+#else
+    uECC_vli_nativeToBytes(signature + num_bytes, num_bytes, s);
+#endif
+    return 1;
+}
+
 /* Compute an HMAC using K as a key (as in RFC 6979). Note that K is always
    the same size as the hash result size. */
 static void HMAC_init(const uECC_HashContext *hash_context, const uint8_t *K) {
     uint8_t *pad = hash_context->tmp + 2 * hash_context->result_size;
     unsigned i;
+    if (hash_context->init_hmac_pad) {
+        hash_context->init_hmac_pad(hash_context, K, 0x36);
+        return;
+    }
     for (i = 0; i < hash_context->result_size; ++i)
         pad[i] = K[i] ^ 0x36;
     for (; i < hash_context->block_size; ++i)
@@ -1371,15 +1685,25 @@ static void HMAC_finish(const uECC_HashContext *hash_context,
                         uint8_t *result) {
     uint8_t *pad = hash_context->tmp + 2 * hash_context->result_size;
     unsigned i;
-    for (i = 0; i < hash_context->result_size; ++i)
-        pad[i] = K[i] ^ 0x5c;
-    for (; i < hash_context->block_size; ++i)
-        pad[i] = 0x5c;
 
-    hash_context->finish_hash(hash_context, result);
+    if (hash_context->init_hmac_pad) {
+        /* result may alias K, so keep a copy of K in the otherwise unused pad buffer. */
+        for (i = 0; i < hash_context->result_size; ++i)
+            pad[i] = K[i];
 
-    hash_context->init_hash(hash_context);
-    hash_context->update_hash(hash_context, pad, hash_context->block_size);
+        hash_context->finish_hash(hash_context, result);
+        hash_context->init_hmac_pad(hash_context, pad, 0x5c);
+    } else {
+        for (i = 0; i < hash_context->result_size; ++i)
+            pad[i] = K[i] ^ 0x5c;
+        for (; i < hash_context->block_size; ++i)
+            pad[i] = 0x5c;
+
+        hash_context->finish_hash(hash_context, result);
+
+        hash_context->init_hash(hash_context);
+        hash_context->update_hash(hash_context, pad, hash_context->block_size);
+    }
     hash_context->update_hash(hash_context, result, hash_context->result_size);
     hash_context->finish_hash(hash_context, result);
 }
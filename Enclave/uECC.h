@@ -75,6 +75,12 @@ the same endianness. */
     #define uECC_SUPPORT_COMPRESSED_POINT 1
 #endif
 
+/* Teeth of the comb used by uECC_make_key_fixed_base(). Its table holds 2^teeth points, each
+   2 * the curve size long, and a key costs about num_n_bits / teeth doublings and additions. */
+#ifndef uECC_FIXED_BASE_TEETH
+    #define uECC_FIXED_BASE_TEETH 5
+#endif
+
 struct uECC_Curve_t;
 typedef const struct uECC_Curve_t * uECC_Curve;
 
@@ -240,6 +246,31 @@ Returns 1 if the key was computed successfully, 0 if an error occurred.
 */
 int uECC_compute_public_key(const uint8_t *private_key, uint8_t *public_key, uECC_Curve curve);
 
+/* uECC_fixed_base_init() function.
+Build the table of multiples of the curve's generator used by uECC_make_key_fixed_base(). The
+table is randomized, so a correctly functioning RNG function must be set (using uECC_set_rng())
+first. There is one table: it is built for one curve at a time, and must not be built again
+while keys are being made from it.
+
+Returns 1 if the table was built successfully, 0 if an error occurred.
+*/
+int uECC_fixed_base_init(uECC_Curve curve);
+
+/* uECC_make_key_fixed_base() function.
+Create a public/private key pair, like uECC_make_key(), with a comb over the table built by
+uECC_fixed_base_init() instead of a point multiplication ladder: several times fewer field
+operations per key. The table is read in full for every lookup, so as with the ladder the
+memory access pattern does not depend on the private key.
+
+Outputs:
+    public_key  - Will be filled in with the public key, as for uECC_make_key().
+    private_key - Will be filled in with the private key, as for uECC_make_key().
+
+Returns 1 if the key pair was generated successfully, 0 if an error occurred or the table has
+not been built for this curve.
+*/
+int uECC_make_key_fixed_base(uint8_t *public_key, uint8_t *private_key, uECC_Curve curve);
+
 /* uECC_sign() function.
 Generate an ECDSA signature for a given hash value.
 
@@ -263,6 +294,54 @@ int uECC_sign(const uint8_t *private_key,
               uint8_t *signature,
               uECC_Curve curve);
 
+/* uECC_sign_precompute() function.
+Perform the message-independent part of an ECDSA signature ahead of time. A random nonce k is
+generated and the values r = (k * G).x mod n and k^-1 mod n are computed. These are exactly the
+expensive parts of uECC_sign(); the remaining work needs only two scalar multiplications mod n.
+
+A correctly functioning RNG function must be set (using uECC_set_rng()) before calling
+uECC_sign_precompute().
+
+IMPORTANT: Each (k_inverse, r) pair must be passed to uECC_sign_with_precomputed() at most once
+and then erased. Signing two different messages with the same pair reveals the private key.
+
+Outputs:
+    k_inverse - Will be filled in with k^-1 mod n. Must be as long as the curve order; for
+                example, if the curve is secp256r1, k_inverse must be 32 bytes long.
+    r         - Will be filled in with the r value of the signature. Must be curve size bytes
+                long; for example, if the curve is secp256r1, r must be 32 bytes long.
+
+Returns 1 if the values were generated successfully, 0 if an error occurred.
+*/
+int uECC_sign_precompute(uint8_t *k_inverse, uint8_t *r, uECC_Curve curve);
+
+/* uECC_sign_with_precomputed() function.
+Generate an ECDSA signature for a given hash value using values previously generated by
+uECC_sign_precompute(). The resulting signature is identical in format to one produced by
+uECC_sign().
+
+Inputs:
+    private_key  - Your private key.
+    message_hash - The hash of the message to sign.
+    hash_size    - The size of message_hash in bytes.
+    k_inverse    - The k^-1 value from uECC_sign_precompute().
+    r            - The r value from uECC_sign_precompute().
+
+Outputs:
+    signature - Will be filled in with the signature value. Must be at least 2 * curve size long.
+                For example, if the curve is secp256r1, signature must be 64 bytes long.
+
+Returns 1 if the signature generated successfully, 0 if an error occurred. On error the
+precomputed values must still be discarded; the caller may fall back to uECC_sign().
+*/
+int uECC_sign_with_precomputed(const uint8_t *private_key,
+                               const uint8_t *message_hash,
+                               unsigned hash_size,
+                               const uint8_t *k_inverse,
+                               const uint8_t *r,
+                               uint8_t *signature,
+                               uECC_Curve curve);
+
 /* uECC_HashContext structure.
 This is used to pass in an arbitrary hash function to uECC_sign_deterministic().
 The structure will be used for multiple hash computations; each time a new hash
@@ -310,6 +389,13 @@ typedef struct uECC_HashContext {
     unsigned block_size; /* Hash function block size in bytes, eg 64 for SHA-256. */
     unsigned result_size; /* Hash function result size in bytes, eg 32 for SHA-256. */
     uint8_t *tmp; /* Must point to a buffer of at least (2 * result_size + block_size) bytes. */
+    /* Optional, may be 0. When set, each HMAC calls this instead of hashing the padded key
+       itself, so the hash implementation can cache the resulting state per key. It must leave
+       the context as if init_hash() had been called, followed by update_hash() with K (which is
+       result_size bytes long) zero-extended to block_size bytes and XORed with pad_byte. */
+    void (*init_hmac_pad)(const struct uECC_HashContext *context,
+                          const uint8_t *K,
+                          uint8_t pad_byte);
 } uECC_HashContext;
 
 /* uECC_sign_deterministic() function.
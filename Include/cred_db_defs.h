@@ -0,0 +1,138 @@
+/*
+ * cred_db_defs.h - On-disk format of the credential database, shared
+ * between the app and the enclave.
+ *
+ * The file is a fixed header, a journal page, two open-addressing
+ * indexes and pages of records:
+ *
+ *   [cred_db_header_t, CRED_DB_HEADER_SIZE bytes]
+ *   [journal, CRED_DB_PAGE_SIZE bytes]
+ *   [cred_db_slot_t x index_slots]
+ *   [cred_db_rp_slot_t x index_slots]
+ *   [page, CRED_DB_PAGE_SIZE bytes]...
+ *
+ * A record is referred to by the offset of its page plus its index in
+ * the page. The index maps the first 8 bytes of a credential ID (random,
+ * so already a good hash) to its record, probing linearly. The rp index
+ * maps the first 8 bytes of an rpIdHash to a doubly linked list of that
+ * relying party's records, threaded through their pages, so the
+ * credentials of one relying party are found without a scan.
+ *
+ * A page holds up to CRED_DB_PAGE_RECORDS records as arrays, one per
+ * field: the host's fields and the credential IDs in the clear, then one
+ * cred_db_page_secrets_t sealed by the enclave's seal_key module, which
+ * authenticates the IDs along with it. The host can reorder or drop pages
+ * but never forge or swap a record, and the seal header is paid once per
+ * page instead of once per record. The host maps the file and the
+ * enclave reads it in place, unsealing a page the first time one of its
+ * credentials is used.
+ *
+ * Pages are rewritten as records are added to or removed from them, and
+ * as the enclave writes back a credential's signature counter. The
+ * new image goes to the journal page first, and is copied over the page
+ * again when the file is opened after a crash.
+ */
+
+#ifndef _CRED_DB_DEFS_H_
+#define _CRED_DB_DEFS_H_
+
+#include <stdint.h>
+
+#define CRED_DB_MAGIC         0x44434157  /* "WACD" */
+#define CRED_DB_VERSION       5
+#define CRED_DB_HEADER_SIZE   4096
+#define CRED_DB_PAGE_SIZE     4096
+#define CRED_DB_PAGE_RECORDS  32          /* the secrets and seal header of 32 still fit a page */
+#define CRED_DB_BATCH_PAGES   4           /* most new pages written by one `untrusted_cred_db_put_pages` */
+#define CRED_DB_UPDATE_PAGES  4           /* most pages rewritten by one `untrusted_cred_db_update` */
+#define CRED_DB_INITIAL_SLOTS 4096        /* power of two, the indexes are rebuilt past half full */
+#define CRED_DB_MAX_SLOTS     (1ULL << 28)
+#define CRED_DB_ID_SIZE       16          /* WEBAUTHN_CREDENTIAL_ID_SIZE */
+#define CRED_DB_KEY_SIZE      32          /* SGX_ECP256_KEY_SIZE */
+#define CRED_DB_HASH_SIZE     32          /* SHA256_DIGEST_SIZE */
+
+#define CRED_DB_SLOT_FREE     0           /* `ref` of a slot never used */
+#define CRED_DB_SLOT_DELETED  1           /* `ref` of a slot whose record was deleted */
+
+#define CRED_DB_RECORD_DELETED (1u << 0)
+
+typedef struct {
+    uint32_t magic;         /* CRED_DB_MAGIC */
+    uint32_t version;       /* CRED_DB_VERSION */
+    uint64_t index_slots;   /* power of two, the size of both indexes */
+    uint64_t num_records;   /* live records */
+    uint64_t used_slots;    /* index slots that are not free, deleted ones included */
+    uint64_t data_end;      /* end of the last page */
+    uint64_t tail_page;     /* the page new records go to while it has room, 0 for a new one */
+    uint64_t journal_page;  /* the page the journal holds an image of, 0 after a clean close */
+    uint64_t journal_sum;   /* of the image, a torn journal is not copied back */
+    uint64_t page_seq;      /* bumped before and after a page is rewritten in place, odd meanwhile */
+} cred_db_header_t;
+
+typedef struct {
+    uint64_t id_hash;       /* first 8 bytes of the credential ID */
+    uint64_t ref;           /* of the record, or CRED_DB_SLOT_* */
+} cred_db_slot_t;
+
+typedef struct {
+    uint64_t rp_hash;       /* first 8 bytes of the rpIdHash */
+    uint64_t head;          /* first record of the relying party, 0 if it has none left */
+    uint32_t count;         /* records in the list */
+    uint32_t used;
+} cred_db_rp_slot_t;
+
+typedef struct {
+    uint32_t count;         /* records in the page, deleted ones included */
+    uint32_t sealed_size;   /* bytes of sealed cred_db_page_secrets_t that follow */
+    uint32_t flags[CRED_DB_PAGE_RECORDS];      /* CRED_DB_RECORD_* */
+    uint64_t rp_hash[CRED_DB_PAGE_RECORDS];
+    uint64_t rp_next[CRED_DB_PAGE_RECORDS];    /* neighbours in the relying party's list, 0 at either end */
+    uint64_t rp_prev[CRED_DB_PAGE_RECORDS];
+    uint8_t ids[CRED_DB_PAGE_RECORDS][CRED_DB_ID_SIZE];  /* the first `count` are authenticated by the seal */
+} cred_db_page_t;
+
+/* Sealed after the page, unused and deleted records all zeroes */
+typedef struct {
+    uint8_t sk[CRED_DB_PAGE_RECORDS][CRED_DB_KEY_SIZE];
+    uint8_t rp_id_hash[CRED_DB_PAGE_RECORDS][CRED_DB_HASH_SIZE];
+    uint32_t meta[CRED_DB_PAGE_RECORDS];       /* algorithm and flags, see cred_db.h */
+    uint32_t counter[CRED_DB_PAGE_RECORDS];    /* signature counter as last written back, see sign_counter.h */
+    uint32_t counter_epoch[CRED_DB_PAGE_RECORDS];
+} cred_db_page_secrets_t;
+
+/* A page in an `untrusted_cred_db_update` buffer, followed by `sealed_size`
+ * bytes of its resealed cred_db_page_secrets_t */
+typedef struct {
+    uint8_t id[CRED_DB_ID_SIZE];    /* of a live record in the page */
+    uint32_t sealed_size;
+} cred_db_update_t;
+
+/* Counters of the enclave's cache of unsealed credentials, not part of
+ * the file format */
+typedef struct {
+    uint64_t budget;        /* bytes the cache may use */
+    uint32_t capacity;      /* credentials that fit in it */
+    uint32_t entries;       /* credentials in it now */
+    uint64_t hits;
+    uint64_t misses;        /* each one unsealed a record from the file */
+    uint64_t evictions;
+} cred_db_cache_stats_t;
+
+#define CRED_DB_JOURNAL_OFFSET CRED_DB_HEADER_SIZE
+#define CRED_DB_ID_INDEX_OFFSET (CRED_DB_JOURNAL_OFFSET + CRED_DB_PAGE_SIZE)
+
+#define CRED_DB_RP_INDEX_OFFSET(index_slots) \
+    (CRED_DB_ID_INDEX_OFFSET + (uint64_t)(index_slots) * sizeof(cred_db_slot_t))
+
+/* Offset of the first page */
+#define CRED_DB_PAGES_OFFSET(index_slots) \
+    ((CRED_DB_RP_INDEX_OFFSET(index_slots) + (uint64_t)(index_slots) * sizeof(cred_db_rp_slot_t) + \
+      CRED_DB_PAGE_SIZE - 1) & ~(uint64_t)(CRED_DB_PAGE_SIZE - 1))
+
+/* Records are referred to by page and index, which never reaches
+ * CRED_DB_PAGE_SIZE */
+#define CRED_DB_REF(page, index)  ((page) + (index))
+#define CRED_DB_REF_PAGE(ref)     ((ref) & ~(uint64_t)(CRED_DB_PAGE_SIZE - 1))
+#define CRED_DB_REF_INDEX(ref)    ((uint32_t)((ref) & (CRED_DB_PAGE_SIZE - 1)))
+
+#endif /* !_CRED_DB_DEFS_H_ */
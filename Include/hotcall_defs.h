@@ -0,0 +1,82 @@
+/*
+ * hotcall_defs.h - The request ring of resident enclave workers, shared
+ * between the app and the enclave.
+ *
+ * The host allocates the ring and hands it to the `hotcall_attach` ECALL.
+ * Worker threads then enter the enclave through `hotcall_worker` and stay
+ * there, polling the ring, until the host sets `stop`. A request costs
+ * the submitter no enclave transition, only the hand-off of a few cache
+ * lines.
+ *
+ * A submitter fills in one of `calls`, sets its state to
+ * HOTCALL_STATE_PENDING and enqueues its index. The ring is a bounded
+ * MPMC queue of sequence-numbered slots: slot `pos % HOTCALL_RING_SLOTS`
+ * holds request `pos` once its `seq` is `pos + 1`, and is free for
+ * request `pos + HOTCALL_RING_SLOTS` once a worker has taken it and set
+ * `seq` to that. Producers and consumers each claim positions by
+ * compare-and-swap on `enqueue_pos` and `dequeue_pos`.
+ *
+ * The worker writes the results into the call in place and sets its state
+ * to HOTCALL_STATE_DONE. A submitter spins for a while, then parks on the
+ * state word as a futex after changing it to HOTCALL_STATE_SLEEPING; a
+ * worker that finds it sleeping wakes it through the
+ * `untrusted_hotcall_wake` OCALL. Only requests whose submitter gave up
+ * spinning cost an enclave exit.
+ */
+
+#ifndef _HOTCALL_DEFS_H_
+#define _HOTCALL_DEFS_H_
+
+#include <stdint.h>
+
+#include "sgx_tcrypto.h"
+#include "webauthn_defs.h"
+
+#define HOTCALL_RING_SLOTS  64                  /* power of two */
+#define HOTCALL_CALLS       HOTCALL_RING_SLOTS  /* so the ring never fills up */
+#define HOTCALL_DATA_MAX    WEBAUTHN_CLIENT_DATA_INLINE_MAX
+
+/* Workers at once, each holds a TCS for as long as it runs. `TCSNum` in
+ * Enclave.config.xml leaves room for the ECALLs of the other threads */
+#define HOTCALL_MAX_WORKERS 4
+
+/* `op` of a call */
+#define HOTCALL_OP_SIGN_DIGEST   1  /* `data` is the digest, see `webauthn_sign_digest` */
+#define HOTCALL_OP_GET_ASSERTION 2  /* `data` is the clientDataJSON, see `webauthn_get_assertion` */
+
+/* `state` of a call */
+#define HOTCALL_STATE_FREE     0    /* the app's own, the enclave never sees it */
+#define HOTCALL_STATE_CLAIMED  1    /* being filled in by a submitter */
+#define HOTCALL_STATE_PENDING  2    /* enqueued */
+#define HOTCALL_STATE_SLEEPING 3    /* enqueued, its submitter waits on the futex */
+#define HOTCALL_STATE_DONE     4    /* `status` and the results are set */
+
+typedef struct {
+    uint64_t seq;
+    uint32_t call;          /* index into `calls` */
+} __attribute__((aligned(64))) hotcall_slot_t;
+
+typedef struct {
+    uint32_t state;         /* HOTCALL_STATE_*, also the futex word */
+    uint32_t op;            /* HOTCALL_OP_* */
+    uint32_t status;        /* sgx_status_t of the request, once done */
+    uint32_t flags;         /* authenticatorData flags, for HOTCALL_OP_GET_ASSERTION */
+    uint32_t data_size;     /* bytes of `data` */
+    char rp_id[WEBAUTHN_RP_ID_MAX + 1];  /* NUL-terminated, for HOTCALL_OP_GET_ASSERTION */
+    uint8_t data[HOTCALL_DATA_MAX];
+
+    /* Results */
+    uint8_t authenticator_data[WEBAUTHN_AUTHENTICATOR_DATA_SIZE];
+    sgx_ec256_signature_t signature;
+} __attribute__((aligned(64))) hotcall_call_t;
+
+typedef struct {
+    uint64_t enqueue_pos __attribute__((aligned(64)));
+    uint64_t dequeue_pos __attribute__((aligned(64)));
+    uint32_t stop __attribute__((aligned(64)));  /* set by the app to send the workers home */
+    uint32_t running;       /* workers in their loop, kept by the enclave */
+    hotcall_slot_t slots[HOTCALL_RING_SLOTS];
+    hotcall_call_t calls[HOTCALL_CALLS];
+} hotcall_ring_t;
+
+#endif /* !_HOTCALL_DEFS_H_ */
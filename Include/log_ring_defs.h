@@ -0,0 +1,43 @@
+/*
+ * log_ring_defs.h - The enclave's log ring, shared between the app and
+ * the enclave.
+ *
+ * The host allocates the ring and hands it to the `log_ring_attach`
+ * ECALL. Enclave threads then log with plain stores into host memory,
+ * without an OCALL, and a host thread drains the ring in the background.
+ *
+ * Message `seq` (counted from 1) goes to entry `(seq - 1) % LOG_RING_ENTRIES`.
+ * Its writer clears `seq` in the entry, writes the message and stores `seq`
+ * last. A reader expecting message `seq` copies the entry if it holds
+ * that `seq` before and after the copy. A larger `seq` means the enclave
+ * wrapped around and overwrote messages the host had not read yet. The
+ * enclave never reads the ring back and never waits for the host.
+ */
+
+#ifndef _LOG_RING_DEFS_H_
+#define _LOG_RING_DEFS_H_
+
+#include <stdint.h>
+
+#define LOG_RING_ENTRIES     256  /* power of two */
+#define LOG_RING_MESSAGE_MAX 240  /* longer messages are cut, the entry is 256 bytes */
+
+/* Levels of `log_ring_entry_t`, the enclave leaves LOG_LEVEL_DEBUG out
+ * of its release builds */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+
+typedef struct {
+    uint64_t seq;           /* message number, stored last; 0 while it is written */
+    uint32_t level;         /* LOG_LEVEL_* */
+    uint32_t size;          /* bytes of `message`, not NUL-terminated */
+    char message[LOG_RING_MESSAGE_MAX];
+} log_ring_entry_t;
+
+typedef struct {
+    log_ring_entry_t entries[LOG_RING_ENTRIES];
+} log_ring_t;
+
+#endif /* !_LOG_RING_DEFS_H_ */
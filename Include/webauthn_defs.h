@@ -0,0 +1,95 @@
+/*
+ * webauthn_defs.h - Definitions shared between the app and the enclave.
+ */
+
+#ifndef _WEBAUTHN_DEFS_H_
+#define _WEBAUTHN_DEFS_H_
+
+#include <stdint.h>
+
+/* Signing modes, see the `set_signing_mode` ECALL */
+#define SIGNING_MODE_RANDOMIZED    0  /* random nonces, served from the precomputed pool */
+#define SIGNING_MODE_DETERMINISTIC 1  /* deterministic nonces, uECC's RFC 6979 variant */
+
+/* Signed data: authenticatorData (rpIdHash, flags, signCount) || SHA-256(clientDataJSON) */
+#define WEBAUTHN_AUTHENTICATOR_DATA_SIZE 37
+#define WEBAUTHN_SIGNED_DATA_SIZE        (WEBAUTHN_AUTHENTICATOR_DATA_SIZE + 32)
+
+/* authenticatorData flags accepted by `webauthn_get_assertion` */
+#define WEBAUTHN_FLAG_UP 0x01  /* user present */
+#define WEBAUTHN_FLAG_UV 0x04  /* user verified */
+
+/* Credential IDs are random, the all-zero ID is the device credential
+ * used by the signing ECALLs that take no credential ID */
+#define WEBAUTHN_CREDENTIAL_ID_SIZE 16
+
+/* Per credential made by `webauthn_make_credentials`: its ID, then its
+ * public key as an sgx_ec256_public_t */
+#define WEBAUTHN_MADE_CREDENTIAL_SIZE (WEBAUTHN_CREDENTIAL_ID_SIZE + 64)
+
+/* Most credential IDs in the allowList of `webauthn_get_assertion_allow_list` */
+#define WEBAUTHN_ALLOW_LIST_MAX 64
+
+/* Most credentials returned for one relying party by `webauthn_list_credentials` */
+#define WEBAUTHN_LIST_MAX 256
+
+/* Longest rpId, a domain name */
+#define WEBAUTHN_RP_ID_MAX 253
+
+/* Marks a txAuthSimple event in the clientDataJSON, followed by the transaction text */
+#define WEBAUTHN_TX_AUTH_SIMPLE_TEXT "\"clientExtensions\":{\"txAuthSimple\":"
+
+/* Longest clientDataJSON accepted. Up to WEBAUTHN_CLIENT_DATA_INLINE_MAX bytes it is
+ * copied into the enclave by `webauthn_get_signature`, larger ones are read in place
+ * by `webauthn_get_signature_large` */
+#ifndef WEBAUTHN_CLIENT_DATA_MAX_SIZE
+#define WEBAUTHN_CLIENT_DATA_MAX_SIZE    (1 << 20)
+#endif
+#ifndef WEBAUTHN_CLIENT_DATA_INLINE_MAX
+#define WEBAUTHN_CLIENT_DATA_INLINE_MAX  4096
+#endif
+
+/* Streamed clientDataJSON, see `webauthn_stream_begin`: open streams at
+ * once and the largest chunk per `webauthn_stream_update` */
+#define WEBAUTHN_STREAM_MAX       16
+#define WEBAUTHN_STREAM_CHUNK_MAX (64 * 1024)
+
+/* Most requests in one `webauthn_get_signature_batch` call */
+#define WEBAUTHN_BATCH_MAX_REQUESTS 64
+
+/* Transactions waiting for the user's decision at once, see
+ * `begin_tx_confirmation`, and the longest transaction text shown */
+#define WEBAUTHN_TX_PENDING_MAX 16
+#define WEBAUTHN_TX_TEXT_MAX    1024
+
+/* Names a pending transaction to `complete_tx_confirmation`, only
+ * together with the MAC the enclave gave it */
+typedef struct {
+    uint32_t id;
+    uint8_t mac[16];
+} webauthn_tx_handle_t;
+
+/* Counters of the enclave's pool of pre-generated key pairs, see
+ * `key_pool_configure` */
+typedef struct {
+    uint32_t capacity;
+    uint32_t low_water;     /* refilled once it is down to this many */
+    uint32_t depth;         /* pairs ready now */
+    uint32_t reserved;
+    uint64_t hits;          /* registrations served from the pool */
+    uint64_t misses;        /* registrations that found it empty */
+    uint64_t refilled;
+} key_pool_stats_t;
+
+/* Counters of the enclave's per-thread scratch arenas, see `scratch_get_stats` */
+typedef struct {
+    uint32_t arena_size;    /* bytes of each arena */
+    uint32_t arenas;        /* taken from the heap by threads so far */
+    uint32_t peak;          /* most bytes in use at once in any one arena */
+    uint32_t reserved;
+    uint64_t allocations;   /* served from the arenas */
+    uint64_t fallbacks;     /* served from the heap, the arena was full or missing */
+    uint64_t fallback_peak; /* most bytes of fallbacks in use at once */
+} scratch_stats_t;
+
+#endif /* !_WEBAUTHN_DEFS_H_ */
@@ -0,0 +1,622 @@
+/*
+ * sign_counter_test.cpp - Crash recovery of the signature counters.
+ *
+ * Enclave/sign_counter.cpp is built natively, against fakes of the SDK's
+ * trusted locks, the seal key, the credential database and the host's
+ * write-ahead log. The log and the database live in shared memory, and
+ * each round runs in a child process of its own, standing in for one run
+ * of the enclave: it replays the log the previous round left, in a
+ * shuffled order, and opens the counters. Several threads then sign
+ * while a flush thread group commits and a disk thread writes the
+ * records late, fails some of them and tears a few, which leaves the rest
+ * of the log unreadable. The round ends with a clean close, or with a
+ * crash between two writes to the disk.
+ *
+ * Each round first takes one count of every credential signed so far. It
+ * must be above every count handed out before, and at most as far above
+ * the highest one as the recovery jumps since then allow.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "Enclave_t.h"
+#include "cred_db.h"
+#include "log_ring.h"
+#include "scratch.h"
+#include "seal_key.h"
+#include "sign_counter.h"
+
+#include "sgx_spinlock.h"
+#include "sgx_thread.h"
+#include "sgx_tseal.h"
+
+using namespace std;
+
+#define TEST_ROUNDS          96
+#define TEST_CREDENTIALS     1500  /* more than SIGN_COUNTER_MAX_ACTIVE, so counters are evicted */
+#define TEST_SIGNERS         4
+#define TEST_LOG_CAPACITY    (8 << 20)
+
+/* A credential's counter in the database */
+typedef struct {
+    uint32_t counter;
+    uint32_t epoch;
+} test_record_t;
+
+/* What survives a crash, shared by all rounds */
+typedef struct {
+    /* The log file, records each behind their 32-bit size. Replay stops
+     * at `log_readable`, the end of the last record before a torn one */
+    uint64_t log_size;
+    uint64_t log_readable;
+    uint32_t log_torn;
+    uint8_t log[TEST_LOG_CAPACITY];
+
+    test_record_t records[TEST_CREDENTIALS];
+    uint32_t issued[TEST_CREDENTIALS];     /* highest count handed out */
+    uint64_t issued_at[TEST_CREDENTIALS];  /* `crashes` when it was */
+    uint32_t last_clean;                   /* the last round closed the counters */
+
+    /* Coverage, and the result */
+    uint64_t appends;
+    uint64_t snapshots;
+    uint64_t failures;
+    uint64_t tears;
+    uint64_t rejects;
+    uint64_t replays;
+    uint64_t write_backs;
+    uint64_t crashes;
+    uint64_t counts;
+    uint32_t bad;
+} test_disk_t;
+
+/* A record the enclave handed to the host, not yet written */
+typedef struct {
+    vector<uint8_t> record;
+    uint64_t seq;
+    bool reset;
+} test_write_t;
+
+static test_disk_t *disk = NULL;
+
+/* How the round goes. Rates are 0 for never */
+static uint32_t fail_one_in = 0;    /* writes reported failed through `sign_counter_persisted` */
+static uint32_t reject_one_in = 0;  /* records refused by the OCALL itself */
+static uint32_t write_us = 0;       /* longest a write takes */
+static uint32_t hot = 0;            /* credentials signed with most of the time */
+static uint32_t round_seed = 0;
+
+static mutex disk_mutex;            /* held across every write, and by a crash */
+static mutex db_mutex;
+static mutex queue_mutex;
+static condition_variable queue_cond;
+static deque<test_write_t> queue;
+static atomic<bool> stopping(false);
+static atomic<bool> disk_stopping(false);
+
+static uint32_t rnd(uint32_t n)
+{
+    static atomic<uint32_t> streams(0);
+    thread_local minstd_rand engine(round_seed * 7919 + streams++);
+    return n ? (uint32_t)(engine() % n) : 0;
+}
+
+static bool chance(uint32_t one_in)
+{
+    return one_in && rnd(one_in) == 0;
+}
+
+static void fail(const char *what, uint64_t value)
+{
+    fprintf(stderr, "Round %u: %s %llu\n", round_seed, what, (unsigned long long)value);
+    __atomic_add_fetch(&disk->bad, 1, __ATOMIC_RELAXED);
+}
+
+static void credential_id(uint32_t c, uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE])
+{
+    memset(id, 0xa5, WEBAUTHN_CREDENTIAL_ID_SIZE);
+    memcpy(id, &c, sizeof(c));
+}
+
+static bool credential_index(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE], uint32_t *ret_c)
+{
+    uint8_t expected[WEBAUTHN_CREDENTIAL_ID_SIZE];
+    uint32_t c;
+
+    memcpy(&c, id, sizeof(c));
+    if (c >= TEST_CREDENTIALS) {
+        return false;
+    }
+    credential_id(c, expected);
+    *ret_c = c;
+    return memcmp(id, expected, WEBAUTHN_CREDENTIAL_ID_SIZE) == 0;
+}
+
+/* The SDK's trusted locks, for plain threads. Waiters yield, the test
+ * is after interleavings rather than speed */
+uint32_t sgx_spin_lock(sgx_spinlock_t *lock)
+{
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    return 0;
+}
+
+uint32_t sgx_spin_unlock(sgx_spinlock_t *lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int sgx_thread_mutex_lock(sgx_thread_mutex_t *mutex)
+{
+    sgx_spin_lock(&mutex->m_lock);
+    return 0;
+}
+
+int sgx_thread_mutex_unlock(sgx_thread_mutex_t *mutex)
+{
+    sgx_spin_unlock(&mutex->m_lock);
+    return 0;
+}
+
+/* A condition's lock word counts its broadcasts. Waits may wake up
+ * spuriously, as they may in the SDK */
+int sgx_thread_cond_wait(sgx_thread_cond_t *cond, sgx_thread_mutex_t *mutex)
+{
+    const uint32_t seen = __atomic_load_n(&cond->m_lock, __ATOMIC_ACQUIRE);
+
+    sgx_thread_mutex_unlock(mutex);
+    for (int i = 0; i < 1000 && __atomic_load_n(&cond->m_lock, __ATOMIC_ACQUIRE) == seen; i++) {
+        sched_yield();
+    }
+    sgx_thread_mutex_lock(mutex);
+    return 0;
+}
+
+int sgx_thread_cond_signal(sgx_thread_cond_t *cond)
+{
+    __atomic_add_fetch(&cond->m_lock, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int sgx_thread_cond_broadcast(sgx_thread_cond_t *cond)
+{
+    __atomic_add_fetch(&cond->m_lock, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void *scratch_alloc(size_t size)
+{
+    return malloc(size);
+}
+
+void scratch_free(void *buffer)
+{
+    free(buffer);
+}
+
+void log_write(uint32_t level, const char *fmt, ...)
+{
+    (void)level;
+    (void)fmt;
+}
+
+/* Sealing only frames the payload, the counters do not look inside */
+int seal_key_is_sealed(const uint8_t *sealed, uint32_t sealed_size)
+{
+    seal_key_header_t header;
+
+    if (sealed_size < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, sealed, sizeof(header));
+    return header.magic == SEAL_KEY_MAGIC;
+}
+
+sgx_status_t seal_key_seal(const uint8_t *aad, uint32_t aad_size,
+                           const uint8_t *payload, uint32_t payload_size,
+                           uint8_t *sealed, uint32_t sealed_size)
+{
+    seal_key_header_t header;
+
+    if (sealed_size != SEAL_KEY_SEALED_SIZE(payload_size)) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+    memset(&header, 0, sizeof(header));
+    header.magic = SEAL_KEY_MAGIC;
+    header.payload_size = payload_size;
+    memcpy(sealed, &header, sizeof(header));
+    memcpy(sealed + sizeof(header), payload, payload_size);
+    return SGX_SUCCESS;
+}
+
+sgx_status_t seal_key_unseal(const uint8_t *aad, uint32_t aad_size,
+                             const uint8_t *sealed, uint32_t sealed_size,
+                             uint8_t *payload, uint32_t *payload_size)
+{
+    seal_key_header_t header;
+
+    if (!seal_key_is_sealed(sealed, sealed_size)) {
+        return SGX_ERROR_MAC_MISMATCH;
+    }
+    memcpy(&header, sealed, sizeof(header));
+    if (header.payload_size != sealed_size - sizeof(header) || header.payload_size > *payload_size) {
+        return SGX_ERROR_MAC_MISMATCH;
+    }
+    memcpy(payload, sealed + sizeof(header), header.payload_size);
+    *payload_size = header.payload_size;
+    return SGX_SUCCESS;
+}
+
+/* Every record is written by `seal_key_seal`, none of them is legacy */
+uint32_t sgx_get_encrypt_txt_len(const sgx_sealed_data_t *p_sealed_data)
+{
+    return UINT32_MAX;
+}
+
+sgx_status_t sgx_unseal_data(const sgx_sealed_data_t *p_sealed_data, uint8_t *p_additional_MACtext,
+                             uint32_t *p_additional_MACtext_length, uint8_t *p_decrypted_text,
+                             uint32_t *p_decrypted_text_length)
+{
+    return SGX_ERROR_MAC_MISMATCH;
+}
+
+/* The database writes its pages synchronously, a crash cannot lose them */
+sgx_status_t cred_db_get_counter(const uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE],
+                                 uint32_t *ret_counter, uint32_t *ret_epoch)
+{
+    uint32_t c;
+
+    if (!credential_index(id, &c)) {
+        return SGX_ERROR_INVALID_PARAMETER;
+    }
+
+    lock_guard<mutex> lock(db_mutex);
+    *ret_counter = disk->records[c].counter;
+    *ret_epoch = disk->records[c].epoch;
+    return SGX_SUCCESS;
+}
+
+/* As `merge_counter` in Enclave/cred_db.cpp */
+sgx_status_t cred_db_set_counters(const cred_counter_t *counters, uint32_t count, uint32_t epoch)
+{
+    lock_guard<mutex> lock(db_mutex);
+
+    for (uint32_t i = 0; i < count; i++) {
+        test_record_t *record;
+        uint32_t counter = counters[i].counter;
+        uint32_t counter_epoch = epoch;
+        uint32_t c;
+
+        if (!credential_index(counters[i].id, &c)) {
+            continue;
+        }
+        record = &disk->records[c];
+
+        if (record->epoch > counter_epoch) {
+            counter = sign_counter_rebase(counter, counter_epoch, record->epoch);
+            counter_epoch = record->epoch;
+        }
+        const uint32_t stored = sign_counter_rebase(record->counter, record->epoch, counter_epoch);
+        record->counter = stored > counter ? stored : counter;
+        record->epoch = counter_epoch;
+    }
+    disk->write_backs += count;
+    return SGX_SUCCESS;
+}
+
+static sgx_status_t queue_write(int32_t *retval, const uint8_t *record, size_t record_size, uint64_t seq, bool reset)
+{
+    if (chance(reject_one_in)) {
+        __atomic_add_fetch(&disk->rejects, 1, __ATOMIC_RELAXED);
+        *retval = 1;
+        return SGX_SUCCESS;
+    }
+
+    test_write_t write;
+    write.record.assign(record, record + record_size);
+    write.seq = seq;
+    write.reset = reset;
+
+    lock_guard<mutex> lock(queue_mutex);
+    queue.push_back(write);
+    queue_cond.notify_one();
+    *retval = 0;
+    return SGX_SUCCESS;
+}
+
+sgx_status_t untrusted_wal_append(int32_t *retval, const uint8_t *record, size_t record_size, uint64_t seq)
+{
+    return queue_write(retval, record, record_size, seq, false);
+}
+
+sgx_status_t untrusted_wal_reset(int32_t *retval, const uint8_t *record, size_t record_size, uint64_t seq)
+{
+    return queue_write(retval, record, record_size, seq, true);
+}
+
+static void log_put(const test_write_t &write)
+{
+    const uint32_t size = (uint32_t)write.record.size();
+
+    memcpy(disk->log + disk->log_size, &size, sizeof(size));
+    memcpy(disk->log + disk->log_size + sizeof(size), &write.record[0], size);
+    disk->log_size += sizeof(size) + size;
+}
+
+/* Write one record as the host would, 0 once it is on disk. A failed
+ * write may have landed anyway, or torn the log */
+static int32_t disk_write(const test_write_t &write)
+{
+    lock_guard<mutex> lock(disk_mutex);
+    const bool failed = chance(fail_one_in);
+    const bool landed = !failed || chance(2);
+
+    if (write.reset) {
+        /* Written aside and renamed over the log, all or nothing */
+        if (landed) {
+            disk->log_size = 0;
+            log_put(write);
+            disk->log_readable = disk->log_size;
+            disk->log_torn = 0;
+            disk->snapshots++;
+        }
+    } else if (disk->log_size + sizeof(uint32_t) + write.record.size() > TEST_LOG_CAPACITY) {
+        return 1;
+    } else if (landed) {
+        log_put(write);
+        if (!disk->log_torn) {
+            disk->log_readable = disk->log_size;
+        }
+        disk->appends++;
+    } else {
+        disk->log_torn = 1;
+        disk->tears++;
+    }
+
+    if (failed) {
+        disk->failures++;
+    }
+    return failed ? 1 : 0;
+}
+
+static void disk_loop(void)
+{
+    for (;;) {
+        test_write_t write;
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            while (queue.empty() && !disk_stopping) {
+                queue_cond.wait(lock);
+            }
+            if (queue.empty()) {
+                return;
+            }
+            write = queue.front();
+            queue.pop_front();
+        }
+
+        /* Let a few records queue up */
+        this_thread::sleep_for(chrono::microseconds(rnd(write_us)));
+
+        const int32_t error = disk_write(write);
+        if (sign_counter_persisted(write.seq, error) != SGX_SUCCESS) {
+            fail("persisted out of order, record", write.seq);
+        }
+    }
+}
+
+static void flush_loop(void)
+{
+    while (!stopping) {
+        sign_counter_flush();
+        this_thread::sleep_for(chrono::microseconds(rnd(1000)));
+    }
+}
+
+/* Take the next count of credential `c`. Counts handed out are recorded
+ * once returned: one taken just before a crash may never be */
+static sgx_status_t take_count(uint32_t c, uint32_t *ret_count)
+{
+    uint8_t id[WEBAUTHN_CREDENTIAL_ID_SIZE];
+    uint32_t count;
+
+    credential_id(c, id);
+    sgx_status_t status = sign_counter_next(id, &count);
+    if (status) {
+        return status;
+    }
+
+    uint32_t issued = __atomic_load_n(&disk->issued[c], __ATOMIC_RELAXED);
+    while (count > issued &&
+           !__atomic_compare_exchange_n(&disk->issued[c], &issued, count, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    __atomic_store_n(&disk->issued_at[c], disk->crashes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&disk->counts, 1, __ATOMIC_RELAXED);
+
+    *ret_count = count;
+    return SGX_SUCCESS;
+}
+
+static void sign_loop(void)
+{
+    uint32_t count;
+
+    while (!stopping) {
+        const uint32_t c = chance(5) ? rnd(TEST_CREDENTIALS) : rnd(hot);
+        take_count(c, &count);
+    }
+}
+
+/* Replay whatever part of the log is readable, in any order */
+static void replay(void)
+{
+    vector<pair<uint64_t, uint32_t> > records;
+    uint64_t pos = 0;
+    uint32_t size;
+
+    while (pos + sizeof(size) <= disk->log_readable) {
+        memcpy(&size, disk->log + pos, sizeof(size));
+        if (pos + sizeof(size) + size > disk->log_readable) {
+            break;
+        }
+        records.push_back(make_pair(pos + sizeof(size), size));
+        pos += sizeof(size) + size;
+    }
+
+    shuffle(records.begin(), records.end(), minstd_rand(round_seed));
+    for (size_t i = 0; i < records.size(); i++) {
+        if (sign_counter_replay(disk->log + records[i].first, records[i].second) != SGX_SUCCESS) {
+            fail("failed to replay record", i);
+        }
+    }
+    disk->replays += records.size();
+}
+
+static void run_round(uint32_t round)
+{
+    vector<thread> threads;
+    uint32_t count;
+    uint32_t c;
+
+    round_seed = round;
+    fail_one_in = (round % 4 == 1) ? 8 : (round % 4 == 2) ? 64 : 0;
+    reject_one_in = (round % 5 == 3) ? 200 : 0;
+    write_us = (round / 4 % 3 == 0) ? 2000 : 200;
+    hot = (round / 12 % 2 == 0) ? 4 : 200;
+    const bool clean = rnd(3) == 0;
+
+    /* Counted here, so that it stays the same while counts are taken */
+    if (round && !disk->last_clean) {
+        disk->crashes++;
+    }
+    disk->last_clean = 0;
+    alarm(30);
+
+    replay();
+
+    thread disk_thread(disk_loop);
+    if (sign_counter_open() != SGX_SUCCESS) {
+        /* Its snapshot may be on disk anyway, with the counters jumped */
+        disk_stopping = true;
+        queue_cond.notify_one();
+        disk_thread.join();
+        _exit(0);
+    }
+    threads.push_back(thread(flush_loop));
+
+    /* Nothing goes back, however the last round ended. After a crash,
+     * counts a signer took but had not recorded yet may be lost, and all
+     * counters jump */
+    for (c = 0; c < TEST_CREDENTIALS; c++) {
+        const uint32_t issued = disk->issued[c];
+        const uint64_t slack = 1 + (disk->crashes - disk->issued_at[c]) * (SIGN_COUNTER_RECOVERY_JUMP + TEST_SIGNERS);
+        sgx_status_t status;
+        int tries = 0;
+
+        if (!issued) {
+            continue;
+        }
+        while ((status = take_count(c, &count)) != SGX_SUCCESS && ++tries < 100) {
+        }
+        if (status) {
+            fail("no count for credential", c);
+        } else if (count <= issued || count - issued > slack) {
+            fprintf(stderr, "Round %u: credential %u counted %u after %u, at most %llu above it\n",
+                    round, c, count, issued, (unsigned long long)slack);
+            disk->bad++;
+        }
+    }
+
+    for (int i = 0; i < TEST_SIGNERS; i++) {
+        threads.push_back(thread(sign_loop));
+    }
+    this_thread::sleep_for(chrono::milliseconds(20 + rnd(100)));
+
+    if (!clean) {
+        /* Between two writes, with the rest of the queue lost */
+        disk_mutex.lock();
+        db_mutex.lock();
+        _exit(0);
+    }
+
+    stopping = true;
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    const sgx_status_t status = sign_counter_close();
+
+    disk_stopping = true;
+    queue_cond.notify_one();
+    disk_thread.join();
+
+    disk->last_clean = status == SGX_SUCCESS;
+    _exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    void *shared = mmap(NULL, sizeof(test_disk_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    disk = (test_disk_t*)shared;
+
+    for (uint32_t round = 0; round < TEST_ROUNDS; round++) {
+        int status;
+
+        fflush(stdout);
+        const pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            run_round(round);
+        }
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Round %u did not finish\n", round);
+            disk->bad++;
+        }
+    }
+
+    printf("%llu counts, %llu records appended, %llu snapshots, %llu replayed, %llu written back\n",
+           (unsigned long long)disk->counts, (unsigned long long)disk->appends,
+           (unsigned long long)disk->snapshots, (unsigned long long)disk->replays,
+           (unsigned long long)disk->write_backs);
+    printf("%llu crashes, %llu failed writes, %llu torn, %llu refused\n",
+           (unsigned long long)disk->crashes, (unsigned long long)disk->failures,
+           (unsigned long long)disk->tears, (unsigned long long)disk->rejects);
+
+    /* Each path has to have been taken for the run to mean anything */
+    if (!disk->crashes || !disk->replays || !disk->write_backs || !disk->tears || !disk->rejects ||
+        disk->snapshots <= TEST_ROUNDS) {
+        fprintf(stderr, "Not every recovery path was exercised\n");
+        disk->bad++;
+    }
+
+    if (disk->bad) {
+        printf("FAILED: %u errors\n", disk->bad);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,24 @@
+/*
+ * tlibc.h - What the enclave modules use from the SDK's trusted C
+ * library and glibc does not have, for building them natively. Included
+ * ahead of every source, see the Makefile.
+ */
+
+#ifndef _TEST_TLIBC_H_
+#define _TEST_TLIBC_H_
+
+#include <stddef.h>
+#include <string.h>
+
+/* A `memset` that is not optimized away */
+static inline int memset_s(void *s, size_t smax, int c, size_t n)
+{
+    if (n > smax) {
+        return -1;
+    }
+    memset(s, c, n);
+    __asm__ volatile("" : : "r"(s) : "memory");
+    return 0;
+}
+
+#endif /* !_TEST_TLIBC_H_ */